@@ -1,165 +1,374 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string>
 #include <algorithm>
 #include "amazon.h"
 #include <iostream>
+#include <fstream>
 #include <tuple>
-#include <set>
+#include <map>
 #include <unordered_map>
 #include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <climits>
+#include <cstdint>
+#include <thread>
 
 using namespace std;
 
 vector<vector<string>> convertQuery(string query);
+const char * getElementStartPtr(const void * const file, const unsigned int index);
+static const unsigned int * keywordPostingBlock(const char * const keywordPtr, unsigned int& numEntries);
+
+// A sidecar file describes one particular build of the file it was derived from, so it
+// records that file's identity: its size, split into two unsigned ints (low word first),
+// and a checksum of its count and offset array, which moves whenever any element does.
+static const unsigned int kSourceIdentityWords = 3;
+
+static unsigned int offsetArrayChecksum(const void *file) {
+    // FNV-1a, a word at a time
+    const unsigned int *words = (const unsigned int *) file;
+    unsigned int checksum = 2166136261u;
+    for (size_t i = 0; i <= (size_t) words[0]; i++) checksum = (checksum ^ words[i]) * 16777619u;
+    return checksum;
+}
+
+static void sourceIdentity(const void *file, size_t fileSize, unsigned int identity[kSourceIdentityWords]) {
+    identity[0] = (unsigned int) fileSize;
+    identity[1] = (unsigned int) ((uint64_t) fileSize >> 32);
+    identity[2] = offsetArrayChecksum(file);
+}
+
+static bool matchesSource(const unsigned int *recorded, const void *file, size_t fileSize) {
+    unsigned int identity[kSourceIdentityWords];
+    sourceIdentity(file, fileSize, identity);
+    return equal(identity, identity + kSourceIdentityWords, recorded);
+}
+
+// The skip index starts with a header of seven unsigned ints:
+//     magic, block size, number of keywords, number of skip entries, and the keyword
+//     index's identity
+// followed by numKeywords + 1 unsigned ints giving, for each keyword in index order, the
+// position of its first skip entry (keyword k owns entries [first[k], first[k + 1])), and
+// then the SkipEntry array itself.  Lists no longer than one block get no entries.
+static const unsigned int kSkipIndexMagic = 0x32504b53; // "SKP2"
+static const unsigned int kSkipIndexHeaderWords = 4 + kSourceIdentityWords;
+
+// The compressed keyword index has the same layout as the plain one (keyword count, offset
+// array, one entry per keyword), except that every entry is 4-byte aligned and holds
+//     keyword (null-terminated, padded to a multiple of 4 bytes)
+//     unsigned int numPostings
+//     SkipEntry blocks[ceil(numPostings / kCompressedBlockSize)]
+//     the encoded blocks (see posting_list.h), padded to a multiple of 4 bytes
+// and the file ends with a trailer: magic, block size, and the plain keyword index's identity.
+static const unsigned int kCompressedIndexMagic = 0x324b5043; // "CPK2"
+static const unsigned int kCompressedIndexTrailerWords = 2 + kSourceIdentityWords;
+
+// The sort key table is a six-word header (magic, number of reviews, the review database's
+// identity, and a zero word that keeps the first column 8-byte aligned) followed by one
+// column per property, each indexed by review index:
+//     uint64_t titlePrefix[n], unsigned int date[n], titleSize[n], headlineSize[n],
+//     bodySize[n], and finally unsigned char starRating[n]
+static const unsigned int kSortKeyTableMagic = 0x32545253; // "SRT2"
+static const unsigned int kSortKeyTableHeaderWords = 3 + kSourceIdentityWords;
+
+static size_t sortKeyTableSize(unsigned int numReviews) {
+    return kSortKeyTableHeaderWords * sizeof(unsigned int) +
+        (size_t) numReviews * (sizeof(uint64_t) + 4 * sizeof(unsigned int) + 1);
+}
+
+amazon::amazon(const string& directory, const string& filesPrefix, const ResidencyPolicy& residency) :
+    amazon(directory, filesPrefix, residency, true) {}
+
+amazon::amazon(const string& directory, const string& filesPrefix, const ResidencyPolicy& residency,
+    bool loadSegments) : residency(residency), directory(directory), filesPrefix(filesPrefix) {
+    if (loadSegments && ownFilesReplaced()) {
+        // A compaction has merged this instance's own files into a later base segment, so
+        // only the segments listed in the manifest are opened
+        databaseFile = keywordIndexFile = skipIndexFile = sortKeyFile = nullptr;
+        compressedPostings = false;
+        for (fileInfo *info : {&databaseInfo, &keywordIndexInfo, &skipIndexInfo, &sortKeyInfo}) {
+            info->fd = -1;
+            info->fileSize = 0;
+            info->fileMap = NULL;
+        }
+        if (!refreshSegments()) {
+            cerr << "Problem opening the segments listed in " << filesPrefix << "_segments.txt" << endl;
+        }
+        return;
+    }
 
-amazon::amazon(const string& directory, const string& filesPrefix) {
     const string databaseFileName = directory + "/" + filesPrefix + ".bin";
     const string keywordIndexFileName = directory + "/" + filesPrefix + "_keyword_index.bin";  
-    databaseFile = acquireFileMap(databaseFileName, databaseInfo);
-    keywordIndexFile = acquireFileMap(keywordIndexFileName, keywordIndexInfo);
+    databaseFile = acquireFileMap(databaseFileName, databaseInfo, residency.hugePages);
+    compressedPostings = false;
+    keywordIndexFile = acquireFileMap(keywordIndexFileName, keywordIndexInfo, residency.hugePages);
+    loadCompressedIndex(directory + "/" + filesPrefix + "_keyword_index_compressed.bin");
+    skipIndexFile = nullptr;
+    skipIndexInfo.fd = -1;
+    skipIndexInfo.fileMap = NULL;
+    // Skip entries point into the plain index; compressed lists carry their own block tables
+    if (good() && !compressedPostings) loadSkipIndex(directory + "/" + filesPrefix + "_keyword_skips.bin");
+    sortKeyFile = nullptr;
+    sortKeyInfo.fd = -1;
+    sortKeyInfo.fileMap = NULL;
+    if (good()) loadSortKeyTable(directory + "/" + filesPrefix + "_sort_keys.bin");
+    if (good()) applyResidencyPolicy(residency);
+    if (good()) keywords.build(keywordIndexFile);
+    shared_ptr<MappedFiles> files = make_shared<MappedFiles>();
+    files->infos[0] = databaseInfo;
+    files->infos[1] = keywordIndexInfo;
+    files->infos[2] = skipIndexInfo;
+    files->infos[3] = sortKeyInfo;
+    files->owner = this;
+    ownFiles = files;
+    ownFilesHandle = ownFiles;
+    if (!good() || !loadSegments) return;
+    // Start out with just this instance's own files, in case the segments can't be opened
+    installSegments(vector<string>(1, filesPrefix));
+    if (!refreshSegments()) {
+        cerr << "Problem opening the segments listed in " << filesPrefix << "_segments.txt" << endl;
+    }
 }
 
+static const size_t kHugePageSize = 2 << 20;
 
-bool amazon::good() const {
-    return !( (databaseInfo.fd == -1) || 
-            (keywordIndexInfo.fd == -1) ); 
+static size_t pageSize() {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
 }
 
-amazon::~amazon() {
-    releaseFileMap(databaseInfo);
-    releaseFileMap(keywordIndexInfo);
+// Faults in every page of [start, start + length) by reading one byte from each
+static void touchPages(const void *start, size_t length) {
+    const volatile char *bytes = (const volatile char *) start;
+    for (size_t offset = 0; offset < length; offset += pageSize()) (void) bytes[offset];
+    if (length > 0) (void) bytes[length - 1];
 }
 
-const char * amazon::findKeywordPtr(const std::string& keyword) const {
-    unsigned int * offsetArrayStart = (unsigned int *) keywordIndexFile + 1;
-    unsigned int numKeywords = * (unsigned int *) keywordIndexFile;    
-   
-    // Find the keyword in the keywordIndexFile
-    auto keywordIndexFile = this->keywordIndexFile;
-    auto compare = [keywordIndexFile](unsigned int offset, std::string referenceKeyword) -> bool {
-        const char * str = (char *) keywordIndexFile + offset;
-        std::string queryKeyword = std::string(str);
-        return queryKeyword < referenceKeyword;
+// madvise wants a page-aligned start; widen [start, start + length) to page boundaries
+static void adviseRange(const void *start, size_t length, int advice) {
+    uintptr_t first = (uintptr_t) start & ~(pageSize() - 1);
+    uintptr_t end = (uintptr_t) start + length;
+    if (madvise((void *) first, end - first, advice) != 0) {
+        cerr << "madvise(" << advice << ") failed: " << strerror(errno) << endl;
+    }
+}
+
+void amazon::applyResidencyPolicy(const ResidencyPolicy& residency) {
+    // Both the review database and the keyword index start with a count and an offset array
+    struct { const void *map; size_t size; } offsetArrays[] = {
+        {databaseFile, (1 + (size_t) localReviews()) * sizeof(unsigned int)},
+        {keywordIndexFile, (1 + (size_t) localKeywords()) * sizeof(unsigned int)},
     };
-    auto offsetArrayPtr = std::lower_bound(offsetArrayStart, offsetArrayStart + numKeywords, keyword, compare);
-    // If keyword not found, return a nullptr
-    if (offsetArrayPtr == offsetArrayStart + numKeywords) return nullptr; 
-    auto offset = * offsetArrayPtr;
-    const char * queryKeyword = (char *) keywordIndexFile + offset; 
-    // If keyword not found, return a nullptr
-    if (std::string(queryKeyword) != keyword) return nullptr;
-    return queryKeyword;
-}
-
-struct KeywordInfo {
-    unsigned int reviewIndex;
-    unsigned char reviewPortion;
-    unsigned int wordOffset;
-
-    // We need to overload the comparison operator to allow insertion into a set
-    bool operator<(const KeywordInfo& other) const {
-        return reviewIndex < other.reviewIndex ||
-            (reviewIndex == other.reviewIndex && reviewPortion < other.reviewPortion) ||
-            (reviewIndex == other.reviewIndex && reviewPortion == other.reviewPortion && wordOffset < other.wordOffset);
-    }
-};
-
-KeywordInfo parse_keyword_info(const unsigned int * const keywordInfoBlock) {
-    KeywordInfo keywordInfo;
-    keywordInfo.reviewIndex = *keywordInfoBlock;
-    unsigned int keywordInfoByte = *(keywordInfoBlock + 1);
-    keywordInfo.reviewPortion = (keywordInfoByte & 0xFF000000) >> 24;
-    keywordInfo.wordOffset = (keywordInfoByte & 0x00FFFFFF);
-    return keywordInfo;
-}
-
-std::set<unsigned int> amazon::findReviewsContainingTerm(const std::vector<std::string>& term) const {
-    std::set<unsigned int> reviewIndices;
-    std::set<KeywordInfo> keywordInfoSet;
-    std::set<KeywordInfo> newKeywordInfoSet;
-    bool isFirst = true; // Is it the first iteration of the outer loop?
-
-    for (auto it = term.begin(); it != term.end(); ++it)  {
-        newKeywordInfoSet.clear();
-        const char * keywordPtr = findKeywordPtr(*it);
-        if (keywordPtr == nullptr) {
-            // Keyword was not found in the database, i.e no matching reviews
-            // Return empty set
-            reviewIndices.clear();
-            return reviewIndices;
-        }
 
-        const std::string keyword = keywordPtr;
-        assert(keyword == *it);
-        // Pointer arithmetic to find start of array containing review info w.r.t keyword
-        // If keyword has even length, null terminator makes it odd length, so add one more byte to make it even
-        const size_t keywordBytes = keyword.length() % 2 == 0 ? keyword.length() + 2 : keyword.length() + 1; 
-        
-        const unsigned int numEntries = *(unsigned int *)(keywordPtr + keywordBytes);
-        const unsigned int * keywordInfoBlockStart = (unsigned int *)(keywordPtr + keywordBytes + 4);
-        
-        // Iterate over all reviews in the keyword information block
-        for (unsigned int i = 0; i < numEntries; i ++) {
-            KeywordInfo keywordInfo = parse_keyword_info(keywordInfoBlockStart + 2*i);
-            if (isFirst) {
-                // Add every review containing first keyword to the set
-                newKeywordInfoSet.insert(keywordInfo);
-            } 
-            else {
-                // Only add reviews containing previous keyword in correct position
-                // Because we iterate from first keyword to last, we need only cache the previous keyword's location, not its value
-                KeywordInfo prevKeywordInfo = keywordInfo;
-                prevKeywordInfo.wordOffset -= 1;
-                const bool prev_is_in = keywordInfoSet.find(prevKeywordInfo) != keywordInfoSet.end();
-                if (prev_is_in) newKeywordInfoSet.insert(keywordInfo);
+    if (residency.randomReviews) {
+        const size_t recordsStart = offsetArrays[0].size;
+        adviseRange((const char *) databaseFile + recordsStart, databaseInfo.fileSize - recordsStart, MADV_RANDOM);
+    }
+    if (residency.hugePages) {
+        for (const fileInfo *info : {&databaseInfo, &keywordIndexInfo, &skipIndexInfo, &sortKeyInfo}) {
+            if (info->fileMap != NULL && info->fileMap != MAP_FAILED) adviseRange(info->fileMap, info->fileSize, MADV_HUGEPAGE);
+        }
+    }
+    if (residency.populateOffsets || residency.lockOffsets) {
+        for (const auto& offsets : offsetArrays) {
+            adviseRange(offsets.map, offsets.size, MADV_WILLNEED);
+            touchPages(offsets.map, offsets.size);
+        }
+    }
+    if (residency.lockOffsets) {
+        for (const auto& offsets : offsetArrays) {
+            uintptr_t first = (uintptr_t) offsets.map & ~(pageSize() - 1);
+            if (mlock((const void *) first, (uintptr_t) offsets.map + offsets.size - first) != 0) {
+                cerr << "Could not lock offset array in memory: " << strerror(errno) << endl;
             }
         }
-        keywordInfoSet = newKeywordInfoSet;
+    }
+    if (residency.warm) warm();
+}
 
-        // After the first outer loop, behaviour changes
-        isFirst = false;
-     
+void amazon::warm() const {
+    shared_ptr<const SegmentSet> set = currentSegments();
+    if (set) {
+        for (const shared_ptr<const amazon>& segment : set->segments) segment->warm();
+        if (!set->includesSelf) return;
     }
-    // keywordInfoSet now contains the review indices that match the entire term
-    for (const auto & element : keywordInfoSet) {
-        reviewIndices.insert(element.reviewIndex);
+    for (const fileInfo *info : {&databaseInfo, &keywordIndexInfo, &skipIndexInfo, &sortKeyInfo}) {
+        if (info->fileMap == NULL || info->fileMap == MAP_FAILED || info->fileSize == 0) continue;
+        // Start asynchronous readahead of the whole file, then wait for it page by page
+        adviseRange(info->fileMap, info->fileSize, MADV_WILLNEED);
+        touchPages(info->fileMap, info->fileSize);
     }
+}
 
-    return reviewIndices;
+static thread_local PageFaultCounts lastQueryFaults = {0, 0};
+
+PageFaultCounts amazon::threadPageFaults() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) return PageFaultCounts {0, 0};
+    return PageFaultCounts {usage.ru_minflt, usage.ru_majflt};
 }
 
+PageFaultCounts amazon::lastQueryPageFaults() {
+    return lastQueryFaults;
+}
 
-bool amazon::searchKeywordIndex(const string& query, vector<unsigned int>& reviewIndexes) const {
-    vector<vector<string>> allSearchTerms = convertQuery(query);
-    std::set<unsigned int> reviewIndices;
-    bool isFirst = true;
-    for (auto& term : allSearchTerms) {
-         std::set<unsigned int> currentTermReviewIndices = findReviewsContainingTerm(term);
-         if (isFirst) {
-             isFirst = false;
-             reviewIndices = currentTermReviewIndices;
-         }
-         else {
-             std::set<unsigned int> intersect;
+QueryStats amazon::lastQueryStats() {
+    return threadQueryStats();
+}
 
-             std::set_intersection(
-                 currentTermReviewIndices.begin(), currentTermReviewIndices.end(),
-                 reviewIndices.begin(), reviewIndices.end(),
-                 std::inserter(intersect, intersect.begin())
-             );
-             reviewIndices = intersect;
+void amazon::loadSortKeyTable(const string& sortKeyFileName) {
+    // Like the skip index, the sort key table is optional
+    if (access(sortKeyFileName.c_str(), R_OK) != 0) return;
+    const unsigned int *header = (const unsigned int *) acquireFileMap(sortKeyFileName, sortKeyInfo, residency.hugePages);
+    if (header == MAP_FAILED || sortKeyInfo.fileSize < kSortKeyTableHeaderWords * sizeof(unsigned int) ||
+        header[0] != kSortKeyTableMagic || header[1] != localReviews() ||
+        sortKeyInfo.fileSize != sortKeyTableSize(header[1]) ||
+        !matchesSource(header + 2, databaseFile, databaseInfo.fileSize)) {
+        cerr << "Ignoring stale or malformed sort key table " << sortKeyFileName << endl;
+        releaseFileMap(sortKeyInfo);
+        return;
+    }
+    sortKeyFile = header;
+}
 
-         }
+void amazon::loadCompressedIndex(const string& compressedIndexFileName) {
+    // Prefer the compressed index when there is one that was built from the plain index
+    // (or there's no plain index to check it against), and fall back to the plain index otherwise
+    if (access(compressedIndexFileName.c_str(), R_OK) != 0) return;
+    fileInfo compressedInfo;
+    const void *map = acquireFileMap(compressedIndexFileName, compressedInfo, residency.hugePages);
+    const size_t minimumSize = (1 + kCompressedIndexTrailerWords) * sizeof(unsigned int);
+    if (map == MAP_FAILED || compressedInfo.fileSize < minimumSize) {
+        releaseFileMap(compressedInfo);
+        return;
     }
 
-    for (unsigned int element: reviewIndices) {
-        reviewIndexes.push_back(element);
+    const unsigned int *trailer = (const unsigned int *) ((const char *) map + compressedInfo.fileSize) -
+        kCompressedIndexTrailerWords;
+    const unsigned int numKeywords = *(const unsigned int *) map;
+    if (trailer[0] != kCompressedIndexMagic || trailer[1] != kCompressedBlockSize ||
+        (1 + (size_t) numKeywords + kCompressedIndexTrailerWords) * sizeof(unsigned int) > compressedInfo.fileSize) {
+        cerr << "Ignoring malformed compressed keyword index " << compressedIndexFileName << endl;
+        releaseFileMap(compressedInfo);
+        return;
     }
-    return reviewIndexes.size() > 0 ;
+    const bool havePlainIndex = keywordIndexInfo.fd != -1 && keywordIndexFile != MAP_FAILED;
+    if (havePlainIndex && !matchesSource(trailer + 2, keywordIndexFile, keywordIndexInfo.fileSize)) {
+        cerr << "Ignoring stale compressed keyword index " << compressedIndexFileName << endl;
+        releaseFileMap(compressedInfo);
+        return;
+    }
+    releaseFileMap(keywordIndexInfo);
+    keywordIndexInfo = compressedInfo;
+    keywordIndexFile = map;
+    compressedPostings = true;
+}
+
+void amazon::loadSkipIndex(const string& skipIndexFileName) {
+    // The skip index is optional: quietly run without it if it's missing or doesn't
+    // describe this keyword index.
+    if (access(skipIndexFileName.c_str(), R_OK) != 0) return;
+    const unsigned int *header = (const unsigned int *) acquireFileMap(skipIndexFileName, skipIndexInfo, residency.hugePages);
+    if (header == MAP_FAILED || skipIndexInfo.fileSize < kSkipIndexHeaderWords * sizeof(unsigned int)) {
+        releaseFileMap(skipIndexInfo);
+        return;
+    }
+
+    const size_t expectedSize = (kSkipIndexHeaderWords + (size_t) header[2] + 1) * sizeof(unsigned int) +
+        (size_t) header[3] * sizeof(SkipEntry);
+    if (header[0] != kSkipIndexMagic || header[1] == 0 || header[2] != localKeywords() ||
+        skipIndexInfo.fileSize != expectedSize || !matchesSource(header + 4, keywordIndexFile, keywordIndexInfo.fileSize) ||
+        !validSkipEntries(header)) {
+        cerr << "Ignoring stale or malformed skip index " << skipIndexFileName << endl;
+        releaseFileMap(skipIndexInfo);
+        return;
+    }
+    skipIndexFile = header;
+}
+
+bool amazon::validSkipEntries(const unsigned int *header) const {
+    // Cursors turn a skip entry's byte offset straight into a position in its list, so
+    // every entry has to point at a posting of the list that owns it
+    const unsigned int *firstSkip = header + kSkipIndexHeaderWords;
+    const SkipEntry *entries = (const SkipEntry *) (firstSkip + header[2] + 1);
+    if (firstSkip[0] != 0 || firstSkip[header[2]] != header[3]) return false;
+    for (unsigned int k = 0; k < header[2]; k++) {
+        if (firstSkip[k + 1] < firstSkip[k]) return false;
+        if (firstSkip[k + 1] == firstSkip[k]) continue;
+        unsigned int numEntries;
+        const char *postings = (const char *) keywordPostingBlock(getElementStartPtr(keywordIndexFile, k), numEntries);
+        const size_t listStart = postings - (const char *) keywordIndexFile;
+        const size_t listEnd = listStart + (size_t) numEntries * 2 * sizeof(unsigned int);
+        if (listEnd > keywordIndexInfo.fileSize) return false;
+        for (unsigned int s = firstSkip[k]; s < firstSkip[k + 1]; s++) {
+            const size_t offset = entries[s].byteOffset;
+            if (offset < listStart || offset >= listEnd || (offset - listStart) % (2 * sizeof(unsigned int)) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+unsigned int amazon::totalKeywords() const {
+    shared_ptr<const SegmentSet> set = currentSegments();
+    return set && !set->includesSelf ? set->segments[0]->localKeywords() : localKeywords();
+}
+
+unsigned int amazon::totalReviews() const {
+    shared_ptr<const SegmentSet> set = currentSegments();
+    return set ? set->totalReviews : localReviews();
+}
+
+size_t amazon::totalSegments() const {
+    shared_ptr<const SegmentSet> set = currentSegments();
+    return set ? set->names.size() : 1;
+}
+
+shared_ptr<const amazon::SegmentSet> amazon::currentSegments() const {
+    return atomic_load(&segments);
+}
+
+const amazon *amazon::segmentFor(const SegmentSet *set, unsigned int &index) const {
+    if (index >= set->totalReviews) return nullptr;
+    if (set->includesSelf && index < localReviews()) return this;
+    size_t segment = upper_bound(set->bases.begin(), set->bases.end(), index) - set->bases.begin() - 1;
+    index -= set->bases[segment];
+    return set->segments[segment].get();
+}
+
+bool amazon::good() const {
+    // Once a compaction has replaced the instance's own files, its segments stand in for them
+    shared_ptr<const SegmentSet> set = currentSegments();
+    if (set && !set->includesSelf) return true;
+    return !( (databaseInfo.fd == -1) || 
+            (keywordIndexInfo.fd == -1) ); 
+}
+
+amazon::~amazon() {
+    // The files are unmapped along with ownFiles, once no ReviewView needs them, and by
+    // then there's no instance left to tell
+    waitForCompaction();
+    shared_ptr<const MappedFiles> files = ownFilesHandle.lock();
+    if (files) files->owner = nullptr;
+}
+
+void amazon::forgetOwnFiles() {
+    // Runs once the last query or ReviewView using a dropped set of files lets go, so
+    // nothing reads through these any more
+    databaseFile = nullptr;
+    keywordIndexFile = nullptr;
+    skipIndexFile = nullptr;
+    sortKeyFile = nullptr;
+    databaseInfo.fileMap = keywordIndexInfo.fileMap = skipIndexInfo.fileMap = sortKeyInfo.fileMap = NULL;
+    keywords.clear();
 }
 
 const char * getElementStartPtr(const void * const file, const unsigned int index) {
@@ -170,50 +379,665 @@ const char * getElementStartPtr(const void * const file, const unsigned int inde
     return elementStartPtr;
 }
 
-const char * convert_and_advance(const char * const str, std::string& string) {
-    // Convert a C string to a C++ string
-    // Return a pointer to the byte after the null delimiter of the C string
-    string = std::string(str);
-    return str + string.length() + 1;    
+int amazon::findKeyword(const std::string& keyword) const {
+    QUERY_STAGE(kLookupStage);
+    int ordinal = keywords.find(keyword.data(), keyword.size());
+    if (ordinal >= 0) QUERY_COUNT(keywordsFound, 1);
+    else QUERY_COUNT(keywordsMissing, 1);
+    return ordinal;
 }
 
-bool amazon::getReview(unsigned int index, Review &review) const {
+static const unsigned int * keywordPostingBlock(const char * const keywordPtr, unsigned int& numEntries) {
+    // Pointer arithmetic to find start of array containing review info w.r.t keyword
+    // If keyword has even length, null terminator makes it odd length, so add one more byte to make it even
+    const size_t keywordLength = strlen(keywordPtr);
+    const size_t keywordBytes = keywordLength % 2 == 0 ? keywordLength + 2 : keywordLength + 1;
+
+    numEntries = *(unsigned int *)(keywordPtr + keywordBytes);
+    return (unsigned int *)(keywordPtr + keywordBytes + 4);
+}
+
+static const char * compressedPostingBlock(const char * const keywordPtr, unsigned int& numEntries) {
+    // Compressed entries pad the keyword out to a multiple of 4 bytes
+    const size_t keywordBytes = (strlen(keywordPtr) + 1 + 3) & ~(size_t) 3;
+    numEntries = *(unsigned int *)(keywordPtr + keywordBytes);
+    return keywordPtr + keywordBytes + 4;
+}
+
+// Notes the length of a list the query opened, for the first few lists
+static void traceListLength(unsigned int numPostings) {
+#if QUERY_STATS_ENABLED
+    QueryStats& stats = threadQueryStats();
+    if (stats.listsOpened < kMaxTracedWords) stats.wordPostings[stats.listsOpened] = numPostings;
+    stats.listsOpened++;
+#endif
+}
+
+PostingCursor amazon::keywordCursor(unsigned int ordinal) const {
+    QUERY_STAGE(kCursorStage);
+    unsigned int numEntries;
+    if (compressedPostings) {
+        const SkipEntry *blocks = (const SkipEntry *) compressedPostingBlock(getElementStartPtr(keywordIndexFile, ordinal), numEntries);
+        traceListLength(numEntries);
+        return PostingCursor::compressed(blocks, numEntries, (const char *) keywordIndexFile);
+    }
+
+    const unsigned int *postings = keywordPostingBlock(getElementStartPtr(keywordIndexFile, ordinal), numEntries);
+    traceListLength(numEntries);
+    PostingCursor cursor(postings, numEntries);
+    if (skipIndexFile != nullptr) {
+        const unsigned int *header = (const unsigned int *) skipIndexFile;
+        const unsigned int *firstSkip = header + kSkipIndexHeaderWords;
+        const SkipEntry *entries = (const SkipEntry *) (firstSkip + header[2] + 1);
+        unsigned int numSkips = firstSkip[ordinal + 1] - firstSkip[ordinal];
+        if (numSkips > 0) cursor.attachSkips(entries + firstSkip[ordinal], numSkips, (const char *) keywordIndexFile);
+    }
+    return cursor;
+}
+
+bool amazon::buildPhraseCursor(const std::vector<std::string>& term, PhraseCursor& cursor) const {
+    for (const string& word : term) {
+        int ordinal = findKeyword(word);
+        // Keyword was not found in the database, i.e no matching reviews
+        if (ordinal < 0) return false;
+        cursor.addWord(keywordCursor(ordinal));
+    }
+    return !term.empty();
+}
+
+// Below this many postings in the cheapest term, splitting a query across threads costs more than it saves
+static const size_t kPostingsPerSearchRange = 1 << 16;
 
-    if (index >= totalReviews()) return false;
+bool amazon::buildQueryCursors(const vector<vector<string>>& allSearchTerms, vector<PhraseCursor>& phrases) const {
+    phrases.assign(allSearchTerms.size(), PhraseCursor());
+    for (size_t i = 0; i < allSearchTerms.size(); i++) {
+        // A term missing from the index means the conjunction can't match anything
+        if (!buildPhraseCursor(allSearchTerms[i], phrases[i])) return false;
+    }
+    return !phrases.empty();
+}
+
+// Keeps only the reviews that also appear in other, never searching backwards
+void filterReviewList(const vector<unsigned int>& other, vector<unsigned int>& reviewIndexes) {
+    QUERY_STAGE(kMatchStage);
+    auto position = other.begin();
+    size_t kept = 0;
+    for (unsigned int reviewIndex : reviewIndexes) {
+        position = lower_bound(position, other.end(), reviewIndex);
+        if (position == other.end()) break;
+        if (*position == reviewIndex) reviewIndexes[kept++] = reviewIndex;
+    }
+    reviewIndexes.resize(kept);
+}
+
+static void intersectReviewLists(const vector<vector<unsigned int>>& lists, vector<size_t> ids, vector<unsigned int>& reviewIndexes) {
+    reviewIndexes.clear();
+    if (ids.empty()) return;
+    sort(ids.begin(), ids.end(), [&lists](size_t lhs, size_t rhs) { return lists[lhs].size() < lists[rhs].size(); });
+
+    // Start from the shortest list and filter it through the others
+    reviewIndexes = lists[ids[0]];
+    for (size_t k = 1; k < ids.size() && !reviewIndexes.empty(); k++) {
+        filterReviewList(lists[ids[k]], reviewIndexes);
+    }
+}
+
+// Renders a term back into query syntax, e.g. "did not work"
+static string quoteTerm(const vector<string>& term) {
+    string quoted = "\"";
+    for (size_t i = 0; i < term.size(); i++) {
+        if (i > 0) quoted += ' ';
+        quoted += term[i];
+    }
+    return quoted + "\"";
+}
+
+// A query's reviews don't depend on the order or repetition of its terms, so equivalent
+// queries normalize to the same sorted, deduplicated list of quoted terms
+static string normalizeQuery(vector<vector<string>> terms) {
+    sort(terms.begin(), terms.end());
+    terms.erase(unique(terms.begin(), terms.end()), terms.end());
+    string normalized;
+    for (const vector<string>& term : terms) {
+        if (!normalized.empty()) normalized += ' ';
+        normalized += quoteTerm(term);
+    }
+    return normalized;
+}
 
-    const char * nextPtr = getElementStartPtr(databaseFile, index);
+void amazon::enableResultCache(size_t maxQueryBytes, size_t maxTermBytes) {
+    queryCache.reset(maxQueryBytes > 0 ? new ResultCache(maxQueryBytes) : nullptr);
+    termCache.reset(maxTermBytes > 0 ? new ResultCache(maxTermBytes) : nullptr);
+}
+
+ResultCacheStats amazon::queryCacheStats() const {
+    return queryCache ? queryCache->stats() : ResultCacheStats {0, 0, 0, 0, 0};
+}
+
+ResultCacheStats amazon::termCacheStats() const {
+    return termCache ? termCache->stats() : ResultCacheStats {0, 0, 0, 0, 0};
+}
+
+bool amazon::searchKeywordIndex(const string& query, vector<unsigned int>& reviewIndexes, unsigned int maxThreads) const {
+    QUERY_STATS_SCOPE();
+    // Faults taken by range-splitting helper threads aren't counted
+    PageFaultCounts before = threadPageFaults();
+    bool found = searchKeywordIndexUncounted(query, reviewIndexes, maxThreads);
+    PageFaultCounts after = threadPageFaults();
+    lastQueryFaults = PageFaultCounts {after.minor - before.minor, after.major - before.major};
+    QUERY_COUNT(minorFaults, lastQueryFaults.minor);
+    QUERY_COUNT(majorFaults, lastQueryFaults.major);
+    QUERY_COUNT(matches, reviewIndexes.size());
+    return found;
+}
 
-    review.index = index; 
-    nextPtr = convert_and_advance(nextPtr, review.product_title);
-    nextPtr = convert_and_advance(nextPtr, review.product_category);
-    review.star_rating = *nextPtr;
-    nextPtr += 1;
-    nextPtr = convert_and_advance(nextPtr, review.review_headline);
-    nextPtr = convert_and_advance(nextPtr, review.review_body);
+bool amazon::searchKeywordIndexUncounted(const string& query, vector<unsigned int>& reviewIndexes,
+        unsigned int maxThreads) const {
+    reviewIndexes.clear();
+    vector<vector<string>> terms = convertQuery(query);
+    shared_ptr<const SegmentSet> set = currentSegments();
+    if (!queryCache) {
+        evaluateSegments(set.get(), terms, reviewIndexes, maxThreads);
+        return reviewIndexes.size() > 0 ;
+    }
+
+    // Results change along with the segments, so each generation of segments gets its own entries
+    const string key = (set ? to_string(set->generation) + ":" : "") + normalizeQuery(terms);
+    {
+        QUERY_STAGE(kCacheStage);
+        ResultCache::Value cached = queryCache->lookup(key);
+        if (cached) {
+            reviewIndexes = *cached;
+            return reviewIndexes.size() > 0 ;
+        }
+    }
+    evaluateSegments(set.get(), terms, reviewIndexes, maxThreads);
+    QUERY_STAGE(kCacheStage);
+    queryCache->insert(key, reviewIndexes);
+    return reviewIndexes.size() > 0 ;
+}
+
+void amazon::evaluateSegments(const SegmentSet *set, const vector<vector<string>>& terms,
+        vector<unsigned int>& reviewIndexes, unsigned int maxThreads) const {
+    if (set == nullptr || set->includesSelf) {
+        if (termCache) evaluateQueryByTerms(terms, reviewIndexes);
+        else evaluateQuery(terms, reviewIndexes, maxThreads);
+    }
+    if (set == nullptr) return;
 
-    if ((review.product_title.length() + 
-        review.product_category.length() + 
-        review.review_headline.length() + 
-        review.review_body.length() + 1) % 2 == 1) {
+    // Segments are numbered in order, so appending each one's rebased results keeps them sorted
+    vector<unsigned int> segmentIndexes;
+    for (size_t i = 0; i < set->segments.size(); i++) {
+        segmentIndexes.clear();
+        set->segments[i]->evaluateQuery(terms, segmentIndexes, maxThreads);
+        for (unsigned int index : segmentIndexes) reviewIndexes.push_back(set->bases[i] + index);
+    }
+}
+
+void amazon::evaluateQueryByTerms(const vector<vector<string>>& terms, vector<unsigned int>& reviewIndexes) const {
+    vector<ResultCache::Value> termReviews(terms.size());
+    for (size_t i = 0; i < terms.size(); i++) {
+        const string key = quoteTerm(terms[i]);
+        {
+            QUERY_STAGE(kCacheStage);
+            termReviews[i] = termCache->lookup(key);
+        }
+        if (termReviews[i]) continue;
+
+        vector<PhraseCursor> phrase(1);
+        vector<unsigned int> matches;
+        if (buildPhraseCursor(terms[i], phrase[0])) intersectPhrases(phrase, matches);
+        QUERY_STAGE(kCacheStage);
+        termCache->insert(key, matches);
+        termReviews[i] = make_shared<const vector<unsigned int>>(move(matches));
+    }
+
+    // As in intersectReviewLists, filter the shortest list through the others, but without
+    // copying the cached lists
+    if (terms.empty()) return;
+    QUERY_STAGE(kMatchStage);
+    vector<size_t> ids(terms.size());
+    for (size_t i = 0; i < terms.size(); i++) ids[i] = i;
+    sort(ids.begin(), ids.end(), [&termReviews](size_t lhs, size_t rhs) {
+        return termReviews[lhs]->size() < termReviews[rhs]->size();
+    });
+    reviewIndexes = *termReviews[ids[0]];
+    for (size_t k = 1; k < ids.size() && !reviewIndexes.empty(); k++) {
+        filterReviewList(*termReviews[ids[k]], reviewIndexes);
+    }
+}
+
+void amazon::evaluateQuery(const vector<vector<string>>& terms, vector<unsigned int>& reviewIndexes,
+        unsigned int maxThreads) const {
+    vector<PhraseCursor> phrases;
+    if (!buildQueryCursors(terms, phrases)) return;
+
+    size_t cost = SIZE_MAX;
+    for (const PhraseCursor& phrase : phrases) cost = min(cost, phrase.cost());
+    const unsigned int numRanges = max<size_t>(1, min<size_t>(maxThreads, cost / kPostingsPerSearchRange));
+    if (numRanges == 1) {
+        intersectPhrases(phrases, reviewIndexes);
+        return;
+    }
+
+    // Split [0, localReviews) into contiguous ranges; each thread leapfrogs its own copies
+    // of the (still unpositioned) cursors, whose first seek gallops straight to the range.
+    vector<vector<unsigned int>> rangeResults(numRanges);
+    vector<QueryStats> rangeStats(numRanges);
+    auto searchRange = [&](unsigned int r) {
+        vector<PhraseCursor> rangePhrases = phrases;
+        unsigned int firstReview = (uint64_t) localReviews() * r / numRanges;
+        unsigned int lastReview = r + 1 == numRanges ? UINT_MAX : (uint64_t) localReviews() * (r + 1) / numRanges - 1;
+        intersectPhrases(rangePhrases, rangeResults[r], firstReview, lastReview);
+        if (r > 0) rangeStats[r] = threadQueryStats();
+    };
+    vector<thread> threads;
+    for (unsigned int r = 1; r < numRanges; r++) threads.push_back(thread(searchRange, r));
+    searchRange(0);
+    for (thread& t : threads) t.join();
+    // Each helper thread counted its own work in its own record
+    if (QUERY_STATS_ENABLED) {
+        for (unsigned int r = 1; r < numRanges; r++) addQueryCounters(threadQueryStats(), rangeStats[r]);
+    }
+
+    for (const vector<unsigned int>& rangeResult : rangeResults) {
+        reviewIndexes.insert(reviewIndexes.end(), rangeResult.begin(), rangeResult.end());
+    }
+}
+
+vector<vector<unsigned int>> amazon::searchBatch(const vector<string>& queries) const {
+    QUERY_STATS_SCOPE();
+    shared_ptr<const SegmentSet> set = currentSegments();
+    if (set && (!set->includesSelf || !set->segments.empty())) {
+        // Term results can't be shared across segments, so answer each query on its own
+        vector<vector<unsigned int>> results(queries.size());
+        for (size_t i = 0; i < queries.size(); i++) {
+            searchKeywordIndexUncounted(queries[i], results[i], 1);
+            QUERY_COUNT(matches, results[i].size());
+        }
+        return results;
+    }
+
+    // Parse every query, giving each distinct term a slot that all of its uses share
+    map<vector<string>, size_t> termSlots;
+    vector<vector<size_t>> queryTerms(queries.size());
+    for (size_t i = 0; i < queries.size(); i++) {
+        for (const vector<string>& term : convertQuery(queries[i])) {
+            auto slot = termSlots.insert(make_pair(term, termSlots.size())).first;
+            queryTerms[i].push_back(slot->second);
+        }
+    }
+
+    // Resolve each distinct keyword once, then walk the posting lists once per distinct term
+    unordered_map<string, int> ordinals;
+    vector<vector<unsigned int>> termReviews(termSlots.size());
+    for (const auto& slot : termSlots) {
+        vector<PhraseCursor> phrase(1);
+        bool found = !slot.first.empty();
+        for (const string& word : slot.first) {
+            auto ordinal = ordinals.find(word);
+            if (ordinal == ordinals.end()) ordinal = ordinals.insert(make_pair(word, findKeyword(word))).first;
+            if (ordinal->second < 0) {
+                found = false;
+                break;
+            }
+            phrase[0].addWord(keywordCursor(ordinal->second));
+        }
+        if (found) intersectPhrases(phrase, termReviews[slot.second]);
+    }
+
+    // Fan the per-term results out to every query
+    vector<vector<unsigned int>> results(queries.size());
+    for (size_t i = 0; i < queries.size(); i++) {
+        intersectReviewLists(termReviews, queryTerms[i], results[i]);
+        QUERY_COUNT(matches, results[i].size());
+    }
+    return results;
+}
+
+bool amazon::writeSkipIndex(const string& directory, const string& filesPrefix, unsigned int blockSize) {
+    if (blockSize == 0) return false;
+    fileInfo keywordIndexInfo;
+    const void *keywordIndexFile = acquireFileMap(directory + "/" + filesPrefix + "_keyword_index.bin", keywordIndexInfo);
+    if (keywordIndexInfo.fd == -1 || keywordIndexFile == MAP_FAILED) {
+        releaseFileMap(keywordIndexInfo);
+        return false;
+    }
+
+    const unsigned int numKeywords = *(const unsigned int *) keywordIndexFile;
+    vector<unsigned int> firstSkip;
+    vector<SkipEntry> entries;
+    firstSkip.reserve(numKeywords + 1);
+    for (unsigned int k = 0; k < numKeywords; k++) {
+        firstSkip.push_back(entries.size());
+        unsigned int numEntries;
+        const unsigned int *postings = keywordPostingBlock(getElementStartPtr(keywordIndexFile, k), numEntries);
+        if (numEntries <= blockSize) continue;
+        for (unsigned int i = 0; i < numEntries; i += blockSize) {
+            SkipEntry entry;
+            entry.firstReviewIndex = postings[2 * i];
+            entry.byteOffset = (const char *) (postings + 2 * i) - (const char *) keywordIndexFile;
+            entries.push_back(entry);
+        }
+    }
+    firstSkip.push_back(entries.size());
+    unsigned int header[kSkipIndexHeaderWords] = {kSkipIndexMagic, blockSize, numKeywords, (unsigned int) entries.size()};
+    sourceIdentity(keywordIndexFile, keywordIndexInfo.fileSize, header + 4);
+    releaseFileMap(keywordIndexInfo);
+
+    // Write to a temporary file and rename it into place, so a reader never maps a partial index
+    const string skipIndexFileName = directory + "/" + filesPrefix + "_keyword_skips.bin";
+    const string tempFileName = skipIndexFileName + ".tmp";
+    ofstream out(tempFileName, ios::binary | ios::trunc);
+    out.write((const char *) header, sizeof(header));
+    out.write((const char *) firstSkip.data(), firstSkip.size() * sizeof(unsigned int));
+    out.write((const char *) entries.data(), entries.size() * sizeof(SkipEntry));
+    out.close();
+    if (!out) {
+        unlink(tempFileName.c_str());
+        return false;
+    }
+    return rename(tempFileName.c_str(), skipIndexFileName.c_str()) == 0;
+}
+
+bool amazon::writeCompressedIndex(const string& directory, const string& filesPrefix) {
+    fileInfo keywordIndexInfo;
+    const void *keywordIndexFile = acquireFileMap(directory + "/" + filesPrefix + "_keyword_index.bin", keywordIndexInfo);
+    if (keywordIndexInfo.fd == -1 || keywordIndexFile == MAP_FAILED) {
+        releaseFileMap(keywordIndexInfo);
+        return false;
+    }
+
+    const string compressedIndexFileName = directory + "/" + filesPrefix + "_keyword_index_compressed.bin";
+    const string tempFileName = compressedIndexFileName + ".tmp";
+    ofstream out(tempFileName, ios::binary | ios::trunc);
+
+    // The offset array is written as a placeholder first, and patched once every entry's position is known
+    const unsigned int numKeywords = *(const unsigned int *) keywordIndexFile;
+    vector<unsigned int> offsets(numKeywords);
+    out.write((const char *) &numKeywords, sizeof(numKeywords));
+    out.write((const char *) offsets.data(), offsets.size() * sizeof(unsigned int));
+
+    const char padding[4] = {0, 0, 0, 0};
+    vector<SkipEntry> blocks;
+    vector<unsigned char> encoded;
+    for (unsigned int k = 0; k < numKeywords && out; k++) {
+        const char *keywordPtr = getElementStartPtr(keywordIndexFile, k);
+        unsigned int numEntries;
+        const unsigned int *postings = keywordPostingBlock(keywordPtr, numEntries);
+
+        offsets[k] = out.tellp();
+        const size_t keywordLength = strlen(keywordPtr) + 1;
+        out.write(keywordPtr, keywordLength);
+        out.write(padding, (4 - keywordLength % 4) % 4);
+        out.write((const char *) &numEntries, sizeof(numEntries));
+
+        const unsigned int numBlocks = (numEntries + kCompressedBlockSize - 1) / kCompressedBlockSize;
+        const size_t dataStart = (size_t) out.tellp() + numBlocks * sizeof(SkipEntry);
+        blocks.clear();
+        encoded.clear();
+        for (unsigned int b = 0; b < numBlocks; b++) {
+            const unsigned int first = b * kCompressedBlockSize;
+            SkipEntry block;
+            block.firstReviewIndex = postings[2 * first];
+            block.byteOffset = dataStart + encoded.size();
+            blocks.push_back(block);
+            encodePostingBlock(postings + 2 * first, min(kCompressedBlockSize, numEntries - first), encoded);
+        }
+        out.write((const char *) blocks.data(), blocks.size() * sizeof(SkipEntry));
+        out.write((const char *) encoded.data(), encoded.size());
+        out.write(padding, (4 - encoded.size() % 4) % 4);
+    }
+    unsigned int trailer[kCompressedIndexTrailerWords] = {kCompressedIndexMagic, kCompressedBlockSize};
+    sourceIdentity(keywordIndexFile, keywordIndexInfo.fileSize, trailer + 2);
+    releaseFileMap(keywordIndexInfo);
+
+    out.write((const char *) trailer, sizeof(trailer));
+    out.seekp(sizeof(unsigned int));
+    out.write((const char *) offsets.data(), offsets.size() * sizeof(unsigned int));
+    out.close();
+    if (!out) {
+        unlink(tempFileName.c_str());
+        return false;
+    }
+    return rename(tempFileName.c_str(), compressedIndexFileName.c_str()) == 0;
+}
+
+size_t ReviewView::length(int field) const {
+    if (lengths[field] == kUnknownLength) lengths[field] = strlen(fieldStart(field));
+    return lengths[field];
+}
+
+const char * ReviewView::fieldStart(int field) const {
+    // Each field follows the previous one's null terminator; the star rating byte sits
+    // between the category and the headline.
+    if (field == kTitle) return record;
+    const char *start = fieldStart(field - 1) + length(field - 1) + 1;
+    return field == kHeadline ? start + 1 : start;
+}
+
+const char * ReviewView::dateStart() const {
+    const char *nextPtr = fieldStart(kBody) + length(kBody) + 1;
+    // The date is aligned to an even offset within the record
+    if ((length(kTitle) + length(kCategory) + length(kHeadline) + length(kBody) + 1) % 2 == 1) {
         nextPtr += 1;
-    } 
-
-    review.review_year = *(short *) nextPtr;
-    nextPtr += 2;
-    review.review_month = *nextPtr;
-    nextPtr += 1;
-    review.review_day = *nextPtr;
-   
+    }
+    return nextPtr;
+}
+
+void ReviewView::hydrate(Review& review) const {
+    review.index = index;
+    review.product_title = string(product_title());
+    review.product_category = string(product_category());
+    review.star_rating = star_rating();
+    review.review_headline = string(review_headline());
+    review.review_body = string(review_body());
+    review.review_year = review_year();
+    review.review_month = review_month();
+    review.review_day = review_day();
+}
+
+bool amazon::getReview(unsigned int index, ReviewView &review) const {
+    QUERY_STAGE(kFetchStage);
+    QUERY_COUNT(reviewsFetched, 1);
+    shared_ptr<const SegmentSet> set = currentSegments();
+    if (!set) {
+        // Only an instance opened without its segments has no set, and it never drops its files
+        if (!getLocalReview(index, review)) return false;
+        review.files = ownFiles;
+        return true;
+    }
+    unsigned int localIndex = index;
+    const amazon *segment = segmentFor(set.get(), localIndex);
+    if (segment == nullptr || !segment->getLocalReview(localIndex, review)) return false;
+    review.index = index;
+    // ownFiles may be dropped by a concurrent refresh, but the set's reference can't be
+    review.files = segment == this ? set->selfFiles : segment->ownFiles;
+    return true;
+}
+
+bool amazon::getLocalReview(unsigned int index, ReviewView &review) const {
+    if (index >= localReviews()) return false;
+    QUERY_COUNT(bytesTouched, recordLength(index));
+    review.index = index;
+    review.record = getElementStartPtr(databaseFile, index);
+    review.clearLengths();
+    return true;
+}
+
+bool amazon::getReview(unsigned int index, Review &review) const {
+    ReviewView view;
+    if (!getReview(index, view)) return false;
+    view.hydrate(review);
+    return true;
+}
+
+static void measureSortKey(const ReviewView& review, ReviewSortKey& key) {
+    key.index = review.index;
+    key.star_rating = review.star_rating();
+    key.date = (review.review_year() << 16) | ((unsigned char) review.review_month() << 8) |
+        (unsigned char) review.review_day();
+    string_view title = review.product_title();
+    key.title_size = title.size();
+    key.headline_size = review.review_headline().size();
+    key.body_size = review.review_body().size();
+    key.title_prefix = 0;
+    for (size_t i = 0; i < sizeof(key.title_prefix); i++) {
+        unsigned char c = i < title.size() ? title[i] : 0;
+        key.title_prefix = (key.title_prefix << 8) | c;
+    }
+}
+
+bool amazon::getSortKey(unsigned int index, ReviewSortKey &key) const {
+    shared_ptr<const SegmentSet> set = currentSegments();
+    if (set) {
+        unsigned int localIndex = index;
+        const amazon *segment = segmentFor(set.get(), localIndex);
+        if (segment == nullptr) return false;
+        if (segment != this) {
+            segment->getSortKey(localIndex, key);
+            key.index = index;
+            return true;
+        }
+    }
+
+    if (index >= localReviews()) return false;
+    QUERY_COUNT(sortKeysRead, 1);
+    if (sortKeyFile == nullptr) {
+        ReviewView review;
+        getLocalReview(index, review);
+        measureSortKey(review, key);
+        return true;
+    }
+
+    const size_t numReviews = localReviews();
+    const uint64_t *titlePrefixes = (const uint64_t *) ((const unsigned int *) sortKeyFile + kSortKeyTableHeaderWords);
+    const unsigned int *dates = (const unsigned int *) (titlePrefixes + numReviews);
+    const unsigned int *titleSizes = dates + numReviews;
+    const unsigned int *headlineSizes = titleSizes + numReviews;
+    const unsigned int *bodySizes = headlineSizes + numReviews;
+    const signed char *starRatings = (const signed char *) (bodySizes + numReviews);
+    key.index = index;
+    key.star_rating = starRatings[index];
+    key.date = dates[index];
+    key.title_size = titleSizes[index];
+    key.headline_size = headlineSizes[index];
+    key.body_size = bodySizes[index];
+    key.title_prefix = titlePrefixes[index];
+    QUERY_COUNT(bytesTouched, sizeof(uint64_t) + 4 * sizeof(unsigned int) + 1);
     return true;
 }
 
+void amazon::sortReviewIndexes(vector<unsigned int> &reviewIndexes,
+    function<bool(const ReviewSortKey &, const ReviewSortKey &)> cmp) const {
+
+    QUERY_STAGE(kFetchStage);
+    vector<ReviewSortKey> keys(reviewIndexes.size());
+    for (size_t i = 0; i < reviewIndexes.size(); i++) getSortKey(reviewIndexes[i], keys[i]);
+    std::sort(keys.begin(), keys.end(), cmp);
+    for (size_t i = 0; i < keys.size(); i++) reviewIndexes[i] = keys[i].index;
+}
+
+void amazon::topReviewIndexes(vector<unsigned int> &reviewIndexes, size_t k,
+    function<bool(const ReviewSortKey &, const ReviewSortKey &)> cmp) const {
+
+    QUERY_STAGE(kFetchStage);
+    if (k >= reviewIndexes.size()) {
+        sortReviewIndexes(reviewIndexes, cmp);
+        return;
+    }
+
+    // A max-heap (under cmp) of the best k keys seen so far: its front is the worst of
+    // them, and any key that beats it takes its place.
+    vector<ReviewSortKey> heap;
+    heap.reserve(k);
+    ReviewSortKey key;
+    for (unsigned int index : reviewIndexes) {
+        if (k == 0) break;
+        getSortKey(index, key);
+        if (heap.size() < k) {
+            heap.push_back(key);
+            push_heap(heap.begin(), heap.end(), cmp);
+        } else if (cmp(key, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), cmp);
+            heap.back() = key;
+            push_heap(heap.begin(), heap.end(), cmp);
+        }
+    }
+    sort_heap(heap.begin(), heap.end(), cmp);
+
+    reviewIndexes.resize(heap.size());
+    for (size_t i = 0; i < heap.size(); i++) reviewIndexes[i] = heap[i].index;
+}
+
+void amazon::getTopReviewsFromIndexes(const vector<unsigned int> &reviewIndexes, size_t k,
+    vector<ReviewView> &reviews,
+    function<bool(const ReviewSortKey &, const ReviewSortKey &)> cmp) const {
+
+    QUERY_STAGE(kFetchStage);
+    vector<unsigned int> winners(reviewIndexes);
+    topReviewIndexes(winners, k, cmp);
+    reviews.resize(winners.size());
+    for (size_t i = 0; i < winners.size(); i++) getReview(winners[i], reviews[i]);
+}
+
+bool amazon::writeSortKeyTable(const string& directory, const string& filesPrefix) {
+    // The table describes these files alone, whatever segments are layered on them
+    amazon db(directory, filesPrefix, ResidencyPolicy(), false);
+    if (!db.good()) return false;
+
+    // Build each column in turn, so the output is written sequentially
+    const unsigned int numReviews = db.localReviews();
+    vector<ReviewSortKey> keys(numReviews);
+    for (unsigned int index = 0; index < numReviews; index++) {
+        ReviewView review;
+        db.getLocalReview(index, review);
+        measureSortKey(review, keys[index]);
+    }
+
+    const string sortKeyFileName = directory + "/" + filesPrefix + "_sort_keys.bin";
+    const string tempFileName = sortKeyFileName + ".tmp";
+    ofstream out(tempFileName, ios::binary | ios::trunc);
+    unsigned int header[kSortKeyTableHeaderWords] = {kSortKeyTableMagic, numReviews};
+    sourceIdentity(db.databaseFile, db.databaseInfo.fileSize, header + 2);
+    out.write((const char *) header, sizeof(header));
+    for (const ReviewSortKey& key : keys) out.write((const char *) &key.title_prefix, sizeof(key.title_prefix));
+    for (const ReviewSortKey& key : keys) out.write((const char *) &key.date, sizeof(key.date));
+    for (const ReviewSortKey& key : keys) out.write((const char *) &key.title_size, sizeof(key.title_size));
+    for (const ReviewSortKey& key : keys) out.write((const char *) &key.headline_size, sizeof(key.headline_size));
+    for (const ReviewSortKey& key : keys) out.write((const char *) &key.body_size, sizeof(key.body_size));
+    for (const ReviewSortKey& key : keys) out.put((char) key.star_rating);
+    out.close();
+    if (!out) {
+        unlink(tempFileName.c_str());
+        return false;
+    }
+    return rename(tempFileName.c_str(), sortKeyFileName.c_str()) == 0;
+}
+
 void amazon::getSortedReviewsFromIndexes(const vector<unsigned int> &reviewIndexes,
     vector<Review> &reviews,
     function<bool(const Review &, const Review &)> cmp) const {
 
+    QUERY_STAGE(kFetchStage);
+    reviews.reserve(reviews.size() + reviewIndexes.size());
     for (auto index: reviewIndexes) {
         Review review;
         getReview(index, review);
+        reviews.push_back(std::move(review));
+    }
+    std::sort(reviews.begin(), reviews.end(), cmp);
+}
+
+void amazon::getSortedReviewsFromIndexes(const vector<unsigned int> &reviewIndexes,
+    vector<ReviewView> &reviews,
+    function<bool(const ReviewView &, const ReviewView &)> cmp) const {
+
+    QUERY_STAGE(kFetchStage);
+    reviews.reserve(reviews.size() + reviewIndexes.size());
+    for (auto index: reviewIndexes) {
+        ReviewView review;
+        getReview(index, review);
         reviews.push_back(review);
     }
     std::sort(reviews.begin(), reviews.end(), cmp);
@@ -233,18 +1057,56 @@ ostream& operator<<(ostream& os, const Review& review) {
     return os;
 }
 
+ostream& operator<<(ostream& os, const ReviewView& review) {
+    os << "Review index: " << review.index << endl;
+    os << "Product title: " << review.product_title() << endl;
+    os << "Product category: " << review.product_category() << endl;
+    os << "Star rating: " << review.star_rating() << " stars" << endl;
+    os << "Review headline: " << review.review_headline() << endl;
+    os << "Review body: " << review.review_body() << endl;
+    os << "Date: " << review.review_year() << "-" <<
+        review.review_month() << "-" << 
+        review.review_day() << endl;
+    return os;
+}
 
-const void *amazon::acquireFileMap(const string& fileName, struct fileInfo& info) {
+
+const void *amazon::acquireFileMap(const string& fileName, struct fileInfo& info, bool hugePageAligned) {
     struct stat stats;
-    stat(fileName.c_str(), &stats);
-    info.fileSize = stats.st_size;
     info.fd = open(fileName.c_str(), O_RDONLY);
-    return info.fileMap = mmap(0, info.fileSize, PROT_READ, MAP_SHARED, info.fd, 0);
+    if (info.fd == -1 || fstat(info.fd, &stats) == -1) {
+        if (info.fd != -1) close(info.fd);
+        info.fd = -1;
+        info.fileSize = 0;
+        return info.fileMap = MAP_FAILED;
+    }
+    info.fileSize = stats.st_size;
+    if (!hugePageAligned) {
+        return info.fileMap = mmap(0, info.fileSize, PROT_READ, MAP_SHARED, info.fd, 0);
+    }
+
+    // Reserve enough address space to find a huge page boundary, map the file there, and
+    // give back the unused head and tail of the reservation
+    const size_t reserved = info.fileSize + kHugePageSize;
+    char *region = (char *) mmap(0, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) return info.fileMap = mmap(0, info.fileSize, PROT_READ, MAP_SHARED, info.fd, 0);
+    char *aligned = (char *) (((uintptr_t) region + kHugePageSize - 1) & ~(uintptr_t) (kHugePageSize - 1));
+    info.fileMap = mmap(aligned, info.fileSize, PROT_READ, MAP_SHARED | MAP_FIXED, info.fd, 0);
+    if (info.fileMap == MAP_FAILED) {
+        munmap(region, reserved);
+        return info.fileMap;
+    }
+    const size_t mapped = (info.fileSize + pageSize() - 1) & ~(pageSize() - 1);
+    if (aligned > region) munmap(region, aligned - region);
+    if (aligned + mapped < region + reserved) munmap(aligned + mapped, region + reserved - (aligned + mapped));
+    return info.fileMap;
 }
 
 void amazon::releaseFileMap(struct fileInfo& info) {
-    if (info.fileMap != NULL) munmap((char *) info.fileMap, info.fileSize);
+    if (info.fileMap != NULL && info.fileMap != MAP_FAILED) munmap((char *) info.fileMap, info.fileSize);
     if (info.fd != -1) close(info.fd);
+    info.fileMap = NULL;
+    info.fd = -1;
 }
 
 vector<vector<string>> convertQuery(string query) {
@@ -257,6 +1119,7 @@ vector<vector<string>> convertQuery(string query) {
        [['tv'], ['did', 'not', 'work'], ['second', 'rate']]
        */
 
+    QUERY_STAGE(kParseStage);
     // make lowercase, convert dashes to space, and remove characters 
     // that aren't alphanumeric, or the double-quote, or a space
     string newStr = "";
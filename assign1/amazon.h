@@ -1,10 +1,20 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <cstdint>
 #include <vector>
 #include <ostream>
-#include <set>
 #include <tuple>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <thread>
+#include "posting_list.h"
+#include "keyword_dictionary.h"
+#include "result_cache.h"
+#include "query_stats.h"
 
 struct Review {
     unsigned int index;
@@ -30,6 +40,149 @@ struct Review {
     friend std::ostream& operator<<(std::ostream& os, const Review& review);
 };
 
+/**
+ * Struct: ReviewSortKey
+ * ---------------------
+ * The handful of review properties that result ordering is based on, small enough to
+ * sort hundreds of thousands of matches without touching the review text.  The date is
+ * packed as (year << 16) | (month << 8) | day so that dates compare as integers, and
+ * title_prefix holds the first 8 bytes of the title, big-endian and zero-padded, so
+ * that comparing prefixes orders titles the way comparing the strings would (only
+ * titles with equal prefixes and more than 8 bytes need a full comparison).
+ */
+struct ReviewSortKey {
+    unsigned int index;
+    int star_rating;
+    unsigned int date;
+    unsigned int title_size;
+    unsigned int headline_size;
+    unsigned int body_size;
+    uint64_t title_prefix;
+};
+
+/**
+ * Struct: ResidencyPolicy
+ * -----------------------
+ * How eagerly the mmap'd database files are brought into memory.  By default every page
+ * is faulted in on first use with the kernel's usual readahead.
+ *
+ *     populateOffsets  fault in the offset arrays of the review database and keyword index
+ *                      when the database is opened, so lookups never wait on them
+ *     lockOffsets      additionally mlock those offset arrays so they can't be paged out
+ *                      (needs a large enough RLIMIT_MEMLOCK; failures are reported and ignored)
+ *     randomReviews    advise MADV_RANDOM for the review records, which are read a few
+ *                      hundred bytes at a time in no particular order, so readahead is wasted
+ *     hugePages        map every file at a 2MB-aligned address and advise MADV_HUGEPAGE, so
+ *                      kernels that back file mappings with transparent huge pages can
+ *     warm             call warm() as soon as the database is opened
+ */
+struct ResidencyPolicy {
+    bool populateOffsets = false;
+    bool lockOffsets = false;
+    bool randomReviews = false;
+    bool hugePages = false;
+    bool warm = false;
+};
+
+/**
+ * Struct: PageFaultCounts
+ * -----------------------
+ * Minor (page already in memory) and major (page read from disk) fault counts.
+ */
+struct PageFaultCounts {
+    long minor;
+    long major;
+};
+
+/**
+ * Struct: BooleanQuery
+ * --------------------
+ * A parsed boolean query (see amazon::parseBooleanQuery).  A review matches when, for
+ * every clause, it contains at least one of that clause's terms, and it contains none of
+ * the excluded terms.  A term is a word or a phrase, as in searchKeywordIndex.
+ */
+struct BooleanQuery {
+    std::vector<std::vector<std::vector<std::string>>> clauses;
+    std::vector<std::vector<std::string>> excluded;
+};
+
+/**
+ * Struct: RankedReview
+ * --------------------
+ * One result of a ranked search: a review index and its BM25 score.
+ */
+struct RankedReview {
+    unsigned int index;
+    double score;
+};
+
+/**
+ * Class: ReviewView
+ * -----------------
+ * A zero-copy view of one review, pointing straight into the mmap'd database.  The
+ * accessors mirror Review's fields.  A review is stored as consecutive null-terminated
+ * strings with the star rating and date in between and after them, so each field's
+ * position depends on the lengths of the fields before it.  Those lengths are computed
+ * the first time they're needed and then remembered, so a view that's only asked for
+ * its title never scans the body.
+ *
+ * A ReviewView shares ownership of the mapping its record lives in, so it stays valid
+ * after a refresh or compaction replaces the segment it came from, and even after the
+ * amazon instance that produced it is destroyed.
+ */
+class ReviewView {
+    public:
+        ReviewView() : index(0), record(nullptr) { clearLengths(); }
+
+        unsigned int index;
+
+        std::string_view product_title() const { return field(kTitle); }
+        std::string_view product_category() const { return field(kCategory); }
+        int star_rating() const { return *(fieldStart(kCategory) + length(kCategory) + 1); }
+        std::string_view review_headline() const { return field(kHeadline); }
+        std::string_view review_body() const { return field(kBody); }
+        int review_year() const { return *(const short *) dateStart(); }
+        int review_month() const { return dateStart()[2]; }
+        int review_day() const { return dateStart()[3]; }
+
+        /**
+         * Method: hydrate
+         * ---------------
+         * Copies every field into review, for callers that need a Review that owns its strings.
+         */
+        void hydrate(Review& review) const;
+
+        /** 
+         * operator<< overload
+         * ------------------
+         * Prints the review exactly as operator<< prints the equivalent Review.
+         */
+        friend std::ostream& operator<<(std::ostream& os, const ReviewView& review);
+
+    private:
+        enum { kTitle, kCategory, kHeadline, kBody, kNumFields };
+        static const size_t kUnknownLength = (size_t) -1;
+
+        const char *record;
+        std::shared_ptr<const void> files;
+        mutable size_t lengths[kNumFields];
+
+        void clearLengths() { for (size_t& length : lengths) length = kUnknownLength; }
+        size_t length(int field) const;
+        const char *fieldStart(int field) const;
+        const char *dateStart() const;
+        std::string_view field(int field) const { return std::string_view(fieldStart(field), length(field)); }
+
+        friend class amazon;
+};
+
+/**
+ * Thread safety: once constructed, an amazon instance is read-only.  Every const method
+ * may be called concurrently from any number of threads on one shared instance, since
+ * queries only read the mmap'd files and keep all of their working state (cursors,
+ * result vectors) local to the call.  Construction and destruction must not overlap
+ * with any other use of the instance.
+ */
 class amazon {
     public:
 
@@ -46,8 +199,13 @@ class amazon {
          * @param filesPrefix The name of the prefix. The form is amazon_reviews_us_Electronics_v1_00,
          *                    which will expect the two files amazon_reviews_us_Electronics_v1_00.bin and
          *                    amazon_reviews_us_Electronics_v1_00_keyword_index.bin 
+         * @param residency How eagerly to bring the files into memory (see ResidencyPolicy)
+         *
+         * When a segment manifest (<filesPrefix>_segments.txt, see appendSegment) is present,
+         * the database spans every segment it lists.
          */
-        amazon(const std::string& directory, const std::string& filesPrefix);
+        amazon(const std::string& directory, const std::string& filesPrefix,
+            const ResidencyPolicy& residency = ResidencyPolicy());
 
         /**
          * Predicate Method: good
@@ -58,6 +216,9 @@ class amazon {
          *     1.) either one or both of the data files supporting the database were missing
          *     2.) the directory passed to the constructor doesn't exist.
          *     3.) the directory and files all exist, but you don't have the permission to read them.
+         *
+         * A database whose base files a compaction has replaced is good when the segments
+         * listed in its manifest opened.
          */
 
         bool good() const;
@@ -70,17 +231,199 @@ class amazon {
          * vector with the results. If the search produces no results, the vector is cleared,
          * and its size is left at 0.
          *
+         * When maxThreads is greater than 1 and the query's cheapest term still has a long
+         * posting list, the intersection is split into ranges of review indexes that are
+         * evaluated on up to maxThreads threads, and their results are concatenated in order.
+         *
          * @param query A query, e.g., 'tv "broke quickly"'
          * @param reviewIndexes A reference to the vector of indexes that will hold
          *                      the resulting indexes from the query. If the query produces no results, 
          *                      reviewIndexes should be cleared and resized to a length of 0.
+         * @param maxThreads The most threads a single query may use (default is 1)
          *
          * @return true if and only if the query returns at least one matching index 
          */
 
-        bool searchKeywordIndex(const std::string& query, std::vector<unsigned int> &reviewIndexes) const;
+        bool searchKeywordIndex(const std::string& query, std::vector<unsigned int> &reviewIndexes,
+            unsigned int maxThreads = 1) const;
+
+
+        /**
+         * Method: searchBatch
+         * --------------------
+         * Evaluates many queries in one pass over the keyword index.  Every query is parsed
+         * up front; each distinct keyword is looked up once and each distinct term (word or
+         * phrase) is matched against the posting lists once, and its reviews are then shared
+         * by every query that uses it.  The cost grows with the number of distinct terms
+         * rather than with the number of queries.
+         *
+         * @param queries The queries to evaluate, each in the form searchKeywordIndex accepts
+         *
+         * @return One vector of review indexes per query, in the same order as queries, each
+         *         holding exactly what searchKeywordIndex would produce for that query
+         */
+
+        std::vector<std::vector<unsigned int>> searchBatch(const std::vector<std::string>& queries) const;
+
+
+
+        /**
+         * Method: findKeyword
+         * --------------------
+         * The first stage of searchKeywordIndex: looks up the position of a keyword in this
+         * instance's own keyword index, using the in-memory keyword dictionary.  Segments
+         * listed by the manifest are not consulted.
+         *
+         * @return The keyword's position in the index's offset array, or -1 if it isn't there
+         */
+
+        int findKeyword(const std::string& keyword) const;
+
+
+        /**
+         * Method: buildQueryCursors
+         * --------------------
+         * The second stage of searchKeywordIndex: builds one phrase cursor per term of a query
+         * parsed by convertQuery, over this instance's own keyword index.  Intersecting the
+         * cursors with intersectPhrases gives the query's matching reviews.
+         *
+         * @return false if the query has no terms or any term can't match
+         */
+
+        bool buildQueryCursors(const std::vector<std::vector<std::string>>& terms, std::vector<PhraseCursor>& phrases) const;
+
+
+        /**
+         * Static Method: parseBooleanQuery
+         * --------------------------------
+         * Parses a query with boolean operators.  Terms are written as for searchKeywordIndex
+         * and are all required, except that
+         *
+         *     a OR b OR c      requires at least one of a, b and c
+         *     NOT a, -a        excludes every review containing a
+         *
+         * so 'tv OR monitor "dead pixels" -refurbished' asks for reviews mentioning a tv or a
+         * monitor, and dead pixels, but not refurbished.  The operators are only recognized
+         * in upper case and outside quotes; a dangling operator is ignored.
+         */
+        static BooleanQuery parseBooleanQuery(const std::string& query);
+
+
+        /**
+         * Method: searchBoolean
+         * ---------------------
+         * Like searchKeywordIndex, but for a query in the form parseBooleanQuery accepts.
+         * Clauses of a single term are leapfrogged together as searchKeywordIndex does; an OR
+         * clause is the union of its terms' reviews, filtered through the rest; excluded
+         * terms are then checked candidate by candidate with forward-only seeks.  A query with
+         * no required clause matches nothing.  Results bypass the result cache.
+         *
+         * @return true if and only if the query returns at least one matching index
+         */
+        bool searchBoolean(const std::string& query, std::vector<unsigned int> &reviewIndexes) const;
+
+
+        /**
+         * Method: searchRanked
+         * --------------------
+         * Finds the k reviews that best match the query's terms by BM25 (k1 = 1.2, b = 0.75),
+         * best first, ties going to the lower review index.  Ranking is disjunctive: a review
+         * containing any of the query's terms (from any clause of the boolean syntax) is a
+         * candidate, and excluded terms still exclude.
+         *
+         *   - A term's frequency in a review is its number of occurrences, counted from the
+         *     positions in the postings, so phrases are scored as phrases.
+         *   - A review's length is the size of its database record in bytes, which the offset
+         *     array gives for free, and the average length follows from the file size.
+         *   - A word's document frequency is counted by seeking through its list review by
+         *     review the first time it's ranked, and remembered; a phrase uses its rarest word's.
+         *
+         * Evaluation is document-at-a-time with MaxScore pruning: each term's score is bounded
+         * by idf * (k1 + 1), and once the k-th best score exceeds the combined bound of the
+         * least valuable terms, reviews containing only those terms are never visited, and
+         * the rest stop being scored as soon as they can't reach the top k.
+         *
+         * @return true if and only if at least one review was ranked
+         */
+        bool searchRanked(const std::string& query, size_t k, std::vector<RankedReview> &results) const;
         
         
+        /**
+         * Method: warm
+         * --------------------
+         * Reads through every page of the review database, keyword index and any sidecar
+         * files, so later queries find them in memory instead of faulting on them one page
+         * at a time.  Safe to call concurrently with queries.
+         */
+
+        void warm() const;
+
+
+        /**
+         * Method: lastQueryPageFaults
+         * --------------------
+         * Returns the page faults the calling thread took during its most recent call to
+         * searchKeywordIndex.
+         */
+
+        static PageFaultCounts lastQueryPageFaults();
+
+
+        /**
+         * Static Method: threadPageFaults
+         * --------------------
+         * Returns the page faults the calling thread has taken so far; the difference
+         * between two calls counts the faults taken by the code in between.
+         */
+
+        static PageFaultCounts threadPageFaults();
+
+
+        /**
+         * Static Method: lastQueryStats
+         * --------------------
+         * Returns the calling thread's statistics for its most recent search (any of
+         * searchKeywordIndex, searchBoolean, searchRanked or searchBatch), including the
+         * sorting and fetching of results it has done since.  Reports enabled == false
+         * unless the library was built with AMAZON_QUERY_STATS; see query_stats.h.
+         */
+
+        static QueryStats lastQueryStats();
+
+
+        /**
+         * Method: enableResultCache
+         * --------------------
+         * Turns on caching of searchKeywordIndex results, keyed on the normalized query
+         * (its parsed terms, sorted and deduplicated, so 'TV remote' and 'remote tv' share
+         * an entry) and bounded to maxQueryBytes.  When maxTermBytes is nonzero, the
+         * reviews matching each individual term are cached as well, and a query missing the
+         * first cache is answered by intersecting its terms' cached lists; this pays off
+         * when different queries keep reusing the same terms.
+         *
+         * Unlike the const methods, this must be called before the database is shared
+         * between threads.  The caches themselves are thread-safe.
+         *
+         * @param maxQueryBytes The most memory the query result cache may use
+         * @param maxTermBytes The most memory the per-term cache may use (0 disables it)
+         *
+         * @return none
+         */
+
+        void enableResultCache(size_t maxQueryBytes, size_t maxTermBytes = 0);
+
+
+        /**
+         * Method: queryCacheStats / termCacheStats
+         * --------------------
+         * Return the hit, miss and eviction counters and current size of each result cache
+         * (all zero when that cache is disabled).
+         */
+
+        ResultCacheStats queryCacheStats() const;
+        ResultCacheStats termCacheStats() const;
+
+
         /**
          * Method: getReview
          * --------------------
@@ -94,6 +437,21 @@ class amazon {
          */
        
         bool getReview(unsigned int index, Review &review) const;
+
+
+        /**
+         * Method: getReview
+         * --------------------
+         * Like getReview above, but fills in a zero-copy ReviewView instead of copying
+         * every field into a Review.  Nothing is allocated.
+         *
+         * @param index The index of the query in the reviews database 
+         * @param review A reference to the ReviewView that should be pointed at the review
+         *        
+         * @return true if and only if the review database contains a review at index 
+         */
+
+        bool getReview(unsigned int index, ReviewView &review) const;
         
         
         /**
@@ -114,26 +472,283 @@ class amazon {
             std::function<bool(const Review &, const Review &)> cmp) const;
 
 
+        /**
+         * Method: getSortedReviewsFromIndexes 
+         * --------------------
+         * Like getSortedReviewsFromIndexes above, but populates a vector of ReviewViews, so
+         * fetching and sorting allocates nothing per review beyond the vector's own storage.
+         *
+         * @param reviewIndexes A reference to a vector of indexes into the reviews database 
+         * @param reviews A reference to a vector of ReviewViews that will be populated
+         * @param cmp The comparison function to compare ReviewViews 
+         *        
+         * @return none 
+         */
+
+        void getSortedReviewsFromIndexes(const std::vector<unsigned int> &reviewIndexes,
+            std::vector<ReviewView> &reviews,
+            std::function<bool(const ReviewView &, const ReviewView &)> cmp) const;
+
+
+        /**
+         * Method: getSortKey
+         * --------------------
+         * Populates key with the sort properties of the review at index.  They come from the
+         * precomputed sort key table when one is loaded (see writeSortKeyTable), and are
+         * otherwise measured from the review itself without copying it.
+         *
+         * @return true if and only if the review database contains a review at index 
+         */
+
+        bool getSortKey(unsigned int index, ReviewSortKey &key) const;
+
+
+        /**
+         * Method: sortReviewIndexes
+         * --------------------
+         * Reorders reviewIndexes by comparing the reviews' sort keys rather than whole
+         * reviews, so the text only needs to be fetched (with getReview) for the matches
+         * that are actually shown.
+         *
+         * @param reviewIndexes A reference to a vector of indexes into the reviews database 
+         * @param cmp The comparison function to compare ReviewSortKeys 
+         *        
+         * @return none 
+         */
+
+        void sortReviewIndexes(std::vector<unsigned int> &reviewIndexes,
+            std::function<bool(const ReviewSortKey &, const ReviewSortKey &)> cmp) const;
+
+
+        /**
+         * Method: topReviewIndexes
+         * --------------------
+         * Like sortReviewIndexes, but keeps only the first k reviews of the ordering:
+         * reviewIndexes is left holding those k (or fewer) indexes, in order.  The winners
+         * are selected with a bounded heap of k sort keys, so the cost is O(n log k) time
+         * and O(k) space however many indexes are passed in.
+         *
+         * @param reviewIndexes A reference to a vector of indexes into the reviews database 
+         * @param k The number of reviews to keep
+         * @param cmp The comparison function to compare ReviewSortKeys 
+         *        
+         * @return none 
+         */
+
+        void topReviewIndexes(std::vector<unsigned int> &reviewIndexes, size_t k,
+            std::function<bool(const ReviewSortKey &, const ReviewSortKey &)> cmp) const;
+
+
+        /**
+         * Method: getTopReviewsFromIndexes
+         * --------------------
+         * Populates reviews with views of the first k reviews of reviewIndexes in the order
+         * given by cmp.  Only the k winning reviews are ever fetched.
+         *
+         * @param reviewIndexes A reference to a vector of indexes into the reviews database 
+         * @param k The number of reviews to return
+         * @param reviews A reference to a vector of ReviewViews which will be populated 
+         * @param cmp The comparison function to compare ReviewSortKeys 
+         *        
+         * @return none 
+         */
+
+        void getTopReviewsFromIndexes(const std::vector<unsigned int> &reviewIndexes, size_t k,
+            std::vector<ReviewView> &reviews,
+            std::function<bool(const ReviewSortKey &, const ReviewSortKey &)> cmp) const;
+
+
+        /**
+         * Method: hasSortKeyTable
+         * --------------------
+         * Returns true if the precomputed sort key table (<filesPrefix>_sort_keys.bin) was
+         * found next to the review database, was built from that same database, and is
+         * being used by getSortKey.
+         */
+
+        bool hasSortKeyTable() const { return sortKeyFile != nullptr; }
+
+
+        /**
+         * Static Method: writeSortKeyTable
+         * --------------------
+         * Scans every review once and writes the columnar sort key table as
+         * <directory>/<filesPrefix>_sort_keys.bin, holding each review's packed date, star
+         * rating, field lengths and title prefix, keyed by review index.
+         *
+         * @return true if and only if the table was written successfully
+         */
+
+        static bool writeSortKeyTable(const std::string& directory, const std::string& filesPrefix);
+
+
         /**
          * Method: totalKeywords
          * --------------------
-         * Returns the total number of keywords in the keyword database 
+         * Returns the total number of keywords in the keyword database.  When the database
+         * spans several segments, this counts the base segment's keywords (after a
+         * compaction, the merged base's).
          *
          * @return the number of keywords 
          */
 
-        unsigned int totalKeywords() const { return *(unsigned int *)keywordIndexFile; }
+        unsigned int totalKeywords() const;
 
 
         /**
          * Method: totalReviews
          * --------------------
-         * Returns the total number of reviews in the database 
+         * Returns the total number of reviews in the database, across all of its segments
          *
          * @return the number of reviews
          */
 
-        unsigned int totalReviews() const { return *(unsigned int *)databaseFile; }
+        unsigned int totalReviews() const;
+
+
+        /**
+         * Method: totalSegments
+         * --------------------
+         * Returns the number of segments the database currently spans (see appendSegment).
+         */
+
+        size_t totalSegments() const;
+
+
+        /**
+         * Static Method: appendSegment
+         * --------------------
+         * Makes reviews searchable without rebuilding the database: they're written as a
+         * small delta segment (its own review database and keyword index, named
+         * <filesPrefix>_delta_<n>) and listed in the segment manifest,
+         * <directory>/<filesPrefix>_segments.txt.  An amazon instance treats the segments
+         * named by the manifest as one database: the first (base) segment's reviews come
+         * first, each later segment's reviews are numbered after the earlier ones', and
+         * every query is answered across all of them.  Open instances see the new reviews
+         * after their next call to refreshSegments.
+         *
+         * The manifest is locked while it changes, so several processes may append at once.
+         *
+         * @return true if and only if the segment was written and listed in the manifest
+         */
+
+        static bool appendSegment(const std::string& directory, const std::string& filesPrefix,
+            const std::vector<Review>& reviews);
+
+
+        /**
+         * Static Method: replaceBaseSegment
+         * --------------------
+         * Makes freshly built <filesPrefix> files the whole database.  writeBase is called to
+         * move the new files into place while the manifest is locked; if it succeeds and
+         * there's a manifest, the manifest is reset to list just <filesPrefix> and the
+         * segments it listed before are deleted, so the appends and compactions made on top
+         * of the old files don't outlive them.  Without a manifest this just calls writeBase.
+         *
+         * @return true if and only if writeBase and any manifest update succeeded
+         */
+
+        static bool replaceBaseSegment(const std::string& directory, const std::string& filesPrefix,
+            const std::function<bool()>& writeBase);
+
+
+        /**
+         * Static Method: compactSegments
+         * --------------------
+         * Merges the segments currently listed in the manifest into a single new base
+         * segment, so queries stop paying for many small segments.  Reviews keep their
+         * indexes.  Segments appended while the merge runs are kept after the new base.
+         * The new base gets a skip index, compressed keyword index and sort key table
+         * whenever the segments it replaces had them.  The replaced segment files, the
+         * original <filesPrefix> files included, are then deleted; instances opened later
+         * go straight to the segments the manifest lists.
+         *
+         * @return true if and only if there was nothing to merge or the merge succeeded
+         */
+
+        static bool compactSegments(const std::string& directory, const std::string& filesPrefix);
+
+
+        /**
+         * Method: refreshSegments
+         * --------------------
+         * Rereads the segment manifest and starts answering queries from the segments it
+         * lists, reusing the segments that haven't changed.  Safe to call concurrently with
+         * queries: a query in flight finishes against the segments it started with.  A
+         * replaced segment, including this instance's own files once a compaction has
+         * superseded them, is unmapped as soon as the last query and ReviewView using it
+         * are done with it.
+         *
+         * @return false if a segment listed in the manifest couldn't be opened, in which
+         *         case the current segments are kept
+         */
+
+        bool refreshSegments();
+
+
+        /**
+         * Method: compactInBackground / waitForCompaction
+         * --------------------
+         * compactInBackground runs compactSegments on a background thread and then
+         * refreshes this instance, while queries carry on against the current segments.
+         * waitForCompaction blocks until a background compaction has finished.
+         */
+
+        void compactInBackground();
+        void waitForCompaction();
+
+
+        /**
+         * Method: hasSkipIndex
+         * --------------------
+         * Returns true if the optional skip index (<filesPrefix>_keyword_skips.bin) was found
+         * next to the keyword index, was built from that same keyword index, and is being
+         * used to speed up long posting lists.
+         */
+
+        bool hasSkipIndex() const { return skipIndexFile != nullptr; }
+
+
+        /**
+         * Static Method: writeSkipIndex
+         * --------------------
+         * Builds the skip index companion file for an existing keyword index: for every
+         * posting list longer than blockSize, one skip pointer (first review index and byte
+         * offset) per blockSize postings.  The file is written as
+         * <directory>/<filesPrefix>_keyword_skips.bin, and later amazon instances opened on
+         * the same files pick it up automatically.
+         *
+         * @param blockSize The number of postings covered by each skip pointer
+         *
+         * @return true if and only if the skip index was written successfully
+         */
+
+        static bool writeSkipIndex(const std::string& directory, const std::string& filesPrefix, unsigned int blockSize);
+
+
+        /**
+         * Method: hasCompressedIndex
+         * --------------------
+         * Returns true if the keyword index was opened from its compressed form
+         * (<filesPrefix>_keyword_index_compressed.bin) rather than the plain one.  A
+         * compressed index is only used if it was converted from the plain keyword index
+         * that's there now.
+         */
+
+        bool hasCompressedIndex() const { return compressedPostings; }
+
+
+        /**
+         * Static Method: writeCompressedIndex
+         * --------------------
+         * Converts an existing keyword index into the compressed layout, written as
+         * <directory>/<filesPrefix>_keyword_index_compressed.bin.  Later amazon instances
+         * opened on the same files use it in place of the plain keyword index.
+         *
+         * @return true if and only if the compressed index was written successfully
+         */
+
+        static bool writeCompressedIndex(const std::string& directory, const std::string& filesPrefix);
 
 
         /** Destructor: ~amazon
@@ -145,19 +760,122 @@ class amazon {
     private:
         const void *databaseFile;
         const void *keywordIndexFile;
+        const void *skipIndexFile;
+        const void *sortKeyFile;
+        bool compressedPostings;
+        KeywordDictionary keywords;
+        std::unique_ptr<ResultCache> queryCache;
+        std::unique_ptr<ResultCache> termCache;
+        mutable std::unordered_map<unsigned int, unsigned int> documentFrequencies;
+        mutable std::mutex documentFrequencyLock;
+        ResidencyPolicy residency;
+        std::string directory;
+        std::string filesPrefix;
 
-        /** Method: findKeywordPtr
+        /**
+         * The segments the database currently spans, as listed by the manifest.  A new set
+         * replaces the old one whenever the manifest changes, and queries take their own
+         * reference to the current set, so refreshes never disturb queries in flight.  The
+         * instance's own files are the first segment when includesSelf is set, and selfFiles
+         * then keeps them mapped; every other segment's reviews are numbered starting at its
+         * entry in bases.  An instance opened with its segments always has a set, even if it
+         * only holds the instance's own files.
+         */
+        struct MappedFiles;
+        struct SegmentSet {
+            unsigned long generation;
+            std::vector<std::string> names;
+            bool includesSelf;
+            std::shared_ptr<const MappedFiles> selfFiles;
+            std::vector<std::shared_ptr<const amazon>> segments;
+            std::vector<unsigned int> bases;
+            unsigned int totalReviews;
+        };
+        std::shared_ptr<const SegmentSet> segments;
+        std::mutex refreshLock;
+        std::thread compactionThread;
+
+        amazon(const std::string& directory, const std::string& filesPrefix, const ResidencyPolicy& residency,
+            bool loadSegments);
+        unsigned int localReviews() const { return *(unsigned int *)databaseFile; }
+        unsigned int localKeywords() const { return *(unsigned int *)keywordIndexFile; }
+        bool getLocalReview(unsigned int index, ReviewView &review) const;
+        std::shared_ptr<const SegmentSet> currentSegments() const;
+        bool installSegments(const std::vector<std::string>& names);
+        bool ownFilesReplaced() const;
+        const amazon *segmentFor(const SegmentSet *set, unsigned int &index) const;
+        static bool mergeSegments(const std::vector<const amazon *>& sources, const std::string& directory,
+            const std::string& filesPrefix);
+
+        /** Method: keywordCursor
          *  -------------------
-         *  Perform binary search to find a pointer to the position in memory containing the information for a particular keyword. Return nullptr if keyword not found in database.
+         *  Returns a cursor over the posting list of the keyword at the given position, with
+         *  skip pointers attached when the skip index is loaded.
          */
-        const char * findKeywordPtr(const std::string& keyword) const;
+        PostingCursor keywordCursor(unsigned int ordinal) const;
      
-        /** Method: findReviewsMatchingTerm 
+        /** Method: buildPhraseCursor
+         *  -------------------
+         *  Appends a cursor over each word's posting list to cursor, in phrase order.
+            @return false if the term is empty or any of its words is missing from the index
+         */
+        bool buildPhraseCursor(const std::vector<std::string>& term, PhraseCursor& cursor) const;
+
+        /** Method: searchKeywordIndexUncounted
          *  -------------------
-         *  Iteratively find all reviews containing a term.
-            @return A std::set of all review indices containing the term 
-         */ 
-        std::set<unsigned int> findReviewsContainingTerm(const std::vector<std::string>& term) const;
+         *  searchKeywordIndex without the page fault accounting, or resetting the query statistics.
+         */
+        bool searchKeywordIndexUncounted(const std::string& query, std::vector<unsigned int>& reviewIndexes,
+            unsigned int maxThreads) const;
+
+        /** Method: evaluateSegments
+         *  -------------------
+         *  Evaluates the parsed query against every segment in set (or just this instance's own files when set is null).
+         */
+        void evaluateSegments(const SegmentSet *set, const std::vector<std::vector<std::string>>& terms,
+            std::vector<unsigned int>& reviewIndexes, unsigned int maxThreads) const;
+
+        /** Method: evaluateQuery
+         *  -------------------
+         *  Leapfrogs the terms' posting lists into reviewIndexes, split across up to maxThreads threads.
+         */
+        void evaluateQuery(const std::vector<std::vector<std::string>>& terms, std::vector<unsigned int>& reviewIndexes,
+            unsigned int maxThreads) const;
+
+        /** Method: evaluateQueryByTerms
+         *  -------------------
+         *  Intersects the reviews of each term, taking them from (and adding them to) the term cache.
+         */
+        void evaluateQueryByTerms(const std::vector<std::vector<std::string>>& terms, std::vector<unsigned int>& reviewIndexes) const;
+
+        /** Method: evaluateBoolean
+         *  -------------------
+         *  searchBoolean over this instance's own files only, with local review indexes.
+         */
+        void evaluateBoolean(const BooleanQuery& query, std::vector<unsigned int>& reviewIndexes) const;
+
+        /** Method: rankLocal
+         *  -------------------
+         *  The MaxScore loop of searchRanked over this instance's own files.  idfs holds each
+         *  term's (global) idf; reviews are reported as base + their local index, and compete
+         *  with whatever top is already holding, a min-heap of at most k reviews.
+         */
+        void rankLocal(const std::vector<std::vector<std::string>>& terms, const std::vector<double>& idfs,
+            const std::vector<std::vector<std::string>>& excluded, double averageLength, unsigned int base,
+            size_t k, std::vector<RankedReview>& top) const;
+
+        /** Method: documentFrequency
+         *  -------------------
+         *  The number of local reviews containing the word, memoized in documentFrequencies.
+         */
+        unsigned int documentFrequency(const std::string& word) const;
+
+        /** Method: recordLength
+         *  -------------------
+         *  The size in bytes of the local review's database record.
+         */
+        unsigned int recordLength(unsigned int index) const;
+        uint64_t localRecordBytes() const;
 
 
         /** everything below here needn't be touched.
@@ -167,9 +885,35 @@ class amazon {
             int fd;
             size_t fileSize;
             const void *fileMap;
-        } databaseInfo, keywordIndexInfo;
+        } databaseInfo, keywordIndexInfo, skipIndexInfo, sortKeyInfo;
+
+        /**
+         * The instance's own mapped files, shared with every SegmentSet that includes them
+         * and every ReviewView into them, and unmapped when the last of those lets go.
+         * Reset once a compaction replaces them (see refreshSegments).  Until the instance
+         * itself is destroyed, owner is told to forget the files just before they're unmapped,
+         * so none of its pointers outlive the memory they point into.
+         */
+        struct MappedFiles {
+            fileInfo infos[4];
+            mutable std::atomic<amazon *> owner;
+            MappedFiles() : owner(nullptr) {}
+            ~MappedFiles() {
+                amazon *instance = owner.load();
+                if (instance != nullptr) instance->forgetOwnFiles();
+                for (fileInfo& info : infos) releaseFileMap(info);
+            }
+        };
+        std::shared_ptr<const MappedFiles> ownFiles;
+        std::weak_ptr<const MappedFiles> ownFilesHandle;
+        void forgetOwnFiles();
 
-        static const void *acquireFileMap(const std::string& fileName, struct fileInfo& info);
+        void applyResidencyPolicy(const ResidencyPolicy& residency);
+        void loadSkipIndex(const std::string& skipIndexFileName);
+        bool validSkipEntries(const unsigned int *header) const;
+        void loadSortKeyTable(const std::string& sortKeyFileName);
+        void loadCompressedIndex(const std::string& compressedIndexFileName);
+        static const void *acquireFileMap(const std::string& fileName, struct fileInfo& info, bool hugePageAligned = false);
         static void releaseFileMap(struct fileInfo& info);
 
         amazon(const amazon& original) = delete;
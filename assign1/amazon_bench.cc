@@ -0,0 +1,409 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "amazon.h"
+#include "amazon_writer.h"
+using namespace std;
+
+static const int kDatabaseNotWritten = 2;
+static const int kDatabaseNotFound = 3;
+
+// Defined in amazon.cc; parsing is one of the stages timed below
+vector<vector<string>> convertQuery(string query);
+
+struct BenchmarkConfig {
+    size_t numReviews = 100000;
+    size_t vocabularySize = 50000;
+    size_t numQueries = 200;
+    size_t numLookups = 100000;
+    unsigned int repetitions = 5;
+    unsigned int seed = 1;
+    string directory = "/tmp";
+    string filesPrefix = "amazon_bench";
+    bool keepFiles = false;
+};
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)>" << endl
+        << "Generates a synthetic review database and keyword index, then times each stage of a search" << endl
+        << "and of fetching and ordering its results, printing one JSON object per benchmark." << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-n,--reviews N\tNumber of reviews to generate (default is 100000)" << endl
+        << "\t-v,--vocabulary N\tNumber of distinct words, drawn with a Zipf distribution (default is 50000)" << endl
+        << "\t-q,--queries N\tNumber of queries to time (default is 200)" << endl
+        << "\t-l,--lookups N\tNumber of reviews to fetch in the getReview benchmarks (default is 100000)" << endl
+        << "\t-r,--repetitions N\tTimes to repeat each benchmark (default is 5)" << endl
+        << "\t-s,--seed N\tRandom seed (default is 1)" << endl
+        << "\t-k,--keep\tKeep the generated files instead of deleting them when done" << endl
+        << "\t-d,--directory DIRECTORY\tSpecify the directory for the generated files (default is /tmp)" << endl
+        << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_bench')" << endl;
+}
+
+static int parseArgs(int argc, char **argv, BenchmarkConfig &config) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        size_t *count = nullptr;
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-n") || (arg == "--reviews")) {
+            count = &config.numReviews;
+        } else if ((arg == "-v") || (arg == "--vocabulary")) {
+            count = &config.vocabularySize;
+        } else if ((arg == "-q") || (arg == "--queries")) {
+            count = &config.numQueries;
+        } else if ((arg == "-l") || (arg == "--lookups")) {
+            count = &config.numLookups;
+        } else if ((arg == "-r") || (arg == "--repetitions")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                config.repetitions = max(1, stoi(argv[++i]));
+            } else {
+                cout << "--repetitions option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-s") || (arg == "--seed")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                config.seed = stoul(argv[++i]);
+            } else {
+                cout << "--seed option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-k") || (arg == "--keep")) {
+            config.keepFiles = true;
+        } else if ((arg == "-d") || (arg == "--directory")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                config.directory = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--directory option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else if ((arg == "-f") || (arg == "--files-prefix")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                config.filesPrefix = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--files-prefix option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else {
+            cout << "Unrecognized argument '" << arg << "'" << endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+
+        if (count != nullptr) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                long value = stol(argv[++i]);
+                if (value <= 0) {
+                    cout << arg << " must be positive" << endl;
+                    return -1;
+                }
+                *count = value;
+            } else {
+                cout << arg << " option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Class: SyntheticCorpus
+ * ----------------------
+ * Generates reviews whose words follow a Zipf distribution over a fixed vocabulary, like
+ * natural text: a few words appear in most reviews and most words are rare.  Every random
+ * choice comes from one seeded generator, so a configuration always yields the same files.
+ */
+class SyntheticCorpus {
+    public:
+        SyntheticCorpus(const BenchmarkConfig& config) : generator(config.seed) {
+            vocabulary.reserve(config.vocabularySize);
+            cumulative.reserve(config.vocabularySize);
+            double total = 0;
+            for (size_t rank = 0; rank < config.vocabularySize; rank++) {
+                vocabulary.push_back(wordForRank(rank));
+                total += 1.0 / (rank + 1);
+                cumulative.push_back(total);
+            }
+        }
+
+        const string& commonWord() {
+            double sample = uniform_real_distribution<double>(0, cumulative.back())(generator);
+            size_t rank = lower_bound(cumulative.begin(), cumulative.end(), sample) - cumulative.begin();
+            return vocabulary[min(rank, vocabulary.size() - 1)];
+        }
+
+        const string& anyWord() { return vocabulary[uniform(0, vocabulary.size() - 1)]; }
+
+        string text(size_t minWords, size_t maxWords) {
+            string words;
+            size_t numWords = uniform(minWords, maxWords);
+            for (size_t i = 0; i < numWords; i++) {
+                if (i > 0) words += ' ';
+                words += commonWord();
+            }
+            return words;
+        }
+
+        void review(Review& review) {
+            review.product_title = text(1, 8);
+            review.product_category = "Electronics";
+            review.star_rating = uniform(1, 5);
+            review.review_headline = text(1, 10);
+            review.review_body = text(5, 120);
+            review.review_year = uniform(1999, 2015);
+            review.review_month = uniform(1, 12);
+            review.review_day = uniform(1, 28);
+        }
+
+        size_t uniform(size_t low, size_t high) { return uniform_int_distribution<size_t>(low, high)(generator); }
+
+    private:
+        mt19937_64 generator;
+        vector<string> vocabulary;
+        vector<double> cumulative;
+
+        // Pronounceable-ish distinct words: rank written in base 20 over alternating letters
+        static string wordForRank(size_t rank) {
+            static const char consonants[] = "bcdfghjklmnprstvwxyz";
+            static const char vowels[] = "aeiou";
+            string word;
+            do {
+                word += consonants[rank % 20];
+                rank /= 20;
+                word += vowels[rank % 5];
+                rank /= 5;
+            } while (rank > 0);
+            return word;
+        }
+};
+
+/**
+ * Generates the database and keyword index, plus a mix of queries drawn from the reviews
+ * themselves: single words, a common word ANDed with a rare one, phrases copied from a
+ * review body, and a phrase ANDed with a word.
+ */
+static bool generateCorpus(const BenchmarkConfig& config, vector<string>& queries) {
+    SyntheticCorpus corpus(config);
+    AmazonWriter writer(config.directory, config.filesPrefix);
+    vector<string> phrases;
+    Review review;
+    for (size_t i = 0; i < config.numReviews; i++) {
+        corpus.review(review);
+        writer.addReview(review);
+        if (phrases.size() < config.numQueries && corpus.uniform(0, config.numReviews - 1) < 2 * config.numQueries) {
+            vector<string> words;
+            forEachReviewWord(review, [&words](const string& word, unsigned int portion, unsigned int) {
+                if (portion == kBodyPortion) words.push_back(word);
+            });
+            size_t length = min<size_t>(words.size(), corpus.uniform(2, 3));
+            size_t start = corpus.uniform(0, words.size() - length);
+            string phrase = "\"";
+            for (size_t w = start; w < start + length; w++) phrase += (w > start ? " " : "") + words[w];
+            phrases.push_back(phrase + "\"");
+        }
+    }
+    if (!writer.finish()) return false;
+
+    for (size_t i = 0; i < config.numQueries; i++) {
+        switch (i % 4) {
+            case 0: queries.push_back(corpus.commonWord()); break;
+            case 1: queries.push_back(corpus.commonWord() + " " + corpus.anyWord()); break;
+            case 2: queries.push_back(phrases.empty() ? corpus.commonWord() : phrases[i % phrases.size()]); break;
+            case 3: queries.push_back((phrases.empty() ? corpus.anyWord() : phrases[i % phrases.size()]) + " " +
+                        corpus.commonWord()); break;
+        }
+    }
+    return true;
+}
+
+static volatile size_t sink;
+
+/**
+ * Runs body, which performs ops operations, config.repetitions times and prints one JSON
+ * line with the fastest and median nanoseconds per operation.
+ */
+template <typename Body>
+static void runBenchmark(const BenchmarkConfig& config, const amazon& db, const string& name, size_t ops, Body body) {
+    vector<double> nsPerOp;
+    for (unsigned int r = 0; r < config.repetitions; r++) {
+        auto start = chrono::steady_clock::now();
+        sink += body();
+        double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        nsPerOp.push_back(elapsed / max<size_t>(ops, 1));
+    }
+    sort(nsPerOp.begin(), nsPerOp.end());
+    cout << fixed << setprecision(1) << "{\"benchmark\": \"" << name << "\", \"reviews\": " << db.totalReviews()
+        << ", \"keywords\": " << db.totalKeywords() << ", \"ops\": " << ops
+        << ", \"repetitions\": " << config.repetitions << ", \"ns_per_op_min\": " << nsPerOp.front()
+        << ", \"ns_per_op_median\": " << nsPerOp[nsPerOp.size() / 2] << "}" << endl;
+}
+
+static bool compareByDate(const ReviewSortKey& lhs, const ReviewSortKey& rhs) {
+    return make_tuple(lhs.date, lhs.body_size, lhs.headline_size, lhs.star_rating, lhs.title_size) <
+        make_tuple(rhs.date, rhs.body_size, rhs.headline_size, rhs.star_rating, rhs.title_size);
+}
+
+/**
+ * Class: AmazonBenchmark
+ * ----------------------
+ * Times the stages of searchKeywordIndex one at a time, through the stage entry points
+ * amazon exposes (convertQuery, findKeyword, buildQueryCursors, intersectPhrases), and
+ * then the ways of fetching and ordering the matching reviews.
+ */
+class AmazonBenchmark {
+    public:
+        static void run(const BenchmarkConfig& config, const amazon& db, const vector<string>& queries) {
+            vector<vector<vector<string>>> parsed;
+            vector<string> words;
+            for (const string& query : queries) {
+                parsed.push_back(convertQuery(query));
+                for (const vector<string>& term : parsed.back()) words.insert(words.end(), term.begin(), term.end());
+            }
+            vector<vector<PhraseCursor>> cursors(queries.size());
+            vector<vector<unsigned int>> results(queries.size());
+            size_t totalMatches = 0;
+            for (size_t i = 0; i < queries.size(); i++) {
+                db.buildQueryCursors(parsed[i], cursors[i]);
+                db.searchKeywordIndex(queries[i], results[i]);
+                totalMatches += results[i].size();
+            }
+
+            runBenchmark(config, db, "parse_query", queries.size(), [&] {
+                size_t terms = 0;
+                for (const string& query : queries) terms += convertQuery(query).size();
+                return terms;
+            });
+            runBenchmark(config, db, "keyword_lookup", words.size(), [&] {
+                size_t found = 0;
+                for (const string& word : words) found += db.findKeyword(word) >= 0;
+                return found;
+            });
+            runBenchmark(config, db, "build_cursors", queries.size(), [&] {
+                size_t built = 0;
+                vector<PhraseCursor> phrases;
+                for (const vector<vector<string>>& terms : parsed) built += db.buildQueryCursors(terms, phrases);
+                return built;
+            });
+            runBenchmark(config, db, "intersect", queries.size(), [&] {
+                size_t matches = 0;
+                vector<unsigned int> reviewIndexes;
+                for (const vector<PhraseCursor>& phrases : cursors) {
+                    // Cursors are consumed as they advance, so each run works on fresh copies
+                    vector<PhraseCursor> copies = phrases;
+                    reviewIndexes.clear();
+                    intersectPhrases(copies, reviewIndexes);
+                    matches += reviewIndexes.size();
+                }
+                return matches;
+            });
+            runBenchmark(config, db, "search_keyword_index", queries.size(), [&] {
+                size_t matches = 0;
+                vector<unsigned int> reviewIndexes;
+                for (const string& query : queries) {
+                    db.searchKeywordIndex(query, reviewIndexes);
+                    matches += reviewIndexes.size();
+                }
+                return matches;
+            });
+
+            mt19937 generator(config.seed);
+            vector<unsigned int> lookups(config.numLookups);
+            for (unsigned int& index : lookups) index = generator() % db.totalReviews();
+            runBenchmark(config, db, "get_review", lookups.size(), [&] {
+                size_t bytes = 0;
+                Review review;
+                for (unsigned int index : lookups) {
+                    db.getReview(index, review);
+                    bytes += review.review_body.size();
+                }
+                return bytes;
+            });
+            runBenchmark(config, db, "get_review_view", lookups.size(), [&] {
+                size_t bytes = 0;
+                ReviewView review;
+                for (unsigned int index : lookups) {
+                    db.getReview(index, review);
+                    bytes += review.review_body().size();
+                }
+                return bytes;
+            });
+
+            // Ordering benchmarks count one operation per matching review
+            runBenchmark(config, db, "get_sorted_reviews", totalMatches, [&] {
+                size_t sorted = 0;
+                vector<Review> reviews;
+                for (const vector<unsigned int>& reviewIndexes : results) {
+                    // getSortedReviewsFromIndexes appends to reviews
+                    reviews.clear();
+                    db.getSortedReviewsFromIndexes(reviewIndexes, reviews, [](const Review& lhs, const Review& rhs) {
+                        return make_tuple(lhs.review_year, lhs.review_month, lhs.review_day, lhs.review_body.size()) <
+                            make_tuple(rhs.review_year, rhs.review_month, rhs.review_day, rhs.review_body.size());
+                    });
+                    sorted += reviews.size();
+                }
+                return sorted;
+            });
+            runBenchmark(config, db, "sort_review_keys", totalMatches, [&] {
+                size_t sorted = 0;
+                for (vector<unsigned int> reviewIndexes : results) {
+                    db.sortReviewIndexes(reviewIndexes, compareByDate);
+                    sorted += reviewIndexes.size();
+                }
+                return sorted;
+            });
+            runBenchmark(config, db, "top_10_reviews", totalMatches, [&] {
+                size_t shown = 0;
+                vector<ReviewView> reviews;
+                for (const vector<unsigned int>& reviewIndexes : results) {
+                    db.getTopReviewsFromIndexes(reviewIndexes, 10, reviews, compareByDate);
+                    shown += reviews.size();
+                }
+                return shown;
+            });
+        }
+};
+
+int main(int argc, char **argv) {
+    BenchmarkConfig config;
+    if (parseArgs(argc, argv, config) == -1) return -1;
+
+    vector<string> queries;
+    auto start = chrono::steady_clock::now();
+    if (!generateCorpus(config, queries)) {
+        cerr << "Problem writing the synthetic database...aborting!" << endl;
+        return kDatabaseNotWritten;
+    }
+    double generateSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int status = 0;
+    {
+        amazon db(config.directory, config.filesPrefix);
+        if (!db.good()) {
+            cerr << "Problem reading data files...aborting!" << endl;
+            status = kDatabaseNotFound;
+        } else {
+            cout << fixed << setprecision(3) << "{\"benchmark\": \"generate\", \"reviews\": " << db.totalReviews()
+                << ", \"keywords\": " << db.totalKeywords() << ", \"queries\": " << queries.size()
+                << ", \"seconds\": " << generateSeconds << "}" << endl;
+            AmazonBenchmark::run(config, db, queries);
+        }
+    }
+    if (!config.keepFiles) {
+        unlink((config.directory + "/" + config.filesPrefix + ".bin").c_str());
+        unlink((config.directory + "/" + config.filesPrefix + "_keyword_index.bin").c_str());
+    }
+    return status;
+}
@@ -0,0 +1,242 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include "amazon_writer.h"
+
+using namespace std;
+
+// Workers claim the input this many lines at a time
+static const size_t kLinesPerChunk = 4096;
+
+// Rough per-keyword cost of a partial index entry beyond its postings: the hash node, the
+// string and the vector headers.  Only used to decide when to spill a run.
+static const size_t kKeywordOverhead = 96;
+
+/**
+ * A run file holds one partial inverted index, keywords in ascending order:
+ *
+ *     [u32 keyword length] keyword [u32 count] count posting keys (u64)
+ *
+ * Postings within a run are ascending, because each worker claims chunks in input order.
+ */
+typedef unordered_map<string, vector<uint64_t>> PartialIndex;
+
+namespace {
+struct BuildState {
+    istream& reviews;
+    mutex inputLock;
+    size_t nextChunk;
+
+    mutex commitLock;
+    condition_variable committed;
+    size_t nextCommit;
+    unsigned int numReviews;
+    size_t skippedLines;
+    OffsetTableWriter database;
+
+    mutex runsLock;
+    string runPrefix;
+    vector<string> runFileNames;
+    bool failed;
+
+    BuildState(istream& reviews, const string& databaseFileName, const vector<string>& databaseSidecars,
+            const string& runPrefix) :
+        reviews(reviews), nextChunk(0), nextCommit(0), numReviews(0), skippedLines(0),
+        database(databaseFileName, databaseSidecars), runPrefix(runPrefix), failed(false) {}
+};
+
+struct RunReader {
+    ifstream in;
+    string keyword;
+    vector<uint64_t> postings;
+    bool failed;
+
+    RunReader(const string& fileName) : in(fileName, ios::binary), failed(!in) {}
+
+    /** Reads the next keyword and its postings.  Returns false at the end of the run. */
+    bool next() {
+        unsigned int length, count;
+        if (!in.read((char *) &length, sizeof(length))) {
+            if (in.gcount() != 0 || !in.eof()) failed = true;
+            return false;
+        }
+        keyword.resize(length);
+        in.read(&keyword[0], length);
+        in.read((char *) &count, sizeof(count));
+        if (in) {
+            postings.resize(count);
+            in.read((char *) postings.data(), count * sizeof(uint64_t));
+        }
+        if (!in) failed = true;
+        return !failed;
+    }
+};
+}
+
+static bool writeRun(BuildState& state, PartialIndex& partial) {
+    string fileName;
+    {
+        lock_guard<mutex> lg(state.runsLock);
+        fileName = state.runPrefix + to_string(state.runFileNames.size());
+        state.runFileNames.push_back(fileName);
+    }
+
+    vector<PartialIndex::value_type *> keywords;
+    keywords.reserve(partial.size());
+    for (auto& keyword : partial) keywords.push_back(&keyword);
+    sort(keywords.begin(), keywords.end(), [](const PartialIndex::value_type *lhs, const PartialIndex::value_type *rhs) {
+        return lhs->first < rhs->first;
+    });
+
+    ofstream out(fileName, ios::binary | ios::trunc);
+    for (const PartialIndex::value_type *keyword : keywords) {
+        unsigned int length = keyword->first.size();
+        unsigned int count = keyword->second.size();
+        out.write((const char *) &length, sizeof(length));
+        out.write(keyword->first.data(), length);
+        out.write((const char *) &count, sizeof(count));
+        out.write((const char *) keyword->second.data(), count * sizeof(uint64_t));
+    }
+    out.close();
+    partial.clear();
+    return bool(out);
+}
+
+static void buildWorker(BuildState& state, size_t memoryBudget) {
+    PartialIndex partial;
+    size_t partialBytes = 0;
+    bool ok = true;
+    vector<string> lines;
+    vector<Review> parsed;
+    vector<string> records;
+    while (true) {
+        size_t chunk;
+        lines.clear();
+        {
+            lock_guard<mutex> lg(state.inputLock);
+            string line;
+            while (lines.size() < kLinesPerChunk && getline(state.reviews, line)) lines.push_back(move(line));
+            if (lines.empty()) break;
+            chunk = state.nextChunk++;
+        }
+
+        parsed.clear();
+        records.clear();
+        Review review;
+        for (const string& line : lines) {
+            if (!parseReviewLine(line, review)) continue;
+            parsed.push_back(review);
+            records.emplace_back();
+            encodeReviewRecord(review, records.back());
+        }
+
+        // Records go into the database in chunk order, which is what numbers the reviews
+        unsigned int firstReview;
+        {
+            unique_lock<mutex> ul(state.commitLock);
+            state.committed.wait(ul, [&state, chunk] { return state.nextCommit == chunk; });
+            firstReview = state.numReviews;
+            for (const string& record : records) state.database.add(record);
+            state.numReviews += records.size();
+            state.skippedLines += lines.size() - records.size();
+            state.nextCommit++;
+        }
+        state.committed.notify_all();
+
+        for (size_t i = 0; i < parsed.size(); i++) {
+            const unsigned int index = firstReview + i;
+            forEachReviewWord(parsed[i], [&partial, &partialBytes, index](const string& word, unsigned int portion,
+                    unsigned int offset) {
+                vector<uint64_t>& postings = partial[word];
+                if (postings.empty()) partialBytes += word.size() + kKeywordOverhead;
+                postings.push_back(postingKey(index, (portion << 24) | offset));
+                partialBytes += sizeof(uint64_t);
+            });
+        }
+        if (partialBytes >= memoryBudget) {
+            ok = writeRun(state, partial) && ok;
+            partialBytes = 0;
+        }
+    }
+    if (!partial.empty()) ok = writeRun(state, partial) && ok;
+    if (!ok) {
+        lock_guard<mutex> lg(state.runsLock);
+        state.failed = true;
+    }
+}
+
+static bool mergeRuns(const vector<string>& runFileNames, OffsetTableWriter& keywordIndex) {
+    vector<unique_ptr<RunReader>> runs;
+    for (const string& fileName : runFileNames) runs.emplace_back(new RunReader(fileName));
+
+    // Min-heap of runs by current keyword; ties go to the earlier run
+    auto later = [&runs](size_t lhs, size_t rhs) {
+        int order = runs[lhs]->keyword.compare(runs[rhs]->keyword);
+        return order > 0 || (order == 0 && lhs > rhs);
+    };
+    priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (runs[i]->next()) heap.push(i);
+    }
+
+    string keyword;
+    vector<uint64_t> postings;
+    string entry;
+    while (!heap.empty()) {
+        keyword = runs[heap.top()]->keyword;
+        postings.clear();
+        bool sorted = true;
+        while (!heap.empty() && runs[heap.top()]->keyword == keyword) {
+            size_t i = heap.top();
+            heap.pop();
+            const vector<uint64_t>& runPostings = runs[i]->postings;
+            // Runs from different workers interleave by review, so only sometimes is this a plain append
+            if (!postings.empty() && !runPostings.empty() && runPostings.front() < postings.back()) sorted = false;
+            postings.insert(postings.end(), runPostings.begin(), runPostings.end());
+            if (runs[i]->next()) heap.push(i);
+        }
+        if (!sorted) sort(postings.begin(), postings.end());
+        entry.clear();
+        encodeKeywordEntry(keyword, postings, entry);
+        keywordIndex.add(entry);
+    }
+
+    for (const unique_ptr<RunReader>& run : runs) {
+        if (run->failed) return false;
+    }
+    return true;
+}
+
+bool buildDatabase(istream& reviews, const string& directory, const string& filesPrefix,
+        const DatabaseBuildOptions& options, DatabaseBuildStats& stats) {
+    const string prefix = directory + "/" + filesPrefix;
+    BuildState state(reviews, prefix + ".bin", databaseSidecars(directory, filesPrefix), prefix + ".run.");
+    const size_t numThreads = max<size_t>(options.numThreads, 1);
+    const size_t memoryBudget = max<size_t>(options.memoryBudget / numThreads, 1);
+
+    vector<thread> workers;
+    for (size_t i = 0; i < numThreads; i++) {
+        workers.push_back(thread([&state, memoryBudget] { buildWorker(state, memoryBudget); }));
+    }
+    for (thread& worker : workers) worker.join();
+
+    OffsetTableWriter keywordIndex(prefix + "_keyword_index.bin", keywordIndexSidecars(directory, filesPrefix));
+    bool merged = !state.failed && mergeRuns(state.runFileNames, keywordIndex);
+    for (const string& fileName : state.runFileNames) unlink(fileName.c_str());
+
+    stats.reviews = state.numReviews;
+    stats.skippedLines = state.skippedLines;
+    stats.keywords = keywordIndex.size();
+    stats.runs = state.runFileNames.size();
+    if (!merged) return false;
+    // The segments appended to or compacted from the old files go along with them
+    return amazon::replaceBaseSegment(directory, filesPrefix, [&state, &keywordIndex] {
+        bool indexWritten = keywordIndex.finish();
+        return state.database.finish() && indexWritten;
+    });
+}
@@ -0,0 +1,258 @@
+#include <unistd.h>
+#include <iostream>
+#include <iomanip> // for setw formatter
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "amazon.h"
+#include "search_options.h"
+#include "query_protocol.h"
+using namespace std;
+
+static const int kServerNotFound = 2;
+static const int kQueryFileNotFound = 3;
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)> 'search string'" << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-k,--primary-key\tPrimary key, one of: date, stars, bodysize, titlesize (default is date)" << endl
+        << "\t-r,--reversed\tReverse ordering for primary key, making it descending instead of ascending" << endl
+        << "\t-n,--number-of-reviews\tNumber of reviews to show (default is to show all reviews, or 10 ranked ones)" << endl
+        << "\t-q,--query-mode MODE\tHow to read queries: and (every term required, the default), boolean (with OR," << endl
+        << "\t\t\tNOT and -term), or ranked (the best matches for any of the terms, by BM25)" << endl
+        << "\t-b,--batch QUERY_FILE\tRun every query in QUERY_FILE (one per line) over one connection" << endl
+        << "\t-t,--timing\tReport the time the server spent on each query, and the round trip" << endl
+        << "\t-s,--socket PATH\tTalk to the server listening on PATH (default is '" << kDefaultSocketPath << "')" << endl;
+}
+
+static int parseArgs(int argc, char **argv, bool &interactive, string &socketPath, int &primaryKey, bool &reversed,
+        size_t &numReviews, int &queryMode, string &batchFileName, bool &reportTiming, string &searchString) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-k") || (arg == "--primary-key")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                string pKeyStr = argv[++i];
+                if (pKeyStr == "date") {
+                    primaryKey = DATE;
+                } else if (pKeyStr == "stars") {
+                    primaryKey = STARS;
+                } else if (pKeyStr == "bodysize") {
+                    primaryKey = BODY_SIZE;
+                } else if (pKeyStr == "titlesize") {
+                    primaryKey = TITLE_SIZE;
+                } else {
+                    cout << "--primary-key must be either date, stars, bodysize, or titlesize" << endl;
+                    showUsage(argv[0]);
+                    return -1;
+                }
+            }
+        } else if ((arg == "-n") || (arg == "--number-of-reviews")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+               numReviews = stoi(argv[++i]);
+            } else {
+                cout << "--number-of-reviews needs one argument" << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-q") || (arg == "--query-mode")) {
+            string mode = i + 1 < argc ? argv[++i] : "";
+            if (mode == "and") {
+                queryMode = AND_QUERY;
+            } else if (mode == "boolean") {
+                queryMode = BOOLEAN_QUERY;
+            } else if (mode == "ranked") {
+                queryMode = RANKED_QUERY;
+            } else {
+                cout << "--query-mode must be either and, boolean, or ranked" << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-b") || (arg == "--batch")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                batchFileName = argv[++i];
+            } else {
+                cout << "--batch option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-t") || (arg == "--timing")) {
+            reportTiming = true;
+        } else if ((arg == "-r") || (arg == "--reversed")) {
+            reversed = true;
+        } else if ((arg == "-s") || (arg == "--socket")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                socketPath = argv[++i];
+            } else {
+                cout << "--socket option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else {
+            searchString = argv[i];
+        }
+    }
+    if (!interactive && searchString == "" && batchFileName == "") {
+        cout << "No search string found. Going into interactive mode" << endl;
+        interactive = true;
+    }
+    return 0;
+}
+
+/**
+ * Function: showResponse
+ * ----------------------
+ * Prints a response exactly as amazon_search prints the same query's results.
+ */
+static void showResponse(const string& searchString, const QueryResponse& response, int queryMode, bool interactive) {
+    if (response.header.status == RESPONSE_TOO_LARGE) {
+        cout << "The server could not send the results of query '" << searchString << "'" << endl;
+        return;
+    }
+    if (response.header.status != RESPONSE_OK) {
+        cout << "The server rejected query '" << searchString << "'" << endl;
+        return;
+    }
+    if (response.header.totalMatches == 0) {
+        cout << "Could not find any matches for query '" << searchString << "'" << endl;
+        return;
+    }
+
+    const bool ranked = queryMode == RANKED_QUERY;
+    if (ranked) {
+        cout << "Ranked the best " << response.header.totalMatches << " matching reviews out of " <<
+            response.header.totalReviews << " reviews in the database." << endl;
+    } else {
+        cout << "Found " << response.header.totalMatches << " matching reviews out of " <<
+            response.header.totalReviews << " reviews in the database." << endl;
+        if (interactive) {
+            cout << "Press <enter> to see the first five reviews." << flush;
+            string userInput;
+            getline(cin, userInput);
+        }
+    }
+
+    for (size_t i = 0; i < response.reviews.size(); i++) {
+        cout << "**********" << endl;
+        if (ranked) cout << "Score: " << fixed << setprecision(4) << response.scores[i] << defaultfloat << endl;
+        cout << response.reviews[i] << endl;
+        cout << "**********" << endl << endl;
+
+        if (interactive && (i + 1) % 5 == 0 && (!ranked || i + 1 < response.reviews.size())) {
+            cout << "Press <enter> to see the next five reviews ('q' to quit). " << flush;
+            string userInput;
+            getline(cin, userInput);
+            if (userInput != "" && tolower(userInput[0]) == 'q') break;
+        }
+    }
+}
+
+/**
+ * Function: query
+ * ---------------
+ * Sends one request over the connection and waits for its response, returning the
+ * round trip time in microseconds, or a negative value if the server went away.
+ */
+static double query(int connection, const QueryRequest& request, QueryResponse& response) {
+    auto start = chrono::steady_clock::now();
+    string frame;
+    encodeQueryRequest(request, frame);
+    if (!writeFrame(connection, frame) || !readQueryResponse(connection, response)) return -1;
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+static void reportLatencies(const string& name, vector<double> latencies) {
+    if (latencies.empty()) return;
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        size_t rank = (size_t) (p / 100.0 * (latencies.size() - 1) + 0.5);
+        return latencies[rank];
+    };
+    cout << fixed << setprecision(1) << name << " over " << latencies.size() << " queries (us): "
+        << "p50 " << percentile(50) << ", p90 " << percentile(90) << ", p99 " << percentile(99)
+        << ", max " << latencies.back() << defaultfloat << endl;
+}
+
+int main(int argc, char **argv) {
+    bool interactive = false;
+    string socketPath = kDefaultSocketPath;
+    int primaryKey = DATE;
+    bool reversed = false;
+    size_t numReviews = (size_t)-1;
+    int queryMode = AND_QUERY;
+    string batchFileName;
+    bool reportTiming = false;
+    string searchString;
+
+    if (parseArgs(argc, argv, interactive, socketPath, primaryKey, reversed, numReviews, queryMode,
+                batchFileName, reportTiming, searchString) == -1) return -1;
+
+    vector<string> queries;
+    if (batchFileName != "") {
+        ifstream batchFile(batchFileName);
+        if (!batchFile) {
+            cerr << "Could not open query file '" << batchFileName << "'" << endl;
+            return kQueryFileNotFound;
+        }
+        string line;
+        while (getline(batchFile, line)) {
+            if (line != "") queries.push_back(line);
+        }
+    }
+
+    int connection = createClientSocket(socketPath);
+    if (connection == kSocketError) {
+        cerr << "Could not reach a server on '" << socketPath << "'...aborting!" << endl;
+        return kServerNotFound;
+    }
+
+    QueryRequest request;
+    request.mode = queryMode;
+    request.primaryKey = primaryKey;
+    request.reversed = reversed;
+    if (numReviews == (size_t) -1) request.maxReviews = queryMode == RANKED_QUERY ? kDefaultRankedReviews : UINT32_MAX;
+    else request.maxReviews = min<size_t>(numReviews, UINT32_MAX);
+
+    vector<double> roundTrips, serverTimes;
+    size_t next = 0;
+    while (true) {
+        if (batchFileName != "") {
+            if (next == queries.size()) break;
+            searchString = queries[next++];
+            cout << "Query '" << searchString << "'" << endl;
+        } else if (interactive) {
+            cout << "Please enter a search query (<enter> to end): " << flush;
+            getline(cin, searchString);
+            if (searchString == "") break;
+        }
+
+        request.query = searchString;
+        QueryResponse response;
+        double roundTrip = query(connection, request, response);
+        if (roundTrip < 0) {
+            cerr << "Lost the connection to the server...aborting!" << endl;
+            close(connection);
+            return kServerNotFound;
+        }
+        showResponse(searchString, response, queryMode, interactive);
+        roundTrips.push_back(roundTrip);
+        serverTimes.push_back(response.header.serverMicros);
+        if (reportTiming) {
+            cout << fixed << setprecision(1) << "Server time " << response.header.serverMicros << " us, round trip "
+                << roundTrip << " us" << defaultfloat << endl;
+        }
+        if (batchFileName == "" && !interactive) break;
+    }
+    if (batchFileName != "" && reportTiming) {
+        reportLatencies("Server time", serverTimes);
+        reportLatencies("Round trip", roundTrips);
+    }
+    close(connection);
+    return 0;
+}
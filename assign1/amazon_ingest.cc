@@ -0,0 +1,115 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "amazon.h"
+#include "amazon_writer.h"
+using namespace std;
+
+const string kAmazonDataDirectory("/usr/class/archive/cs/cs110/cs110.1204/samples/assign1");
+const string kFilesPrefix("amazon_reviews_us_Electronics_v1_00");
+static const int kSegmentNotWritten = 2;
+static const int kReviewFileNotFound = 3;
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)>" << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-a,--append TSV_FILE\tAppend the reviews in TSV_FILE (Amazon reviews dataset format) as a new segment" << endl
+        << "\t-c,--compact\tMerge all segments back into a single base segment" << endl
+        << "\t-d,--directory DIRECTORY\tSpecify the directory for the database files" << endl
+        << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_reviews_us_Electronics_v1_00')" << endl;
+}
+
+static int parseArgs(int argc, char **argv, string &amazonDataDirectory, string &filesPrefix,
+        string &appendFileName, bool &compact) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-a") || (arg == "--append")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                appendFileName = argv[++i];
+            } else {
+                cout << "--append option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-c") || (arg == "--compact")) {
+            compact = true;
+        } else if ((arg == "-d") || (arg == "--directory")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                amazonDataDirectory = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--directory option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else if ((arg == "-f") || (arg == "--files-prefix")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                filesPrefix = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--files-prefix option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else {
+            cout << "Unrecognized argument '" << arg << "'" << endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+    }
+    if (appendFileName == "" && !compact) {
+        cout << "Nothing to do: specify --append, --compact, or both" << endl;
+        showUsage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string amazonDataDirectory = kAmazonDataDirectory;
+    string filesPrefix = kFilesPrefix;
+    string appendFileName;
+    bool compact = false;
+
+    if (parseArgs(argc, argv, amazonDataDirectory, filesPrefix, appendFileName, compact) == -1) return -1;
+
+    if (appendFileName != "") {
+        ifstream reviewFile(appendFileName);
+        if (!reviewFile) {
+            cerr << "Could not open review file '" << appendFileName << "'" << endl;
+            return kReviewFileNotFound;
+        }
+        vector<Review> reviews;
+        size_t skipped = 0;
+        string line;
+        Review review;
+        while (getline(reviewFile, line)) {
+            if (parseReviewLine(line, review)) reviews.push_back(review);
+            else skipped++;
+        }
+        if (!amazon::appendSegment(amazonDataDirectory, filesPrefix, reviews)) {
+            cerr << "Problem writing the new segment...aborting!" << endl;
+            return kSegmentNotWritten;
+        }
+        cout << "Appended " << reviews.size() << " reviews (" << skipped << " lines skipped)" << endl;
+    }
+
+    if (compact) {
+        if (!amazon::compactSegments(amazonDataDirectory, filesPrefix)) {
+            cerr << "Problem compacting the segments...aborting!" << endl;
+            return kSegmentNotWritten;
+        }
+    }
+
+    amazon db(amazonDataDirectory, filesPrefix);
+    if (!db.good()) {
+        cerr << "Problem reading data files...aborting!" << endl;
+        return kSegmentNotWritten;
+    }
+    cout << db.totalReviews() << " reviews in " << db.totalSegments() << " segment(s)" << endl;
+    return 0;
+}
@@ -0,0 +1,316 @@
+#include <ctype.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <mutex>
+#include "amazon.h"
+
+using namespace std;
+
+// Defined in amazon.cc
+vector<vector<string>> convertQuery(string query);
+void filterReviewList(const vector<unsigned int>& other, vector<unsigned int>& reviewIndexes);
+
+// BM25 parameters: term frequency saturation and length normalization
+static const double kBM25K1 = 1.2;
+static const double kBM25B = 0.75;
+
+// Splits a query at whitespace outside quotes, keeping each quoted phrase (quotes and all) in one token
+static vector<string> splitQuery(const string& query) {
+    vector<string> tokens;
+    string token;
+    bool quoted = false;
+    for (char c : query) {
+        if (c == '"') quoted = !quoted;
+        if (!quoted && isspace((unsigned char) c)) {
+            if (!token.empty()) tokens.push_back(token);
+            token.clear();
+        } else {
+            token += c;
+        }
+    }
+    if (!token.empty()) tokens.push_back(token);
+    return tokens;
+}
+
+BooleanQuery amazon::parseBooleanQuery(const string& query) {
+    QUERY_STAGE(kParseStage);
+    BooleanQuery parsed;
+    bool negated = false;
+    bool joined = false;
+    bool lastWasRequired = false;
+    for (const string& token : splitQuery(query)) {
+        if (token == "NOT") {
+            negated = true;
+            continue;
+        }
+        if (token == "OR") {
+            joined = lastWasRequired;
+            continue;
+        }
+
+        const bool excluded = negated || (token.size() > 1 && token[0] == '-');
+        vector<vector<string>> terms = convertQuery(excluded && !negated ? token.substr(1) : token);
+        for (vector<string>& term : terms) {
+            if (excluded) {
+                parsed.excluded.push_back(move(term));
+            } else if (joined) {
+                parsed.clauses.back().push_back(move(term));
+                joined = false;
+            } else {
+                parsed.clauses.push_back(vector<vector<string>>(1, move(term)));
+            }
+        }
+        lastWasRequired = !excluded && !terms.empty();
+        negated = false;
+        joined = false;
+    }
+    return parsed;
+}
+
+void amazon::evaluateBoolean(const BooleanQuery& query, vector<unsigned int>& reviewIndexes) const {
+    QUERY_STAGE(kMatchStage);
+    // Clauses of one term leapfrog together, exactly like searchKeywordIndex's terms
+    vector<vector<string>> required;
+    vector<const vector<vector<string>> *> alternatives;
+    for (const vector<vector<string>>& clause : query.clauses) {
+        if (clause.size() == 1) required.push_back(clause[0]);
+        else alternatives.push_back(&clause);
+    }
+    if (!required.empty()) {
+        vector<PhraseCursor> phrases;
+        if (!buildQueryCursors(required, phrases)) return;
+        intersectPhrases(phrases, reviewIndexes);
+    }
+
+    // Each OR clause is the union of its terms' reviews, which then filters the candidates
+    bool first = required.empty();
+    vector<unsigned int> clauseReviews, termReviews, merged;
+    for (const vector<vector<string>> *clause : alternatives) {
+        if (!first && reviewIndexes.empty()) return;
+        clauseReviews.clear();
+        for (const vector<string>& term : *clause) {
+            vector<PhraseCursor> phrase(1);
+            if (!buildPhraseCursor(term, phrase[0])) continue;
+            termReviews.clear();
+            intersectPhrases(phrase, termReviews);
+            merged.clear();
+            set_union(clauseReviews.begin(), clauseReviews.end(), termReviews.begin(), termReviews.end(),
+                back_inserter(merged));
+            clauseReviews.swap(merged);
+        }
+        if (first) reviewIndexes.swap(clauseReviews);
+        else filterReviewList(clauseReviews, reviewIndexes);
+        first = false;
+    }
+
+    // Candidates ascend, so each excluded term needs only one forward pass
+    for (const vector<string>& term : query.excluded) {
+        PhraseCursor exclusion;
+        if (!buildPhraseCursor(term, exclusion)) continue;
+        size_t kept = 0;
+        for (size_t i = 0; i < reviewIndexes.size(); i++) {
+            unsigned int reviewIndex = reviewIndexes[i];
+            if (exclusion.seekReview(reviewIndex) && exclusion.reviewIndex() == reviewIndex) continue;
+            reviewIndexes[kept++] = reviewIndex;
+        }
+        reviewIndexes.resize(kept);
+    }
+}
+
+bool amazon::searchBoolean(const string& query, vector<unsigned int>& reviewIndexes) const {
+    QUERY_STATS_SCOPE();
+    reviewIndexes.clear();
+    BooleanQuery parsed = parseBooleanQuery(query);
+    shared_ptr<const SegmentSet> set = currentSegments();
+    if (set == nullptr || set->includesSelf) evaluateBoolean(parsed, reviewIndexes);
+    if (set != nullptr) {
+        vector<unsigned int> segmentIndexes;
+        for (size_t i = 0; i < set->segments.size(); i++) {
+            segmentIndexes.clear();
+            set->segments[i]->evaluateBoolean(parsed, segmentIndexes);
+            for (unsigned int index : segmentIndexes) reviewIndexes.push_back(set->bases[i] + index);
+        }
+    }
+    QUERY_COUNT(matches, reviewIndexes.size());
+    return reviewIndexes.size() > 0;
+}
+
+unsigned int amazon::documentFrequency(const string& word) const {
+    int ordinal = findKeyword(word);
+    if (ordinal < 0) return 0;
+    {
+        lock_guard<mutex> lg(documentFrequencyLock);
+        auto known = documentFrequencies.find(ordinal);
+        if (known != documentFrequencies.end()) return known->second;
+    }
+
+    // Hop from review to review; with skip pointers, long runs within a review are leapt over
+    QUERY_STAGE(kMatchStage);
+    unsigned int frequency = 0;
+    PostingCursor cursor = keywordCursor(ordinal);
+    while (!cursor.done()) {
+        frequency++;
+        cursor.seek(postingKey(cursor.reviewIndex() + 1, 0));
+    }
+    lock_guard<mutex> lg(documentFrequencyLock);
+    documentFrequencies[ordinal] = frequency;
+    return frequency;
+}
+
+unsigned int amazon::recordLength(unsigned int index) const {
+    const unsigned int *offsets = (const unsigned int *) databaseFile + 1;
+    unsigned int end = index + 1 < localReviews() ? offsets[index + 1] : databaseInfo.fileSize;
+    return end - offsets[index];
+}
+
+uint64_t amazon::localRecordBytes() const {
+    return databaseInfo.fileSize - (1 + (uint64_t) localReviews()) * sizeof(unsigned int);
+}
+
+// Orders ranked reviews best first: higher scores, then lower indexes
+static bool rankedBefore(const RankedReview& lhs, const RankedReview& rhs) {
+    return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.index < rhs.index);
+}
+
+namespace {
+struct RankedTerm {
+    PhraseCursor cursor;
+    double idf;
+    double bound;
+    bool live;
+};
+}
+
+void amazon::rankLocal(const vector<vector<string>>& terms, const vector<double>& idfs,
+        const vector<vector<string>>& excluded, double averageLength, unsigned int base,
+        size_t k, vector<RankedReview>& top) const {
+    QUERY_STAGE(kMatchStage);
+    vector<RankedTerm> ranked;
+    for (size_t i = 0; i < terms.size(); i++) {
+        RankedTerm term {PhraseCursor(), idfs[i], idfs[i] * (kBM25K1 + 1), true};
+        if (buildPhraseCursor(terms[i], term.cursor) && term.cursor.seekReview(0)) ranked.push_back(term);
+    }
+    if (ranked.empty()) return;
+    vector<PhraseCursor> exclusions;
+    for (const vector<string>& term : excluded) {
+        exclusions.emplace_back();
+        if (!buildPhraseCursor(term, exclusions.back())) exclusions.pop_back();
+    }
+
+    // Least valuable terms first; boundBelow[i] bounds the score of terms [0, i) together
+    sort(ranked.begin(), ranked.end(), [](const RankedTerm& lhs, const RankedTerm& rhs) {
+        return lhs.bound < rhs.bound;
+    });
+    vector<double> boundBelow(ranked.size() + 1, 0);
+    for (size_t i = 0; i < ranked.size(); i++) boundBelow[i + 1] = boundBelow[i] + ranked[i].bound;
+
+    // Terms [0, essential) can't lift a review into the top k on their own, so only the
+    // essential terms [essential, n) propose candidates
+    size_t essential = 0;
+    auto updateEssential = [&] {
+        while (top.size() == k && essential < ranked.size() && boundBelow[essential + 1] <= top.front().score) {
+            essential++;
+        }
+    };
+    updateEssential();
+
+    while (essential < ranked.size()) {
+        unsigned int candidate = UINT_MAX;
+        for (size_t i = essential; i < ranked.size(); i++) {
+            if (ranked[i].live) candidate = min(candidate, ranked[i].cursor.reviewIndex());
+        }
+        if (candidate == UINT_MAX) break;
+
+        const double lengthNorm = kBM25K1 * (1 - kBM25B + kBM25B * recordLength(candidate) / averageLength);
+        auto termScore = [lengthNorm](RankedTerm& term) {
+            double frequency = term.cursor.occurrences();
+            return term.idf * frequency * (kBM25K1 + 1) / (frequency + lengthNorm);
+        };
+        double score = 0;
+        for (size_t i = essential; i < ranked.size(); i++) {
+            RankedTerm& term = ranked[i];
+            if (!term.live || term.cursor.reviewIndex() != candidate) continue;
+            score += termScore(term);
+            term.live = term.cursor.seekReview(candidate + 1);
+        }
+
+        // Most valuable non-essential terms first, stopping once even all of the rest can't
+        // lift the review past the k-th best (which wins ties, having the lower index)
+        const bool full = top.size() == k;
+        for (size_t i = essential; i-- > 0; ) {
+            if (full && score + boundBelow[i + 1] <= top.front().score) break;
+            RankedTerm& term = ranked[i];
+            if (!term.live) continue;
+            term.live = term.cursor.seekReview(candidate);
+            if (term.live && term.cursor.reviewIndex() == candidate) score += termScore(term);
+        }
+        QUERY_COUNT(candidates, 1);
+        if (full && score <= top.front().score) continue;
+
+        bool isExcluded = false;
+        for (PhraseCursor& exclusion : exclusions) {
+            if (exclusion.seekReview(candidate) && exclusion.reviewIndex() == candidate) {
+                isExcluded = true;
+                break;
+            }
+        }
+        if (isExcluded) continue;
+
+        if (full) {
+            pop_heap(top.begin(), top.end(), rankedBefore);
+            top.pop_back();
+        }
+        top.push_back(RankedReview {base + candidate, score});
+        push_heap(top.begin(), top.end(), rankedBefore);
+        updateEssential();
+    }
+}
+
+bool amazon::searchRanked(const string& query, size_t k, vector<RankedReview>& results) const {
+    QUERY_STATS_SCOPE();
+    results.clear();
+    if (k == 0) return false;
+    BooleanQuery parsed = parseBooleanQuery(query);
+    vector<vector<string>> terms;
+    for (const vector<vector<string>>& clause : parsed.clauses) terms.insert(terms.end(), clause.begin(), clause.end());
+    sort(terms.begin(), terms.end());
+    terms.erase(unique(terms.begin(), terms.end()), terms.end());
+
+    // Statistics are gathered over every segment, so scores are comparable across them
+    shared_ptr<const SegmentSet> set = currentSegments();
+    vector<pair<const amazon *, unsigned int>> parts;
+    if (set == nullptr || set->includesSelf) parts.push_back(make_pair(this, 0));
+    if (set != nullptr) {
+        for (size_t i = 0; i < set->segments.size(); i++) parts.push_back(make_pair(set->segments[i].get(), set->bases[i]));
+    }
+    uint64_t numReviews = 0, recordBytes = 0;
+    for (const auto& part : parts) {
+        numReviews += part.first->localReviews();
+        recordBytes += part.first->localRecordBytes();
+    }
+    if (numReviews == 0 || terms.empty()) return false;
+
+    vector<double> idfs(terms.size());
+    for (size_t i = 0; i < terms.size(); i++) {
+        // A phrase can't occur in more reviews than its rarest word
+        uint64_t frequency = numReviews;
+        for (const string& word : terms[i]) {
+            uint64_t wordFrequency = 0;
+            for (const auto& part : parts) wordFrequency += part.first->documentFrequency(word);
+            frequency = min(frequency, wordFrequency);
+        }
+        idfs[i] = log(1 + (numReviews - frequency + 0.5) / (frequency + 0.5));
+    }
+
+    // A min-heap of the best k so far, whose worst score is the bar every candidate must clear
+    vector<RankedReview> top;
+    const double averageLength = (double) recordBytes / numReviews;
+    for (const auto& part : parts) {
+        part.first->rankLocal(terms, idfs, parsed.excluded, averageLength, part.second, k, top);
+    }
+    sort_heap(top.begin(), top.end(), rankedBefore);
+    results.swap(top);
+    QUERY_COUNT(matches, results.size());
+    return results.size() > 0;
+}
@@ -1,72 +1,21 @@
 #include <iostream>
 #include <iostream>
 #include <iomanip> // for setw formatter
+#include <fstream>
+#include <algorithm>
+#include <chrono>
 #include <map>
 #include <set>
 #include <string>
 #include "amazon.h"
+#include "thread_pool.h"
+#include "search_options.h"
 using namespace std;
 
 const string kAmazonDataDirectory("/usr/class/archive/cs/cs110/cs110.1204/samples/assign1");
 const string kFilesPrefix("amazon_reviews_us_Electronics_v1_00");
 static const int kDatabaseNotFound = 2;
-
-enum {DATE, BODY_SIZE, STARS, TITLE_SIZE};
-
-bool genericReviewCompare(const Review &lhs, const Review &rhs, int primaryKey, bool reversed=false) {
-    size_t lhs_body_size = lhs.review_body.size();
-    size_t rhs_body_size = rhs.review_body.size();
-    
-    size_t lhs_headline_size = lhs.review_headline.size();
-    size_t rhs_headline_size = rhs.review_headline.size();
-   
-    size_t lhs_title_size = lhs.product_title.size();
-    size_t rhs_title_size = rhs.product_title.size();
-
-    if (primaryKey == DATE) {
-        auto tLhs = tie(lhs.review_year, lhs.review_month, lhs.review_day, lhs_body_size, 
-                    lhs_headline_size, lhs.star_rating, lhs_title_size);
-        auto tRhs = tie(rhs.review_year, rhs.review_month, rhs.review_day, rhs_body_size, 
-                    rhs_headline_size, rhs.star_rating, rhs_title_size);
-        if (reversed) {
-            return tRhs < tLhs;
-        } else {
-            return tLhs < tRhs;
-        }
-    } else if (primaryKey == BODY_SIZE) {
-        auto tLhs = tie(lhs_body_size, lhs.review_year, lhs.review_month, lhs.review_day,
-                    lhs_headline_size, lhs.star_rating, lhs_title_size);
-        auto tRhs = tie(rhs_body_size, rhs.review_year, rhs.review_month, rhs.review_day,  
-                    rhs_headline_size, rhs.star_rating, rhs_title_size);
-        if (reversed) {
-            return tRhs < tLhs;
-        } else {
-            return tLhs < tRhs;
-        }
-    } else if (primaryKey == STARS) {
-        auto tLhs = tie(lhs.star_rating, lhs.product_title, lhs.review_year, lhs.review_month, lhs.review_day, lhs_body_size, 
-                    lhs_headline_size);
-        auto tRhs = tie(rhs.star_rating, rhs.product_title, rhs.review_year, rhs.review_month, rhs.review_day, rhs_body_size, 
-                    rhs_headline_size);
-        if (reversed) {
-            return tRhs < tLhs;
-        } else {
-            return tLhs < tRhs;
-        }
-    } else if (primaryKey == TITLE_SIZE) {
-        auto tLhs = tie(lhs_title_size, lhs.review_year, lhs.review_month, lhs.review_day, lhs_body_size, 
-                    lhs_headline_size, lhs.star_rating);
-        auto tRhs = tie(rhs_title_size, rhs.review_year, rhs.review_month, rhs.review_day, rhs_body_size, 
-                    rhs_headline_size, rhs.star_rating);
-        if (reversed) {
-            return tRhs < tLhs;
-        } else {
-            return tLhs < tRhs;
-        }
-    } else {
-        return false;
-    }
-}
+static const int kQueryFileNotFound = 3;
 
 static void showUsage(string name)
 {
@@ -75,13 +24,27 @@ static void showUsage(string name)
         << "\t-h,--help\t\tShow this help message" << endl
         << "\t-k,--primary-key\tPrimary key, one of: date, stars, bodysize, titlesize (default is date)" << endl
         << "\t-r,--reversed\tReverse ordering for primary key, making it descending instead of ascending" << endl
-        << "\t-n,--number-of-reviews\tNumber of reviews to show (default is to show all reviews)" << endl
+        << "\t-n,--number-of-reviews\tNumber of reviews to show (default is to show all reviews, or 10 ranked ones)" << endl
+        << "\t-q,--query-mode MODE\tHow to read queries: and (every term required, the default), boolean (with OR," << endl
+        << "\t\t\tNOT and -term), or ranked (the best matches for any of the terms, by BM25)" << endl
+        << "\t-b,--batch QUERY_FILE\tRun every query in QUERY_FILE (one per line) as a single batch" << endl
+        << "\t-j,--threads N\tUse N threads: with --batch, serve the queries concurrently and report latency percentiles;" << endl
+        << "\t\t\totherwise let each query split its work across N threads (default is 1).  A plain batch run" << endl
+        << "\t\t\twith one thread and no cache shares work between its queries, so only its total time is reported" << endl
+        << "\t-c,--cache-size MB\tCache query results, and the reviews matching each term, in up to MB megabytes each" << endl
+        << "\t-m,--residency MODE[,MODE...]\tHow eagerly to load the database files: any of populate, lock, random," << endl
+        << "\t\t\thugepages, warm (default is to fault pages in on demand)" << endl
+        << "\t-p,--page-faults\tReport the page faults taken by each search and by fetching its results" << endl
+        << "\t-t,--trace\tReport where each search spent its time and how much of the index it read" << endl
+        << "\t\t\t(needs a build with QUERY_STATS=1)" << endl
         << "\t-d,--directory DIRECTORY\tSpecify the directory for the database files" << endl
         << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_reviews_us_Electronics_v1_00')" << endl;
 }
 
 static int parseArgs(int argc, char **argv, bool &interactive, string &amazonDataDirectory, 
-        string &filesPrefix, int &primaryKey, bool &reversed, size_t &numReviews, string &searchString) {
+        string &filesPrefix, int &primaryKey, bool &reversed, size_t &numReviews, string &batchFileName,
+        unsigned int &numThreads, size_t &cacheMegabytes, ResidencyPolicy &residency, bool &reportFaults,
+        bool &trace, int &queryMode, string &searchString) {
     for (int i = 1; i < argc; ++i) {
         string arg = argv[i];
         if ((arg == "-h") || (arg == "--help")) {
@@ -113,6 +76,69 @@ static int parseArgs(int argc, char **argv, bool &interactive, string &amazonDat
                 return -1;
             }
 
+        } else if ((arg == "-q") || (arg == "--query-mode")) {
+            string mode = i + 1 < argc ? argv[++i] : "";
+            if (mode == "and") {
+                queryMode = AND_QUERY;
+            } else if (mode == "boolean") {
+                queryMode = BOOLEAN_QUERY;
+            } else if (mode == "ranked") {
+                queryMode = RANKED_QUERY;
+            } else {
+                cout << "--query-mode must be either and, boolean, or ranked" << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-b") || (arg == "--batch")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                batchFileName = argv[++i];
+            } else {
+                cout << "--batch option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-j") || (arg == "--threads")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                int threads = stoi(argv[++i]);
+                if (threads <= 0) {
+                    cout << "--threads must be positive" << endl;
+                    return -1;
+                }
+                numThreads = threads;
+            } else {
+                cout << "--threads option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-c") || (arg == "--cache-size")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                int megabytes = stoi(argv[++i]);
+                if (megabytes <= 0) {
+                    cout << "--cache-size must be positive" << endl;
+                    return -1;
+                }
+                cacheMegabytes = megabytes;
+            } else {
+                cout << "--cache-size option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-m") || (arg == "--residency")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                if (!parseResidency(argv[++i], residency)) {
+                    cout << "--residency modes must be populate, lock, random, hugepages or warm" << endl;
+                    showUsage(argv[0]);
+                    return -1;
+                }
+            } else {
+                cout << "--residency option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-p") || (arg == "--page-faults")) {
+            reportFaults = true;
+        } else if ((arg == "-t") || (arg == "--trace")) {
+            trace = true;
         } else if ((arg == "-r") || (arg == "--reversed")) {
             reversed = true;
         } else if ((arg == "-d") || (arg == "--directory")) {
@@ -135,77 +161,226 @@ static int parseArgs(int argc, char **argv, bool &interactive, string &amazonDat
             searchString = argv[i];
         }
     }
-    if (!interactive && searchString == "") {
+    if (!interactive && searchString == "" && batchFileName == "") {
         cout << "No search string found. Going into interactive mode" << endl;
         interactive = true;
     }
     return 0;
 }
 
+static void showMatches(const amazon& db, const string& searchString, const vector<unsigned int>& reviewIndexes,
+        int primaryKey, bool reversed, size_t numReviews, bool interactive) {
+    if (reviewIndexes.empty()) {
+        cout << "Could not find any matches for query '" << searchString << "'" << endl;
+        return;
+    }
+
+    // Only the reviews that will be shown are ordered and fetched; the rest are just
+    // weighed by their sort keys
+    vector<ReviewView> reviews;
+    db.getTopReviewsFromIndexes(reviewIndexes, numReviews, reviews,
+            [&db, primaryKey, reversed](const ReviewSortKey &lhs, const ReviewSortKey &rhs) {
+            return genericReviewCompare(db, lhs, rhs, primaryKey, reversed);
+            });
+
+    cout << "Found " << reviewIndexes.size() << " matching reviews out of " <<
+        db.totalReviews() << " reviews in the database." << endl;
+    if (interactive) {
+        cout << "Press <enter> to see the first five reviews." << flush;
+        string userInput;
+        getline(cin, userInput);
+    }
+
+    for (size_t i=0; i < reviews.size(); i++) {
+        const ReviewView& review = reviews[i];
+        cout << "**********" << endl;
+        cout << review << endl;
+        cout << "**********" << endl << endl;
+
+        if (interactive) {
+            if ((i + 1) % 5 == 0) {
+                cout << "Press <enter> to see the next five reviews ('q' to quit). " << flush;
+                string userInput;
+                getline(cin, userInput);
+                if (userInput != "" && tolower(userInput[0]) == 'q') break;
+            }
+        }
+    }
+}
+
+static void showRanked(const amazon& db, const string& searchString, const vector<RankedReview>& ranked,
+        bool interactive) {
+    if (ranked.empty()) {
+        cout << "Could not find any matches for query '" << searchString << "'" << endl;
+        return;
+    }
+
+    cout << "Ranked the best " << ranked.size() << " matching reviews out of " <<
+        db.totalReviews() << " reviews in the database." << endl;
+    for (size_t i = 0; i < ranked.size(); i++) {
+        ReviewView review;
+        db.getReview(ranked[i].index, review);
+        cout << "**********" << endl;
+        cout << "Score: " << fixed << setprecision(4) << ranked[i].score << defaultfloat << endl;
+        cout << review << endl;
+        cout << "**********" << endl << endl;
+
+        if (interactive && (i + 1) % 5 == 0 && i + 1 < ranked.size()) {
+            cout << "Press <enter> to see the next five reviews ('q' to quit). " << flush;
+            string userInput;
+            getline(cin, userInput);
+            if (userInput != "" && tolower(userInput[0]) == 'q') break;
+        }
+    }
+}
+
+// Runs one query the way queryMode says to, filling reviewIndexes, or ranked for ranked queries
+static void runQuery(const amazon& db, const string& query, int queryMode, size_t numReviews, unsigned int numThreads,
+        vector<unsigned int>& reviewIndexes, vector<RankedReview>& ranked) {
+    if (queryMode == RANKED_QUERY) {
+        db.searchRanked(query, numReviews == (size_t) -1 ? kDefaultRankedReviews : numReviews, ranked);
+    } else if (queryMode == BOOLEAN_QUERY) {
+        db.searchBoolean(query, reviewIndexes);
+    } else {
+        db.searchKeywordIndex(query, reviewIndexes, numThreads);
+    }
+}
+
+static void reportLatencies(vector<double> latencies) {
+    if (latencies.empty()) return;
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        size_t rank = (size_t) (p / 100.0 * (latencies.size() - 1) + 0.5);
+        return latencies[rank];
+    };
+    cout << fixed << setprecision(1) << "Latency over " << latencies.size() << " queries (us): "
+        << "p50 " << percentile(50) << ", p90 " << percentile(90) << ", p99 " << percentile(99)
+        << ", max " << latencies.back() << endl;
+}
+
+static void reportCacheStats(const string& name, const ResultCacheStats& stats) {
+    cout << name << " cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions
+        << " evictions, " << stats.entries << " entries in " << stats.bytes << " bytes" << endl;
+}
+
+static int runBatch(const amazon& db, const string& batchFileName, int primaryKey, bool reversed, size_t numReviews,
+        unsigned int numThreads, bool cached, int queryMode, bool trace) {
+    ifstream batchFile(batchFileName);
+    if (!batchFile) {
+        cerr << "Could not open query file '" << batchFileName << "'" << endl;
+        return kQueryFileNotFound;
+    }
+    vector<string> queries;
+    string query;
+    while (getline(batchFile, query)) {
+        if (query != "") queries.push_back(query);
+    }
+
+    vector<vector<unsigned int>> results;
+    vector<vector<RankedReview>> ranked(queries.size());
+    vector<double> latencies;
+    vector<QueryStats> stats;
+    // searchBatch shares work between the queries of one plain batch but bypasses the
+    // result cache, so with a cache every query goes through searchKeywordIndex instead
+    double batchMicros = -1;
+    if (numThreads == 1 && !cached && queryMode == AND_QUERY) {
+        // The queries share their term lookups, so there is no per-query latency to report
+        auto start = chrono::steady_clock::now();
+        results = db.searchBatch(queries);
+        batchMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        stats.push_back(amazon::lastQueryStats());
+    } else {
+        // One shared, read-only database; every worker writes only its own query's slots
+        results.resize(queries.size());
+        latencies.resize(queries.size());
+        stats.resize(queries.size());
+        ThreadPool pool(numThreads);
+        for (size_t i = 0; i < queries.size(); i++) {
+            pool.schedule([&db, &queries, &results, &ranked, &latencies, &stats, queryMode, numReviews, i] {
+                auto start = chrono::steady_clock::now();
+                runQuery(db, queries[i], queryMode, numReviews, 1, results[i], ranked[i]);
+                latencies[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+                stats[i] = amazon::lastQueryStats();
+            });
+        }
+        pool.wait();
+    }
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        cout << "Query '" << queries[i] << "'" << endl;
+        if (queryMode == RANKED_QUERY) showRanked(db, queries[i], ranked[i], false);
+        else showMatches(db, queries[i], results[i], primaryKey, reversed, numReviews, false);
+        // Queries run on pool threads are traced without the fetching of their results
+        if (trace && stats.size() == queries.size()) printQueryStats(cout, stats[i]);
+    }
+    // A shared batch is traced as a whole
+    if (trace && stats.size() == 1 && queries.size() != 1) printQueryStats(cout, stats[0]);
+    if (batchMicros >= 0) {
+        cout << fixed << setprecision(1) << "Shared batch of " << queries.size() << " queries (us): total "
+            << batchMicros << ", mean " << batchMicros / max<size_t>(queries.size(), 1) << endl;
+    }
+    reportLatencies(latencies);
+    if (cached) {
+        reportCacheStats("Query", db.queryCacheStats());
+        reportCacheStats("Term", db.termCacheStats());
+    }
+    return 0;
+}
+
 int main(int argc, char **argv) {
     bool interactive = false;
     string amazonDataDirectory = kAmazonDataDirectory;
     string filesPrefix = kFilesPrefix;
     int primaryKey = DATE;
     bool reversed = false;
+    string batchFileName;
+    unsigned int numThreads = 1;
+    size_t cacheMegabytes = 0;
+    ResidencyPolicy residency;
+    bool reportFaults = false;
+    bool trace = false;
+    int queryMode = AND_QUERY;
     string searchString;
     size_t origNumReviews = (size_t)-1;
 
     if (parseArgs(argc, argv, interactive, amazonDataDirectory, filesPrefix, primaryKey, 
-                reversed, origNumReviews, searchString) == -1) return -1;
+                reversed, origNumReviews, batchFileName, numThreads, cacheMegabytes, residency, reportFaults, trace, queryMode, searchString) == -1) return -1;
 
-    amazon db(amazonDataDirectory, filesPrefix);
+    amazon db(amazonDataDirectory, filesPrefix, residency);
     if (!db.good()) {
         cerr << "Problem reading data files...aborting!" << endl; 
         return kDatabaseNotFound;
     }
 
     cout << "Total number of keywords: " << db.totalKeywords() << endl;
+    if (cacheMegabytes > 0) db.enableResultCache(cacheMegabytes << 20, cacheMegabytes << 20);
+
+    if (batchFileName != "") return runBatch(db, batchFileName, primaryKey, reversed, origNumReviews, numThreads,
+            cacheMegabytes > 0, queryMode, trace);
 
     while (true) {
-        size_t numReviews = origNumReviews;
         if (interactive) {
             cout << "Please enter a search query (<enter> to end): " << flush;
             getline(cin, searchString);
             if (searchString == "") break;
+            // Pick up any segments appended since the last query
+            db.refreshSegments();
         }
         vector<unsigned int> reviewIndexes;
-        if (!db.searchKeywordIndex(searchString, reviewIndexes)) {
-            cout << "Could not find any matches for query '" << searchString << "'" << endl;
-        } else {
-            vector<Review> reviews;
-            db.getSortedReviewsFromIndexes(reviewIndexes, reviews, [primaryKey, reversed](const Review &lhs, const Review &rhs) {
-                    return genericReviewCompare(lhs, rhs, primaryKey, reversed);
-                    });
-
-            cout << "Found " << reviewIndexes.size() << " matching reviews out of " <<
-                db.totalReviews() << " reviews in the database." << endl;
-            if (interactive) {
-                cout << "Press <enter> to see the first five reviews." << flush;
-                string userInput;
-                getline(cin, userInput);
-            }
-
-            if (numReviews == (size_t)-1 || numReviews > reviews.size()) {
-                numReviews = reviews.size();
-            }
-
-            for (size_t i=0; i < numReviews; i++) {
-                Review review = reviews[i];
-                cout << "**********" << endl;
-                cout << review << endl;
-                cout << "**********" << endl << endl;
-
-                if (interactive) {
-                    if ((i + 1) % 5 == 0) {
-                        cout << "Press <enter> to see the next five reviews ('q' to quit). " << flush;
-                        string userInput;
-                        getline(cin, userInput);
-                        if (userInput != "" && tolower(userInput[0]) == 'q') break;
-                    }
-                }
-            }
+        vector<RankedReview> ranked;
+        PageFaultCounts beforeSearch = amazon::threadPageFaults();
+        runQuery(db, searchString, queryMode, origNumReviews, numThreads, reviewIndexes, ranked);
+        PageFaultCounts beforeFetch = amazon::threadPageFaults();
+        if (queryMode == RANKED_QUERY) showRanked(db, searchString, ranked, interactive);
+        else showMatches(db, searchString, reviewIndexes, primaryKey, reversed, origNumReviews, interactive);
+        if (reportFaults) {
+            PageFaultCounts afterFetch = amazon::threadPageFaults();
+            cout << "Page faults: search " << beforeFetch.minor - beforeSearch.minor << " minor, "
+                << beforeFetch.major - beforeSearch.major << " major; "
+                << "results " << afterFetch.minor - beforeFetch.minor << " minor, "
+                << afterFetch.major - beforeFetch.major << " major" << endl;
         }
+        if (trace) printQueryStats(cout, amazon::lastQueryStats());
         if (!interactive) break;
     }
     return 0;
@@ -0,0 +1,315 @@
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include "amazon.h"
+#include "amazon_writer.h"
+
+using namespace std;
+
+// Defined in amazon.cc
+const char * getElementStartPtr(const void * const file, const unsigned int index);
+
+// The manifest <filesPrefix>_segments.txt is a line "next <n>", holding the number the next
+// new segment will be given, followed by one segment prefix per line, base segment first.
+// It's only ever replaced whole (written to a temporary file and renamed into place), and
+// only while holding an exclusive flock on <filesPrefix>_segments.lock.
+static string manifestFileName(const string& directory, const string& filesPrefix) {
+    return directory + "/" + filesPrefix + "_segments.txt";
+}
+
+static bool readManifest(const string& directory, const string& filesPrefix, vector<string>& names,
+        unsigned long& nextSegment) {
+    names.clear();
+    nextSegment = 1;
+    ifstream in(manifestFileName(directory, filesPrefix));
+    string label;
+    if (!in || !(in >> label >> nextSegment) || label != "next") {
+        // Without a manifest the database is just its base files
+        names.push_back(filesPrefix);
+        return false;
+    }
+    string name;
+    while (in >> name) names.push_back(name);
+    if (names.empty()) names.push_back(filesPrefix);
+    return true;
+}
+
+static bool writeManifest(const string& directory, const string& filesPrefix, const vector<string>& names,
+        unsigned long nextSegment) {
+    const string manifest = manifestFileName(directory, filesPrefix);
+    const string tempFileName = manifest + ".tmp";
+    ofstream out(tempFileName, ios::trunc);
+    out << "next " << nextSegment << endl;
+    for (const string& name : names) out << name << endl;
+    out.close();
+    if (!out) {
+        unlink(tempFileName.c_str());
+        return false;
+    }
+    return rename(tempFileName.c_str(), manifest.c_str()) == 0;
+}
+
+/**
+ * Class: ManifestLock
+ * -------------------
+ * Holds an exclusive lock on a database's manifest for as long as it's in scope, so
+ * processes appending and compacting at the same time take turns updating it.
+ */
+class ManifestLock {
+    public:
+        ManifestLock(const string& directory, const string& filesPrefix) {
+            fd = open((directory + "/" + filesPrefix + "_segments.lock").c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd != -1 && flock(fd, LOCK_EX) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        bool held() const { return fd != -1; }
+
+        ~ManifestLock() {
+            if (fd == -1) return;
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+
+    private:
+        int fd;
+};
+
+static void removeSegmentFiles(const string& directory, const string& segment) {
+    for (const char *suffix : {".bin", "_keyword_index.bin", "_keyword_index_compressed.bin",
+            "_keyword_skips.bin", "_sort_keys.bin"}) {
+        unlink((directory + "/" + segment + suffix).c_str());
+    }
+}
+
+bool amazon::appendSegment(const string& directory, const string& filesPrefix, const vector<Review>& reviews) {
+    if (reviews.empty()) return true;
+    ManifestLock lock(directory, filesPrefix);
+    if (!lock.held()) return false;
+
+    vector<string> names;
+    unsigned long nextSegment;
+    readManifest(directory, filesPrefix, names, nextSegment);
+    const string segment = filesPrefix + "_delta_" + to_string(nextSegment++);
+    AmazonWriter writer(directory, segment);
+    for (const Review& review : reviews) writer.addReview(review);
+    if (!writer.finish()) {
+        removeSegmentFiles(directory, segment);
+        return false;
+    }
+
+    names.push_back(segment);
+    if (!writeManifest(directory, filesPrefix, names, nextSegment)) {
+        removeSegmentFiles(directory, segment);
+        return false;
+    }
+    return true;
+}
+
+bool amazon::replaceBaseSegment(const string& directory, const string& filesPrefix, const function<bool()>& writeBase) {
+    // A database that was never segmented needs no manifest, or lock file, to go with it
+    if (access(manifestFileName(directory, filesPrefix).c_str(), F_OK) != 0) return writeBase();
+    ManifestLock lock(directory, filesPrefix);
+    if (!lock.held()) return false;
+
+    vector<string> names;
+    unsigned long nextSegment;
+    const bool segmented = readManifest(directory, filesPrefix, names, nextSegment);
+    if (!writeBase()) return false;
+    if (!segmented) return true;
+    // Segment numbers keep counting up, so no instance mistakes a new segment for an old one
+    if (!writeManifest(directory, filesPrefix, vector<string>(1, filesPrefix), nextSegment)) return false;
+    for (const string& name : names) {
+        if (name != filesPrefix) removeSegmentFiles(directory, name);
+    }
+    return true;
+}
+
+bool amazon::mergeSegments(const vector<const amazon *>& sources, const string& directory, const string& filesPrefix) {
+    // Review records are copied verbatim, one segment after another
+    vector<unsigned int> bases;
+    OffsetTableWriter database(directory + "/" + filesPrefix + ".bin", databaseSidecars(directory, filesPrefix));
+    for (const amazon *source : sources) {
+        bases.push_back(database.size());
+        const char *end = (const char *) source->databaseFile + source->databaseInfo.fileSize;
+        for (unsigned int index = 0; index < source->localReviews(); index++) {
+            const char *record = getElementStartPtr(source->databaseFile, index);
+            const char *next = index + 1 < source->localReviews() ? getElementStartPtr(source->databaseFile, index + 1) : end;
+            database.add(string(record, next - record));
+        }
+    }
+
+    // Each segment's keywords are sorted, so the merged index comes from a k-way merge that
+    // holds only one keyword's postings at a time.  Segments hold increasing review indexes,
+    // so concatenating a keyword's rebased postings segment by segment keeps them sorted.
+    OffsetTableWriter keywordIndex(directory + "/" + filesPrefix + "_keyword_index.bin",
+        keywordIndexSidecars(directory, filesPrefix));
+    vector<unsigned int> next(sources.size(), 0);
+    vector<uint64_t> postings;
+    string entry;
+    while (true) {
+        const char *smallest = nullptr;
+        for (size_t s = 0; s < sources.size(); s++) {
+            if (next[s] == sources[s]->localKeywords()) continue;
+            const char *keyword = getElementStartPtr(sources[s]->keywordIndexFile, next[s]);
+            if (smallest == nullptr || strcmp(keyword, smallest) < 0) smallest = keyword;
+        }
+        if (smallest == nullptr) break;
+
+        const string keyword = smallest;
+        postings.clear();
+        for (size_t s = 0; s < sources.size(); s++) {
+            if (next[s] == sources[s]->localKeywords() ||
+                keyword != getElementStartPtr(sources[s]->keywordIndexFile, next[s])) continue;
+            for (PostingCursor cursor = sources[s]->keywordCursor(next[s]); !cursor.done(); cursor.next()) {
+                postings.push_back(cursor.key() + ((uint64_t) bases[s] << 32));
+            }
+            next[s]++;
+        }
+        entry.clear();
+        encodeKeywordEntry(keyword, postings, entry);
+        keywordIndex.add(entry);
+    }
+
+    bool indexWritten = keywordIndex.finish();
+    return database.finish() && indexWritten;
+}
+
+bool amazon::compactSegments(const string& directory, const string& filesPrefix) {
+    // Pick the segments to merge, and reserve a name for the result
+    vector<string> names;
+    unsigned long nextSegment;
+    string merged;
+    {
+        ManifestLock lock(directory, filesPrefix);
+        if (!lock.held()) return false;
+        readManifest(directory, filesPrefix, names, nextSegment);
+        if (names.size() < 2) return true;
+        merged = filesPrefix + "_base_" + to_string(nextSegment++);
+        if (!writeManifest(directory, filesPrefix, names, nextSegment)) return false;
+    }
+
+    // The slow part runs unlocked, so appends carry on in the meantime
+    vector<unique_ptr<amazon>> opened;
+    vector<const amazon *> sources;
+    unsigned int skipBlockSize = 0;
+    bool compressed = false, sortKeys = false;
+    for (const string& name : names) {
+        opened.emplace_back(new amazon(directory, name, ResidencyPolicy(), false));
+        if (!opened.back()->good()) return false;
+        sources.push_back(opened.back().get());
+        if (opened.back()->skipIndexFile != nullptr) skipBlockSize = ((const unsigned int *) opened.back()->skipIndexFile)[1];
+        compressed = compressed || opened.back()->compressedPostings;
+        sortKeys = sortKeys || opened.back()->sortKeyFile != nullptr;
+    }
+    if (!mergeSegments(sources, directory, merged)) {
+        removeSegmentFiles(directory, merged);
+        return false;
+    }
+    opened.clear();
+
+    // The merged segment gets whichever sidecars its sources had, before anyone can open it
+    if ((skipBlockSize > 0 && !writeSkipIndex(directory, merged, skipBlockSize)) ||
+        (compressed && !writeCompressedIndex(directory, merged)) ||
+        (sortKeys && !writeSortKeyTable(directory, merged))) {
+        removeSegmentFiles(directory, merged);
+        return false;
+    }
+
+    // Swap the merged segment in for the ones it replaces, keeping any appended since
+    {
+        ManifestLock lock(directory, filesPrefix);
+        vector<string> current;
+        if (!lock.held() || !readManifest(directory, filesPrefix, current, nextSegment) ||
+            current.size() < names.size() || !equal(names.begin(), names.end(), current.begin())) {
+            // Another compaction got there first
+            removeSegmentFiles(directory, merged);
+            return false;
+        }
+        vector<string> updated(1, merged);
+        updated.insert(updated.end(), current.begin() + names.size(), current.end());
+        if (!writeManifest(directory, filesPrefix, updated, nextSegment)) {
+            removeSegmentFiles(directory, merged);
+            return false;
+        }
+    }
+
+    // Instances still using the old segments keep them mapped, so they can go right away.
+    // That includes the original base files, which new instances skip once they're replaced.
+    for (const string& name : names) removeSegmentFiles(directory, name);
+    return true;
+}
+
+bool amazon::ownFilesReplaced() const {
+    vector<string> names;
+    unsigned long nextSegment;
+    return readManifest(directory, filesPrefix, names, nextSegment) && names[0] != filesPrefix;
+}
+
+static atomic<unsigned long> segmentGenerations(0);
+
+bool amazon::refreshSegments() {
+    lock_guard<mutex> lg(refreshLock);
+    vector<string> names;
+    unsigned long nextSegment;
+    readManifest(directory, filesPrefix, names, nextSegment);
+    shared_ptr<const SegmentSet> current = currentSegments();
+    if (current && current->names == names) return true;
+    return installSegments(names);
+}
+
+bool amazon::installSegments(const vector<string>& names) {
+    shared_ptr<const SegmentSet> current = currentSegments();
+    shared_ptr<SegmentSet> set = make_shared<SegmentSet>();
+    set->generation = ++segmentGenerations;
+    set->names = names;
+    set->includesSelf = names[0] == filesPrefix;
+    // This instance's own files can't come back once they've been dropped
+    if (set->includesSelf && !ownFiles) return false;
+    if (set->includesSelf) set->selfFiles = ownFiles;
+
+    // Segments never change once written, so any that are still listed are reused as is
+    map<string, shared_ptr<const amazon>> reusable;
+    if (current) {
+        for (size_t i = 0; i < current->segments.size(); i++) {
+            reusable[current->names[i + (current->includesSelf ? 1 : 0)]] = current->segments[i];
+        }
+    }
+
+    unsigned int total = set->includesSelf ? localReviews() : 0;
+    for (size_t i = set->includesSelf ? 1 : 0; i < names.size(); i++) {
+        shared_ptr<const amazon> segment = reusable[names[i]];
+        if (!segment) segment.reset(new amazon(directory, names[i], residency, false));
+        if (!segment->good()) return false;
+        set->segments.push_back(segment);
+        set->bases.push_back(total);
+        total += segment->localReviews();
+    }
+    set->totalReviews = total;
+
+    // The replaced set, and any segments only it used, go away with the last query holding
+    // it; ReviewViews hold on to the files they point into themselves.  Dropped own files
+    // clear this instance's pointers into them as they're unmapped (see MappedFiles).
+    atomic_store(&segments, shared_ptr<const SegmentSet>(set));
+    if (!set->includesSelf) ownFiles.reset();
+    return true;
+}
+
+void amazon::compactInBackground() {
+    waitForCompaction();
+    compactionThread = thread([this] {
+        if (compactSegments(directory, filesPrefix)) refreshSegments();
+    });
+}
+
+void amazon::waitForCompaction() {
+    if (compactionThread.joinable()) compactionThread.join();
+}
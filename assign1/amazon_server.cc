@@ -0,0 +1,364 @@
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include "amazon.h"
+#include "thread_pool.h"
+#include "search_options.h"
+#include "query_protocol.h"
+using namespace std;
+
+const string kAmazonDataDirectory("/usr/class/archive/cs/cs110/cs110.1204/samples/assign1");
+const string kFilesPrefix("amazon_reviews_us_Electronics_v1_00");
+static const int kDatabaseNotFound = 2;
+static const int kSocketNotCreated = 3;
+
+// How often the server looks for segments appended since it last checked
+static const auto kRefreshInterval = chrono::seconds(1);
+
+// How long a worker waits on a client that has stopped sending its request or reading
+// the response before giving up on the connection
+static const int kConnectionTimeoutSeconds = 30;
+
+static volatile sig_atomic_t stopRequested = 0;
+static void requestStop(int) { stopRequested = 1; }
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)>" << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-s,--socket PATH\tListen on the Unix-domain socket PATH (default is '" << kDefaultSocketPath << "')" << endl
+        << "\t-j,--threads N\tAnswer up to N queries at once (default is one per core)" << endl
+        << "\t-c,--cache-size MB\tCache query results, and the reviews matching each term, in up to MB megabytes each" << endl
+        << "\t-m,--residency MODE[,MODE...]\tHow eagerly to load the database files: any of populate, lock, random," << endl
+        << "\t\t\thugepages, warm (default is to fault pages in on demand)" << endl
+        << "\t-d,--directory DIRECTORY\tSpecify the directory for the database files" << endl
+        << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_reviews_us_Electronics_v1_00')" << endl;
+}
+
+static int parseArgs(int argc, char **argv, string &amazonDataDirectory, string &filesPrefix, string &socketPath,
+        unsigned int &numThreads, size_t &cacheMegabytes, ResidencyPolicy &residency) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-s") || (arg == "--socket")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                socketPath = argv[++i];
+            } else {
+                cout << "--socket option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-j") || (arg == "--threads")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                int threads = stoi(argv[++i]);
+                if (threads <= 0) {
+                    cout << "--threads must be positive" << endl;
+                    return -1;
+                }
+                numThreads = threads;
+            } else {
+                cout << "--threads option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-c") || (arg == "--cache-size")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                int megabytes = stoi(argv[++i]);
+                if (megabytes <= 0) {
+                    cout << "--cache-size must be positive" << endl;
+                    return -1;
+                }
+                cacheMegabytes = megabytes;
+            } else {
+                cout << "--cache-size option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-m") || (arg == "--residency")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                if (!parseResidency(argv[++i], residency)) {
+                    cout << "--residency modes must be populate, lock, random, hugepages or warm" << endl;
+                    showUsage(argv[0]);
+                    return -1;
+                }
+            } else {
+                cout << "--residency option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-d") || (arg == "--directory")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                amazonDataDirectory = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--directory option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-f") || (arg == "--files-prefix")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                filesPrefix = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--files-prefix option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else {
+            cout << "Unrecognized argument '" << arg << "'" << endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Class: ResponseStream
+ * ---------------------
+ * Sends one response's reviews as they're added, in frames of about kResponseFrameBytes
+ * (see query_protocol.h), so the server never holds more than one frame of a response.
+ */
+namespace {
+class ResponseStream {
+    public:
+        ResponseStream(int connection, const QueryResponseHeader& header) :
+            header(header), connection(connection), sent(true) {
+            beginQueryResponse(frame);
+        }
+
+        QueryResponseHeader header;
+
+        void add(const ReviewView& review, double score) {
+            if (!sent || header.status != RESPONSE_OK) return;
+            appendResponseReview(review, score, frame);
+            header.count++;
+            if (frame.size() > kMaxFrameBytes) {
+                // A single review too long for any frame: report it in place of the results
+                header.status = RESPONSE_TOO_LARGE;
+                header.count = 0;
+                beginQueryResponse(frame);
+            } else if (frame.size() >= kResponseFrameBytes) {
+                send(true);
+            }
+        }
+
+        /** Sends the last frame.  Returns false if the client went away at any point. */
+        bool finish() {
+            if (sent) send(false);
+            return sent;
+        }
+
+    private:
+        int connection;
+        string frame;
+        bool sent;
+
+        void send(bool more) {
+            header.more = more;
+            finishQueryResponse(header, frame);
+            sent = writeFrame(connection, frame);
+            header.count = 0;
+            beginQueryResponse(frame);
+        }
+};
+}
+
+/**
+ * Function: answerQuery
+ * ---------------------
+ * Evaluates request against db and streams the response to the connection, exactly the
+ * reviews amazon_search would show for the same query and options.  Returns false if
+ * the client went away.
+ */
+static bool answerQuery(const amazon& db, const QueryRequest& request, int connection) {
+    auto start = chrono::steady_clock::now();
+    ResponseStream response(connection, QueryResponseHeader {RESPONSE_OK, 0, db.totalReviews(), 0, 0, false});
+    QueryResponseHeader& header = response.header;
+    if (request.mode == RANKED_QUERY) {
+        vector<RankedReview> ranked;
+        db.searchRanked(request.query, request.maxReviews, ranked);
+        header.totalMatches = ranked.size();
+        for (const RankedReview& result : ranked) {
+            ReviewView review;
+            if (!db.getReview(result.index, review)) continue;
+            response.add(review, result.score);
+        }
+    } else {
+        vector<unsigned int> reviewIndexes;
+        if (request.mode == BOOLEAN_QUERY) db.searchBoolean(request.query, reviewIndexes);
+        else db.searchKeywordIndex(request.query, reviewIndexes);
+        header.totalMatches = reviewIndexes.size();
+        vector<ReviewView> reviews;
+        const int primaryKey = request.primaryKey;
+        const bool reversed = request.reversed;
+        db.getTopReviewsFromIndexes(reviewIndexes, request.maxReviews, reviews,
+                [&db, primaryKey, reversed](const ReviewSortKey &lhs, const ReviewSortKey &rhs) {
+                return genericReviewCompare(db, lhs, rhs, primaryKey, reversed);
+                });
+        for (const ReviewView& review : reviews) response.add(review, 0);
+    }
+    header.serverMicros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    return response.finish();
+}
+
+/**
+ * Function: serveRequest
+ * ----------------------
+ * Reads one request from the connection and writes its response.  Returns false once
+ * the client has hung up (or broken the protocol), when the connection should be closed.
+ */
+static bool serveRequest(const amazon& db, int connection) {
+    string payload;
+    if (!readFrame(connection, payload)) return false;
+    QueryRequest request;
+    if (!decodeQueryRequest(payload, request) || request.mode > RANKED_QUERY || request.primaryKey > TITLE_SIZE) {
+        string frame;
+        beginQueryResponse(frame);
+        finishQueryResponse(QueryResponseHeader {RESPONSE_BAD_REQUEST, 0, db.totalReviews(), 0, 0, false}, frame);
+        return writeFrame(connection, frame);
+    }
+    return answerQuery(db, request, connection);
+}
+
+// Bounds how long a blocking read or write on the connection can stall its worker
+static void setConnectionTimeouts(int connection) {
+    struct timeval timeout = {kConnectionTimeoutSeconds, 0};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/**
+ * Connections wait in the main thread's poll set while idle.  Once a request arrives, the
+ * connection leaves the set and is handed to a worker, which serves that one request and
+ * then returns it through returned, waking poll with a byte on the wake pipe.  So a few
+ * workers can serve any number of mostly idle clients, and no connection is ever being
+ * read by two threads.
+ */
+namespace {
+struct IdleConnections {
+    mutex lock;
+    vector<int> returned;
+    int wakePipe[2];
+
+    void giveBack(int connection) {
+        {
+            lock_guard<mutex> lg(lock);
+            returned.push_back(connection);
+        }
+        char wake = 0;
+        if (write(wakePipe[1], &wake, 1) < 0) {} // a full pipe already guarantees a wakeup
+    }
+};
+}
+
+static void serve(amazon& db, int listener, unsigned int numThreads) {
+    IdleConnections connections;
+    if (pipe2(connections.wakePipe, O_CLOEXEC | O_NONBLOCK) != 0) return;
+    vector<int> idle;
+    auto lastRefresh = chrono::steady_clock::now();
+    {
+        ThreadPool pool(numThreads);
+        while (!stopRequested) {
+            vector<struct pollfd> fds;
+            fds.push_back(pollfd {listener, POLLIN, 0});
+            fds.push_back(pollfd {connections.wakePipe[0], POLLIN, 0});
+            for (int connection : idle) fds.push_back(pollfd {connection, POLLIN, 0});
+            int timeout = chrono::duration_cast<chrono::milliseconds>(kRefreshInterval).count();
+            if (poll(fds.data(), fds.size(), timeout) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+
+            if (chrono::steady_clock::now() - lastRefresh >= kRefreshInterval) {
+                // Pick up any segments appended since the last check
+                db.refreshSegments();
+                lastRefresh = chrono::steady_clock::now();
+            }
+
+            idle.clear();
+            for (size_t i = 2; i < fds.size(); i++) {
+                int connection = fds[i].fd;
+                if (fds[i].revents == 0) {
+                    idle.push_back(connection);
+                    continue;
+                }
+                const amazon& reader = db;
+                pool.schedule([&reader, &connections, connection] {
+                    if (serveRequest(reader, connection)) connections.giveBack(connection);
+                    else close(connection);
+                });
+            }
+            if (fds[1].revents != 0) {
+                char drained[64];
+                while (read(connections.wakePipe[0], drained, sizeof(drained)) > 0) {}
+                lock_guard<mutex> lg(connections.lock);
+                idle.insert(idle.end(), connections.returned.begin(), connections.returned.end());
+                connections.returned.clear();
+            }
+            if (fds[0].revents & POLLIN) {
+                int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+                if (connection >= 0) {
+                    setConnectionTimeouts(connection);
+                    idle.push_back(connection);
+                }
+            }
+        }
+    } // the pool finishes any requests in flight before it's destroyed
+
+    for (int connection : idle) close(connection);
+    for (int connection : connections.returned) close(connection);
+    close(connections.wakePipe[0]);
+    close(connections.wakePipe[1]);
+}
+
+int main(int argc, char **argv) {
+    string amazonDataDirectory = kAmazonDataDirectory;
+    string filesPrefix = kFilesPrefix;
+    string socketPath = kDefaultSocketPath;
+    unsigned int numThreads = max(thread::hardware_concurrency(), 1U);
+    size_t cacheMegabytes = 0;
+    ResidencyPolicy residency;
+
+    if (parseArgs(argc, argv, amazonDataDirectory, filesPrefix, socketPath, numThreads, cacheMegabytes,
+                residency) == -1) return -1;
+
+    amazon db(amazonDataDirectory, filesPrefix, residency);
+    if (!db.good()) {
+        cerr << "Problem reading data files...aborting!" << endl;
+        return kDatabaseNotFound;
+    }
+    if (cacheMegabytes > 0) db.enableResultCache(cacheMegabytes << 20, cacheMegabytes << 20);
+
+    int listener = createServerSocket(socketPath);
+    if (listener == kSocketError) {
+        cerr << "Could not listen on '" << socketPath << "' (is another server running?)...aborting!" << endl;
+        return kSocketNotCreated;
+    }
+
+    // No SA_RESTART, so a signal interrupts poll and the loop notices the request to stop
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    cout << "Serving " << db.totalReviews() << " reviews on " << socketPath << " with " << numThreads
+        << " threads" << endl;
+    serve(db, listener, numThreads);
+    close(listener);
+    unlink(socketPath.c_str());
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "amazon_writer.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <climits>
+
+using namespace std;
+
+void encodeReviewRecord(const Review& review, string& record) {
+    const size_t start = record.size();
+    record += review.product_title;
+    record += '\0';
+    record += review.product_category;
+    record += '\0';
+    record += (char) review.star_rating;
+    record += review.review_headline;
+    record += '\0';
+    record += review.review_body;
+    record += '\0';
+    // The date is aligned to an even offset within the record
+    if ((record.size() - start) % 2 == 1) record += '\0';
+    short year = review.review_year;
+    record.append((const char *) &year, sizeof(year));
+    record += (char) review.review_month;
+    record += (char) review.review_day;
+}
+
+bool parseReviewLine(const string& line, Review& review) {
+    static const size_t kNumColumns = 15;
+    vector<string> columns;
+    size_t start = 0;
+    while (columns.size() < kNumColumns) {
+        size_t end = line.find('\t', start);
+        if (end == string::npos) end = line.size();
+        columns.push_back(line.substr(start, end - start));
+        if (end == line.size()) break;
+        start = end + 1;
+    }
+    if (columns.size() != kNumColumns) return false;
+
+    int year, month, day;
+    char trailing;
+    if (sscanf(columns[14].c_str(), "%d-%d-%d%c", &year, &month, &day, &trailing) != 3) return false;
+    if (columns[7].size() != 1 || !isdigit((unsigned char) columns[7][0])) return false;
+    review.product_title = columns[5];
+    review.product_category = columns[6];
+    review.star_rating = columns[7][0] - '0';
+    review.review_headline = columns[12];
+    review.review_body = columns[13];
+    review.review_year = year;
+    review.review_month = month;
+    review.review_day = day;
+    return true;
+}
+
+static void forEachWord(const string& text, unsigned int portion,
+    const function<void(const string&, unsigned int, unsigned int)>& visit) {
+    unsigned int offset = 0;
+    string word;
+    for (size_t i = 0; i <= text.size(); i++) {
+        unsigned char c = i < text.size() ? text[i] : ' ';
+        if (isalnum(c)) {
+            word += tolower(c);
+        } else if (isspace(c) || c == '-') {
+            if (!word.empty()) visit(word, portion, offset++);
+            word.clear();
+        }
+    }
+}
+
+void forEachReviewWord(const Review& review,
+    const function<void(const string& word, unsigned int portion, unsigned int offset)>& visit) {
+    forEachWord(review.product_title, kTitlePortion, visit);
+    forEachWord(review.review_headline, kHeadlinePortion, visit);
+    forEachWord(review.review_body, kBodyPortion, visit);
+}
+
+void encodeKeywordEntry(const string& keyword, const vector<uint64_t>& postings, string& entry) {
+    entry += keyword;
+    entry += '\0';
+    // The posting count is aligned to an even offset within the entry
+    if ((keyword.size() + 1) % 2 == 1) entry += '\0';
+    unsigned int numEntries = postings.size();
+    entry.append((const char *) &numEntries, sizeof(numEntries));
+    for (uint64_t key : postings) {
+        unsigned int pair[2] = {postingKeyReviewIndex(key), (unsigned int) key};
+        entry.append((const char *) pair, sizeof(pair));
+    }
+}
+
+vector<string> keywordIndexSidecars(const string& directory, const string& filesPrefix) {
+    return {directory + "/" + filesPrefix + "_keyword_skips.bin",
+        directory + "/" + filesPrefix + "_keyword_index_compressed.bin"};
+}
+
+vector<string> databaseSidecars(const string& directory, const string& filesPrefix) {
+    return {directory + "/" + filesPrefix + "_sort_keys.bin"};
+}
+
+OffsetTableWriter::OffsetTableWriter(const string& fileName, const vector<string>& sidecarFileNames) :
+    fileName(fileName), sidecarFileNames(sidecarFileNames), spoolFileName(fileName + ".spool"),
+    spool(spoolFileName, ios::binary | ios::trunc), spooledBytes(0), finished(false) {}
+
+void OffsetTableWriter::add(const string& element) {
+    offsets.push_back(spooledBytes);
+    spool.write(element.data(), element.size());
+    spooledBytes += element.size();
+}
+
+bool OffsetTableWriter::finish() {
+    finished = true;
+    spool.close();
+    const uint64_t headerBytes = (1 + (uint64_t) offsets.size()) * sizeof(unsigned int);
+    // Offsets are 32 bits wide, which caps the size of either file at 4GB
+    if (!spool || headerBytes + spooledBytes > UINT_MAX) {
+        unlink(spoolFileName.c_str());
+        return false;
+    }
+
+    const string tempFileName = fileName + ".tmp";
+    ofstream out(tempFileName, ios::binary | ios::trunc);
+    unsigned int count = offsets.size();
+    out.write((const char *) &count, sizeof(count));
+    for (unsigned int& offset : offsets) offset += headerBytes;
+    out.write((const char *) offsets.data(), offsets.size() * sizeof(unsigned int));
+    ifstream in(spoolFileName, ios::binary);
+    if (spooledBytes > 0) out << in.rdbuf();
+    out.close();
+    unlink(spoolFileName.c_str());
+    if (!out) {
+        unlink(tempFileName.c_str());
+        return false;
+    }
+    for (const string& sidecarFileName : sidecarFileNames) unlink(sidecarFileName.c_str());
+    return rename(tempFileName.c_str(), fileName.c_str()) == 0;
+}
+
+OffsetTableWriter::~OffsetTableWriter() {
+    if (!finished) {
+        spool.close();
+        unlink(spoolFileName.c_str());
+    }
+}
+
+AmazonWriter::AmazonWriter(const string& directory, const string& filesPrefix) :
+    directory(directory), filesPrefix(filesPrefix),
+    database(directory + "/" + filesPrefix + ".bin", databaseSidecars(directory, filesPrefix)) {}
+
+unsigned int AmazonWriter::addReview(const Review& review) {
+    const unsigned int index = database.size();
+    string record;
+    encodeReviewRecord(review, record);
+    database.add(record);
+    forEachReviewWord(review, [this, index](const string& word, unsigned int portion, unsigned int offset) {
+        postings[word].push_back(postingKey(index, (portion << 24) | offset));
+    });
+    return index;
+}
+
+bool AmazonWriter::finish() {
+    OffsetTableWriter keywordIndex(directory + "/" + filesPrefix + "_keyword_index.bin",
+        keywordIndexSidecars(directory, filesPrefix));
+    for (const auto& keyword : postings) {
+        string entry;
+        encodeKeywordEntry(keyword.first, keyword.second, entry);
+        keywordIndex.add(entry);
+    }
+    postings.clear();
+    bool indexWritten = keywordIndex.finish();
+    return database.finish() && indexWritten;
+}
@@ -0,0 +1,210 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <thread>
+#include "amazon.h"
+
+/**
+ * The writer side of the review database and keyword index formats that amazon reads:
+ *
+ *     <prefix>.bin                  review count, offset array, then one record per review:
+ *                                   title\0 category\0 star headline\0 body\0 [pad] year month day
+ *     <prefix>_keyword_index.bin    keyword count, offset array, then one entry per keyword
+ *                                   in sorted order: keyword\0 [pad] count (review, portion|offset)...
+ *
+ * A review's words are numbered from 0 within each portion: its title is portion 0, its
+ * headline portion 1 and its body portion 2.
+ */
+static const unsigned int kTitlePortion = 0;
+static const unsigned int kHeadlinePortion = 1;
+static const unsigned int kBodyPortion = 2;
+
+/**
+ * Function: encodeReviewRecord
+ * ----------------------------
+ * Appends the database record for review to record.
+ */
+void encodeReviewRecord(const Review& review, std::string& record);
+
+/**
+ * Function: parseReviewLine
+ * -------------------------
+ * Parses one line of the Amazon customer reviews dataset's tab-separated format:
+ *
+ *     marketplace customer_id review_id product_id product_parent product_title
+ *     product_category star_rating helpful_votes total_votes vine verified_purchase
+ *     review_headline review_body review_date (YYYY-MM-DD)
+ *
+ * into review.  Returns false for the header line and for malformed lines.
+ */
+bool parseReviewLine(const std::string& line, Review& review);
+
+/**
+ * Function: forEachReviewWord
+ * ---------------------------
+ * Calls visit(word, portion, offset) for every word of the review's title, headline and
+ * body, in order.  Words are split and normalized the way queries are: whitespace and
+ * hyphens separate words, letters are lowercased, and any other punctuation is dropped.
+ */
+void forEachReviewWord(const Review& review,
+    const std::function<void(const std::string& word, unsigned int portion, unsigned int offset)>& visit);
+
+/**
+ * Function: encodeKeywordEntry
+ * ----------------------------
+ * Appends the keyword index entry for keyword to entry.  postings holds posting keys (see
+ * postingKey) in ascending order.
+ */
+void encodeKeywordEntry(const std::string& keyword, const std::vector<uint64_t>& postings, std::string& entry);
+
+/**
+ * Function: keywordIndexSidecars
+ * -------------------------------
+ * The files derived from <directory>/<filesPrefix>_keyword_index.bin (its skip index and compressed form),
+ * which only describe the keyword index they were built from.
+ */
+std::vector<std::string> keywordIndexSidecars(const std::string& directory, const std::string& filesPrefix);
+
+/**
+ * Function: databaseSidecars
+ * --------------------------
+ * The files derived from <directory>/<filesPrefix>.bin (its sort key table), which only
+ * describe the review database they were built from.
+ */
+std::vector<std::string> databaseSidecars(const std::string& directory, const std::string& filesPrefix);
+
+/**
+ * Class: OffsetTableWriter
+ * ------------------------
+ * Streams a file in the count/offset array/elements layout that both the review database
+ * and the keyword index use.  Elements are spooled to a scratch file as they're added, so
+ * only their offsets are held in memory; finish writes the header, appends the elements
+ * and renames the result into place, so a reader never sees a partial file.  Any
+ * sidecarFileNames, files derived from an earlier version of the file, are deleted just
+ * before it's replaced.
+ */
+class OffsetTableWriter {
+    public:
+        OffsetTableWriter(const std::string& fileName,
+            const std::vector<std::string>& sidecarFileNames = std::vector<std::string>());
+
+        void add(const std::string& element);
+        size_t size() const { return offsets.size(); }
+
+        /**
+         * Method: finish
+         * --------------
+         * Writes out the file.  Returns true if and only if every step succeeded.
+         */
+        bool finish();
+
+        ~OffsetTableWriter();
+
+    private:
+        std::string fileName;
+        std::vector<std::string> sidecarFileNames;
+        std::string spoolFileName;
+        std::ofstream spool;
+        std::vector<unsigned int> offsets;
+        uint64_t spooledBytes;
+        bool finished;
+
+        OffsetTableWriter(const OffsetTableWriter& original) = delete;
+        OffsetTableWriter& operator=(const OffsetTableWriter& rhs) = delete;
+};
+
+/**
+ * Class: AmazonWriter
+ * -------------------
+ * Builds a complete review database and keyword index from reviews added one at a time.
+ * Review records are streamed to disk as they're added; the postings are accumulated in
+ * memory and written out, keyword by keyword, by finish.
+ */
+class AmazonWriter {
+    public:
+        AmazonWriter(const std::string& directory, const std::string& filesPrefix);
+
+        /**
+         * Method: addReview
+         * -----------------
+         * Appends review to the database and indexes its words.  review.index is ignored:
+         * reviews are numbered in the order they're added.
+         *
+         * @return the index of the new review
+         */
+        unsigned int addReview(const Review& review);
+
+        size_t totalReviews() const { return database.size(); }
+
+        /**
+         * Method: finish
+         * --------------
+         * Writes the keyword index and completes both files.
+         *
+         * @return true if and only if both files were written successfully
+         */
+        bool finish();
+
+    private:
+        std::string directory;
+        std::string filesPrefix;
+        OffsetTableWriter database;
+        std::map<std::string, std::vector<uint64_t>> postings;
+};
+
+/**
+ * Struct: DatabaseBuildOptions
+ * ----------------------------
+ * Tuning for buildDatabase: how many worker threads tokenize the input, and roughly how
+ * many bytes of postings all of them together may hold in memory before spilling sorted
+ * runs to disk.
+ */
+struct DatabaseBuildOptions {
+    size_t numThreads;
+    size_t memoryBudget;
+
+    DatabaseBuildOptions() : numThreads(std::thread::hardware_concurrency()), memoryBudget(1UL << 30) {}
+};
+
+/**
+ * Struct: DatabaseBuildStats
+ * --------------------------
+ * What buildDatabase did: reviews written, input lines skipped (the header and anything
+ * malformed), distinct keywords, and the number of sorted runs that were merged.
+ */
+struct DatabaseBuildStats {
+    size_t reviews;
+    size_t skippedLines;
+    size_t keywords;
+    size_t runs;
+};
+
+/**
+ * Function: buildDatabase
+ * -----------------------
+ * Builds <directory>/<filesPrefix>.bin and <directory>/<filesPrefix>_keyword_index.bin from
+ * a stream of lines in the format parseReviewLine accepts.  The files are byte-for-byte
+ * what an AmazonWriter fed the same reviews would produce, but the work is spread over
+ * options.numThreads threads and memory stays bounded regardless of the input size:
+ *
+ *   - Workers take chunks of lines in input order, parse and encode them, and append the
+ *     records to the database strictly in chunk order, which fixes each review's index.
+ *   - Each worker then tokenizes its chunk into its own partial inverted index, and
+ *     whenever that grows past its share of options.memoryBudget, writes it out as a
+ *     keyword-sorted run file next to the output.
+ *   - Finally the runs are k-way merged keyword by keyword into the keyword index, so
+ *     only one keyword's postings are ever held in memory at once.
+ *
+ * If the database has a segment manifest, the new files replace every segment it lists
+ * (see amazon::replaceBaseSegment).
+ *
+ * @return true if and only if both files were written successfully
+ */
+bool buildDatabase(std::istream& reviews, const std::string& directory, const std::string& filesPrefix,
+    const DatabaseBuildOptions& options, DatabaseBuildStats& stats);
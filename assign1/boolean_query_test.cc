@@ -0,0 +1,272 @@
+/**
+ * File: boolean_query_test.cc
+ * ---------------------------
+ * Checks amazon::parseBooleanQuery on the edge cases of its syntax (dangling and doubled
+ * operators, bare dashes, quoted operators), and then checks searchBoolean and the MaxScore
+ * evaluation behind searchRanked against brute force: every review of a small random
+ * database is scored with the BM25 formula searchRanked documents, straight from the
+ * reviews' words, and the top k must come out the same.  The ranking is checked on the
+ * base files alone and again once an appended segment splits the reviews in two.
+ *
+ *    > ./boolean_query_test
+ */
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <unistd.h>
+#include <stdlib.h>
+#include "amazon.h"
+#include "amazon_writer.h"
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool condition, const string& what) {
+    if (condition) return;
+    cout << "FAILED: " << what << endl;
+    failures++;
+}
+
+typedef vector<vector<string>> Terms;
+
+static void checkParse(const string& query, const vector<Terms>& clauses, const Terms& excluded) {
+    BooleanQuery parsed = amazon::parseBooleanQuery(query);
+    check(parsed.clauses == clauses, "clauses of '" + query + "'");
+    check(parsed.excluded == excluded, "excluded terms of '" + query + "'");
+}
+
+static void testParsing() {
+    checkParse("", {}, {});
+    checkParse("OR", {}, {});
+    checkParse("NOT", {}, {});
+    checkParse("-", {}, {});
+    checkParse("OR NOT OR", {}, {});
+    checkParse("tv -", {{{"tv"}}}, {});
+    checkParse("tv NOT", {{{"tv"}}}, {});
+    checkParse("tv OR", {{{"tv"}}}, {});
+    checkParse("OR tv", {{{"tv"}}}, {});
+    checkParse("tv OR monitor", {{{"tv"}, {"monitor"}}}, {});
+    checkParse("tv OR OR monitor", {{{"tv"}, {"monitor"}}}, {});
+    checkParse("tv OR monitor OR screen remote", {{{"tv"}, {"monitor"}, {"screen"}}, {{"remote"}}}, {});
+    checkParse("tv or monitor", {{{"tv"}}, {{"or"}}, {{"monitor"}}}, {});
+    checkParse("-tv OR monitor", {{{"monitor"}}}, {{"tv"}});
+    checkParse("NOT tv OR monitor", {{{"monitor"}}}, {{"tv"}});
+    checkParse("NOT NOT tv", {}, {{"tv"}});
+    checkParse("\"dead pixels\" OR tv", {{{"dead", "pixels"}, {"tv"}}}, {});
+    checkParse("tv NOT \"dead pixels\"", {{{"tv"}}}, {{"dead", "pixels"}});
+    checkParse("tv -\"dead pixels\"", {{{"tv"}}}, {{"dead", "pixels"}});
+    checkParse("\"NOT\" OR \"tv OR\"", {{{"not"}, {"tv", "or"}}}, {});
+    checkParse("second-rate -third-rate", {{{"second", "rate"}}}, {{"third", "rate"}});
+    checkParse("TV OR --", {{{"tv"}}}, {});
+}
+
+static const unsigned int kVocabulary = 24;
+static const unsigned int kNumReviews = 400;
+static const size_t kRankedReviews[] = {1, 3, 10, 50, 1000};
+
+// Word i of the vocabulary is "w<i>"; low-numbered words are much more common than the rest
+static string randomWords(mt19937& random, unsigned int count) {
+    string words;
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int word = min(random() % kVocabulary, random() % kVocabulary);
+        if (i > 0) words += ' ';
+        words += "w" + to_string(word);
+    }
+    return words;
+}
+
+/**
+ * Struct: ReviewWords
+ * -------------------
+ * What brute force needs to know about a review: the words of each portion in order, and
+ * the size of its database record, which is the length BM25 normalizes by.
+ */
+struct ReviewWords {
+    vector<string> portions[3];
+    size_t recordBytes;
+};
+
+static ReviewWords reviewWords(const Review& review) {
+    ReviewWords words;
+    forEachReviewWord(review, [&words](const string& word, unsigned int portion, unsigned int offset) {
+        words.portions[portion].push_back(word);
+    });
+    string record;
+    encodeReviewRecord(review, record);
+    words.recordBytes = record.size();
+    return words;
+}
+
+// Occurrences of a word or phrase within one portion of the review, overlapping ones included
+static unsigned int occurrences(const ReviewWords& review, const vector<string>& term) {
+    unsigned int count = 0;
+    for (const vector<string>& portion : review.portions) {
+        for (size_t start = 0; start + term.size() <= portion.size(); start++) {
+            if (equal(term.begin(), term.end(), portion.begin() + start)) count++;
+        }
+    }
+    return count;
+}
+
+static vector<unsigned int> bruteForceBoolean(const vector<ReviewWords>& reviews, const BooleanQuery& query) {
+    vector<unsigned int> matches;
+    if (query.clauses.empty()) return matches;
+    for (unsigned int i = 0; i < reviews.size(); i++) {
+        bool match = true;
+        for (const Terms& clause : query.clauses) {
+            bool any = false;
+            for (const vector<string>& term : clause) any = any || occurrences(reviews[i], term) > 0;
+            match = match && any;
+        }
+        for (const vector<string>& term : query.excluded) match = match && occurrences(reviews[i], term) == 0;
+        if (match) matches.push_back(i);
+    }
+    return matches;
+}
+
+/**
+ * Scores every review by BM25 (k1 = 1.2, b = 0.75), as searchRanked documents it: a phrase's
+ * document frequency is its rarest word's, and reviews containing an excluded term, or none
+ * of the terms, aren't ranked.  Returns (score, index) for every ranked review.
+ */
+static vector<pair<double, unsigned int>> bruteForceRanked(const vector<ReviewWords>& reviews, const BooleanQuery& query) {
+    set<vector<string>> unique;
+    for (const Terms& clause : query.clauses) unique.insert(clause.begin(), clause.end());
+    const Terms terms(unique.begin(), unique.end());
+
+    double totalBytes = 0;
+    for (const ReviewWords& review : reviews) totalBytes += review.recordBytes;
+    const double averageLength = totalBytes / reviews.size();
+
+    vector<double> idfs;
+    for (const vector<string>& term : terms) {
+        double frequency = reviews.size();
+        for (const string& word : term) {
+            unsigned int containing = 0;
+            for (const ReviewWords& review : reviews) containing += occurrences(review, vector<string>(1, word)) > 0;
+            frequency = min<double>(frequency, containing);
+        }
+        idfs.push_back(log(1 + (reviews.size() - frequency + 0.5) / (frequency + 0.5)));
+    }
+
+    vector<pair<double, unsigned int>> scored;
+    for (unsigned int i = 0; i < reviews.size(); i++) {
+        bool excluded = false;
+        for (const vector<string>& term : query.excluded) excluded = excluded || occurrences(reviews[i], term) > 0;
+        if (excluded) continue;
+        const double lengthNorm = 1.2 * (1 - 0.75 + 0.75 * reviews[i].recordBytes / averageLength);
+        double score = 0;
+        bool any = false;
+        for (size_t t = 0; t < terms.size(); t++) {
+            double frequency = occurrences(reviews[i], terms[t]);
+            if (frequency == 0) continue;
+            any = true;
+            score += idfs[t] * frequency * (1.2 + 1) / (frequency + lengthNorm);
+        }
+        if (any) scored.push_back(make_pair(score, i));
+    }
+    return scored;
+}
+
+static void checkQuery(const amazon& db, const vector<ReviewWords>& reviews, const string& query, const string& when) {
+    const BooleanQuery parsed = amazon::parseBooleanQuery(query);
+    vector<unsigned int> matches;
+    db.searchBoolean(query, matches);
+    check(matches == bruteForceBoolean(reviews, parsed), when + ": boolean matches for '" + query + "'");
+
+    // Brute-force scores are summed in a different order, so they're compared with a tolerance
+    const double tolerance = 1e-9;
+    map<unsigned int, double> bruteScores;
+    vector<double> bestScores;
+    for (const auto& scored : bruteForceRanked(reviews, parsed)) {
+        bruteScores[scored.second] = scored.first;
+        bestScores.push_back(scored.first);
+    }
+    sort(bestScores.rbegin(), bestScores.rend());
+    for (size_t k : kRankedReviews) {
+        const string what = when + ": top " + to_string(k) + " for '" + query + "'";
+        vector<RankedReview> ranked;
+        db.searchRanked(query, k, ranked);
+        check(ranked.size() == min(k, bestScores.size()), what + " has the right number of reviews");
+        for (size_t i = 0; i < ranked.size() && i < bestScores.size(); i++) {
+            auto brute = bruteScores.find(ranked[i].index);
+            check(brute != bruteScores.end() && fabs(brute->second - ranked[i].score) < tolerance,
+                what + ": review " + to_string(ranked[i].index) + " is scored as brute force scores it");
+            check(fabs(ranked[i].score - bestScores[i]) < tolerance, what + ": rank " + to_string(i) + " has the k-th best score");
+            if (i > 0) {
+                check(ranked[i - 1].score > ranked[i].score ||
+                    (ranked[i - 1].score == ranked[i].score && ranked[i - 1].index < ranked[i].index),
+                    what + ": best first, ties to the lower index");
+            }
+        }
+    }
+}
+
+static const char *kQueries[] = {
+    "w0", "w20", "w1 w2", "w3 w4 w5 w6", "w1 OR w15", "w7 OR w19 OR w23 w0", "w2 -w0", "w1 NOT w3 NOT w4",
+    "\"w0 w1\"", "\"w0 w0\" OR w22", "\"w2 w1 w0\" w5", "w9 OR \"w1 w1\" -w2", "w23 OR w22", "nothing OR w21",
+    "w1 -w1", "-w0", "NOT w4", "w0 w1 w2 w3 w4 w5 w6 w7 w8"
+};
+
+int main(int argc, char *argv[]) {
+    testParsing();
+
+    char scratch[] = "/tmp/boolean_query_test.XXXXXX";
+    if (mkdtemp(scratch) == nullptr) {
+        cerr << "Could not create a scratch directory" << endl;
+        return 1;
+    }
+    const string directory = scratch;
+
+    mt19937 random(15);
+    vector<Review> reviews;
+    vector<ReviewWords> words;
+    for (unsigned int i = 0; i < kNumReviews; i++) {
+        Review review;
+        review.index = i;
+        review.product_title = randomWords(random, 1 + random() % 4);
+        review.product_category = "Electronics";
+        review.star_rating = 1 + random() % 5;
+        review.review_headline = randomWords(random, 1 + random() % 5);
+        review.review_body = randomWords(random, 3 + random() % 40);
+        review.review_year = 2010;
+        review.review_month = 1 + random() % 12;
+        review.review_day = 1 + random() % 28;
+        reviews.push_back(review);
+        words.push_back(reviewWords(review));
+    }
+
+    // First as one base, then with the last quarter of the reviews in an appended segment
+    const unsigned int baseReviews = kNumReviews * 3 / 4;
+    AmazonWriter writer(directory, "whole");
+    for (const Review& review : reviews) writer.addReview(review);
+    check(writer.finish(), "whole database written");
+    AmazonWriter base(directory, "split");
+    for (unsigned int i = 0; i < baseReviews; i++) base.addReview(reviews[i]);
+    check(base.finish(), "base of the split database written");
+    check(amazon::appendSegment(directory, "split", vector<Review>(reviews.begin() + baseReviews, reviews.end())),
+        "segment of the split database appended");
+    {
+        amazon whole(directory, "whole");
+        amazon split(directory, "split");
+        check(whole.good() && split.good() && split.totalReviews() == kNumReviews, "databases open");
+        for (const char *query : kQueries) {
+            checkQuery(whole, words, query, "one segment");
+            checkQuery(split, words, query, "two segments");
+        }
+    }
+
+    for (const char *name : {"whole.bin", "whole_keyword_index.bin", "split.bin", "split_keyword_index.bin",
+            "split_delta_1.bin", "split_delta_1_keyword_index.bin", "split_segments.txt", "split_segments.lock"}) {
+        unlink((directory + "/" + name).c_str());
+    }
+    rmdir(scratch);
+
+    if (failures == 0) cout << "All boolean and ranked query tests passed." << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include "amazon.h"
+#include "amazon_writer.h"
+using namespace std;
+
+const string kAmazonDataDirectory("/usr/class/archive/cs/cs110/cs110.1204/samples/assign1");
+const string kFilesPrefix("amazon_reviews_us_Electronics_v1_00");
+static const int kDatabaseNotWritten = 2;
+static const int kReviewFileNotFound = 3;
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)>" << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-i,--input TSV_FILE\tBuild from TSV_FILE (Amazon reviews dataset format), or standard input if '-'" << endl
+        << "\t-t,--threads N\tTokenize with N threads (default is one per core)" << endl
+        << "\t-m,--memory MB\tSpill postings to disk beyond roughly MB megabytes (default is 1024)" << endl
+        << "\t-d,--directory DIRECTORY\tSpecify the directory for the database files" << endl
+        << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_reviews_us_Electronics_v1_00')" << endl;
+}
+
+static bool parseCount(const string& text, size_t& count) {
+    try {
+        size_t end;
+        long value = stol(text, &end);
+        if (end != text.size() || value <= 0) return false;
+        count = value;
+        return true;
+    } catch (const exception& e) {
+        return false;
+    }
+}
+
+static int parseArgs(int argc, char **argv, string &amazonDataDirectory, string &filesPrefix,
+        string &inputFileName, DatabaseBuildOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-i") || (arg == "--input")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                inputFileName = argv[++i];
+            } else {
+                cout << "--input option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-t") || (arg == "--threads")) {
+            if (i + 1 >= argc || !parseCount(argv[++i], options.numThreads)) {
+                cout << "--threads option requires a positive number." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-m") || (arg == "--memory")) {
+            size_t megabytes;
+            if (i + 1 >= argc || !parseCount(argv[++i], megabytes)) {
+                cout << "--memory option requires a positive number." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+            options.memoryBudget = megabytes << 20;
+        } else if ((arg == "-d") || (arg == "--directory")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                amazonDataDirectory = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--directory option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else if ((arg == "-f") || (arg == "--files-prefix")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                filesPrefix = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--files-prefix option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else {
+            cout << "Unrecognized argument '" << arg << "'" << endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+    }
+    if (inputFileName == "") {
+        cout << "--input is required" << endl;
+        showUsage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string amazonDataDirectory = kAmazonDataDirectory;
+    string filesPrefix = kFilesPrefix;
+    string inputFileName;
+    DatabaseBuildOptions options;
+
+    if (parseArgs(argc, argv, amazonDataDirectory, filesPrefix, inputFileName, options) == -1) return -1;
+
+    ifstream inputFile;
+    if (inputFileName != "-") {
+        inputFile.open(inputFileName);
+        if (!inputFile) {
+            cerr << "Could not open review file '" << inputFileName << "'" << endl;
+            return kReviewFileNotFound;
+        }
+    }
+    istream& input = inputFileName == "-" ? cin : inputFile;
+
+    DatabaseBuildStats stats;
+    if (!buildDatabase(input, amazonDataDirectory, filesPrefix, options, stats)) {
+        cerr << "Problem writing the database files...aborting!" << endl;
+        return kDatabaseNotWritten;
+    }
+    cout << "Wrote " << stats.reviews << " reviews and " << stats.keywords << " keywords ("
+        << stats.skippedLines << " lines skipped, " << stats.runs << " runs merged)" << endl;
+    return 0;
+}
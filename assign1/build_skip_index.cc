@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string>
+#include "amazon.h"
+using namespace std;
+
+const string kAmazonDataDirectory("/usr/class/archive/cs/cs110/cs110.1204/samples/assign1");
+const string kFilesPrefix("amazon_reviews_us_Electronics_v1_00");
+static const unsigned int kDefaultBlockSize = 128;
+static const int kSkipIndexNotWritten = 2;
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)>" << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-b,--block-size N\tNumber of postings per skip pointer (default is " << kDefaultBlockSize << ")" << endl
+        << "\t-d,--directory DIRECTORY\tSpecify the directory for the database files" << endl
+        << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_reviews_us_Electronics_v1_00')" << endl;
+}
+
+static int parseArgs(int argc, char **argv, string &amazonDataDirectory, string &filesPrefix, unsigned int &blockSize) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-b") || (arg == "--block-size")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                int size = stoi(argv[++i]);
+                if (size <= 0) {
+                    cout << "--block-size must be positive" << endl;
+                    return -1;
+                }
+                blockSize = size;
+            } else {
+                cout << "--block-size option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }
+        } else if ((arg == "-d") || (arg == "--directory")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                amazonDataDirectory = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--directory option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else if ((arg == "-f") || (arg == "--files-prefix")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                filesPrefix = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--files-prefix option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else {
+            cout << "Unrecognized argument '" << arg << "'" << endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string amazonDataDirectory = kAmazonDataDirectory;
+    string filesPrefix = kFilesPrefix;
+    unsigned int blockSize = kDefaultBlockSize;
+
+    if (parseArgs(argc, argv, amazonDataDirectory, filesPrefix, blockSize) == -1) return -1;
+
+    if (!amazon::writeSkipIndex(amazonDataDirectory, filesPrefix, blockSize)) {
+        cerr << "Problem writing the skip index...aborting!" << endl;
+        return kSkipIndexNotWritten;
+    }
+
+    amazon db(amazonDataDirectory, filesPrefix);
+    if (db.good() && db.hasCompressedIndex()) {
+        // Compressed lists carry their own block tables, so the skip index goes unused
+        cout << "Wrote skip index for " << db.totalKeywords() << " keywords (block size " << blockSize
+            << "), but the compressed keyword index supersedes it" << endl;
+        return 0;
+    }
+    if (!db.good() || !db.hasSkipIndex()) {
+        cerr << "Skip index was written but could not be loaded back!" << endl;
+        return kSkipIndexNotWritten;
+    }
+    cout << "Wrote skip index for " << db.totalKeywords() << " keywords (block size " << blockSize << ")" << endl;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+#include "amazon.h"
+using namespace std;
+
+const string kAmazonDataDirectory("/usr/class/archive/cs/cs110/cs110.1204/samples/assign1");
+const string kFilesPrefix("amazon_reviews_us_Electronics_v1_00");
+static const int kSortKeyTableNotWritten = 2;
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)>" << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-d,--directory DIRECTORY\tSpecify the directory for the database files" << endl
+        << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_reviews_us_Electronics_v1_00')" << endl;
+}
+
+static int parseArgs(int argc, char **argv, string &amazonDataDirectory, string &filesPrefix) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-d") || (arg == "--directory")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                amazonDataDirectory = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--directory option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else if ((arg == "-f") || (arg == "--files-prefix")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                filesPrefix = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--files-prefix option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else {
+            cout << "Unrecognized argument '" << arg << "'" << endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string amazonDataDirectory = kAmazonDataDirectory;
+    string filesPrefix = kFilesPrefix;
+
+    if (parseArgs(argc, argv, amazonDataDirectory, filesPrefix) == -1) return -1;
+
+    if (!amazon::writeSortKeyTable(amazonDataDirectory, filesPrefix)) {
+        cerr << "Problem writing the sort key table...aborting!" << endl;
+        return kSortKeyTableNotWritten;
+    }
+
+    amazon db(amazonDataDirectory, filesPrefix);
+    if (!db.good() || !db.hasSortKeyTable()) {
+        cerr << "Sort key table was written but could not be loaded back!" << endl;
+        return kSortKeyTableNotWritten;
+    }
+    cout << "Wrote sort keys for " << db.totalReviews() << " reviews" << endl;
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <string>
+#include "amazon.h"
+using namespace std;
+
+const string kAmazonDataDirectory("/usr/class/archive/cs/cs110/cs110.1204/samples/assign1");
+const string kFilesPrefix("amazon_reviews_us_Electronics_v1_00");
+static const int kCompressedIndexNotWritten = 2;
+
+static void showUsage(string name)
+{
+    cout << "Usage: " << name << " <option(s)>" << endl
+        << "Options:\n" << endl
+        << "\t-h,--help\t\tShow this help message" << endl
+        << "\t-d,--directory DIRECTORY\tSpecify the directory for the database files" << endl
+        << "\t-f,--files-prefix FILE_PREFIX\tSpecify the files prefix (default is 'amazon_reviews_us_Electronics_v1_00')" << endl;
+}
+
+static int parseArgs(int argc, char **argv, string &amazonDataDirectory, string &filesPrefix) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "-h") || (arg == "--help")) {
+            showUsage(argv[0]);
+            return -1;
+        } else if ((arg == "-d") || (arg == "--directory")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                amazonDataDirectory = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--directory option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else if ((arg == "-f") || (arg == "--files-prefix")) {
+            if (i + 1 < argc) { // Make sure we aren't at the end of argv!
+                filesPrefix = argv[++i]; // Increment 'i' so we don't get the argument as the next argv[i].
+            } else { // Uh-oh, there was no argument to the destination option.
+                cout << "--files-prefix option requires one argument." << endl;
+                showUsage(argv[0]);
+                return -1;
+            }  
+        } else {
+            cout << "Unrecognized argument '" << arg << "'" << endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static off_t fileSize(const string& fileName) {
+    struct stat stats;
+    if (stat(fileName.c_str(), &stats) == -1) return 0;
+    return stats.st_size;
+}
+
+int main(int argc, char **argv) {
+    string amazonDataDirectory = kAmazonDataDirectory;
+    string filesPrefix = kFilesPrefix;
+
+    if (parseArgs(argc, argv, amazonDataDirectory, filesPrefix) == -1) return -1;
+
+    if (!amazon::writeCompressedIndex(amazonDataDirectory, filesPrefix)) {
+        cerr << "Problem writing the compressed keyword index...aborting!" << endl;
+        return kCompressedIndexNotWritten;
+    }
+
+    amazon db(amazonDataDirectory, filesPrefix);
+    if (!db.good() || !db.hasCompressedIndex()) {
+        cerr << "Compressed keyword index was written but could not be loaded back!" << endl;
+        return kCompressedIndexNotWritten;
+    }
+
+    const string prefix = amazonDataDirectory + "/" + filesPrefix;
+    off_t plainSize = fileSize(prefix + "_keyword_index.bin");
+    off_t compressedSize = fileSize(prefix + "_keyword_index_compressed.bin");
+    cout << "Compressed " << db.totalKeywords() << " keywords: " << plainSize << " bytes -> "
+        << compressedSize << " bytes" << endl;
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "keyword_dictionary.h"
+#include <string.h>
+
+using namespace std;
+
+static uint64_t keywordPrefix(const char *keyword, size_t length) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < sizeof(prefix); i++) {
+        unsigned char c = i < length ? keyword[i] : 0;
+        prefix = (prefix << 8) | c;
+    }
+    return prefix;
+}
+
+// Fills the subtree rooted at slot k with the next keywords in sorted order (an in-order walk)
+static void fillEytzinger(const vector<uint64_t>& sortedPrefixes, size_t& next, size_t k,
+        vector<uint64_t>& prefixes, vector<unsigned int>& ordinals) {
+    if (k >= prefixes.size()) return;
+    fillEytzinger(sortedPrefixes, next, 2 * k, prefixes, ordinals);
+    prefixes[k] = sortedPrefixes[next];
+    ordinals[k] = next++;
+    fillEytzinger(sortedPrefixes, next, 2 * k + 1, prefixes, ordinals);
+}
+
+void KeywordDictionary::build(const void *keywordIndex) {
+    index = (const char *) keywordIndex;
+    const unsigned int numKeywords = *(const unsigned int *) keywordIndex;
+    offsets = (const unsigned int *) keywordIndex + 1;
+
+    vector<uint64_t> sortedPrefixes(numKeywords);
+    for (unsigned int i = 0; i < numKeywords; i++) {
+        const char *keyword = index + offsets[i];
+        sortedPrefixes[i] = keywordPrefix(keyword, strnlen(keyword, sizeof(uint64_t)));
+    }
+
+    prefixes.assign(numKeywords + 1, 0);
+    ordinals.assign(numKeywords + 1, numKeywords);
+    size_t next = 0;
+    fillEytzinger(sortedPrefixes, next, 1, prefixes, ordinals);
+}
+
+void KeywordDictionary::clear() {
+    index = nullptr;
+    offsets = nullptr;
+    vector<uint64_t>().swap(prefixes);
+    vector<unsigned int>().swap(ordinals);
+}
+
+size_t KeywordDictionary::lowerBound(uint64_t prefix) const {
+    // Branch-free descent: each step goes right while the slot is still too small.  The
+    // answer is the last slot where we went left, recovered by stripping the trailing
+    // right turns (1 bits) and that final left turn off k.
+    const size_t n = prefixes.size() - 1;
+    size_t k = 1;
+    while (k <= n) {
+        __builtin_prefetch(&prefixes[0] + 16 * k);
+        k = 2 * k + (prefixes[k] < prefix);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k == 0 ? size() : ordinals[k];
+}
+
+int KeywordDictionary::compareKeyword(unsigned int ordinal, const char *keyword, size_t length) const {
+    const char *candidate = index + offsets[ordinal];
+    int order = strncmp(candidate, keyword, length);
+    if (order != 0) return order;
+    return candidate[length] == '\0' ? 0 : 1;
+}
+
+int KeywordDictionary::find(const char *keyword, size_t length) const {
+    if (index == nullptr || memchr(keyword, '\0', length) != nullptr) return -1;
+    uint64_t prefix = keywordPrefix(keyword, length);
+    size_t low = lowerBound(prefix);
+    if (low == size()) return -1;
+    if (length <= sizeof(prefix)) {
+        // The prefix is the whole query, so only the first candidate can match exactly
+        return compareKeyword(low, keyword, length) == 0 ? (int) low : -1;
+    }
+
+    // Binary search the run of keywords sharing the query's prefix, comparing raw bytes
+    size_t high = (prefix == UINT64_MAX) ? size() : lowerBound(prefix + 1);
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = compareKeyword(mid, keyword, length);
+        if (order == 0) return mid;
+        if (order < 0) low = mid + 1;
+        else high = mid;
+    }
+    return -1;
+}
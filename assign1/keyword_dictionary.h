@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Class: KeywordDictionary
+ * ------------------------
+ * An in-memory search structure over the sorted keywords of a keyword index, built once
+ * when the index is opened.  Every keyword is reduced to its first 8 bytes, packed
+ * big-endian and zero-padded so that comparing two prefixes as integers orders them the
+ * way comparing the strings would.  The prefixes are laid out in Eytzinger (breadth-first
+ * binary tree) order: a search walks down the tree touching a few cache lines at the top
+ * of one small array, instead of probing random pages of the mmap'd index.
+ *
+ * Only keywords that share the query's whole 8-byte prefix are compared in full, as raw
+ * bytes against the index, and there are rarely more than a handful of them.
+ */
+class KeywordDictionary {
+    public:
+        KeywordDictionary() : index(nullptr) {}
+
+        /**
+         * Method: build
+         * -------------
+         * Indexes the keywords of the keyword index mapped at keywordIndex: a keyword count,
+         * followed by that many offsets to null-terminated keywords in sorted order.
+         */
+        void build(const void *keywordIndex);
+
+        /**
+         * Method: find
+         * ------------
+         * Returns the position of the keyword (length bytes at keyword) in the keyword
+         * index's offset array, or -1 if the index doesn't contain it.
+         */
+        int find(const char *keyword, size_t length) const;
+
+        /**
+         * Method: clear
+         * -------------
+         * Forgets the keyword index (once it's about to be unmapped) and frees the
+         * dictionary; find reports every keyword as missing until the next build.
+         */
+        void clear();
+
+        size_t size() const { return prefixes.empty() ? 0 : prefixes.size() - 1; }
+
+    private:
+        const char *index;
+        const unsigned int *offsets;
+
+        // Slot 0 is unused, so the children of slot k are slots 2k and 2k + 1
+        std::vector<uint64_t> prefixes;
+        std::vector<unsigned int> ordinals;
+
+        size_t lowerBound(uint64_t prefix) const;
+        int compareKeyword(unsigned int ordinal, const char *keyword, size_t length) const;
+};
@@ -0,0 +1,266 @@
+#include "posting_list.h"
+#include <algorithm>
+#include <climits>
+
+using namespace std;
+
+static void appendVarint(uint64_t value, vector<unsigned char>& out) {
+    while (value >= 0x80) {
+        out.push_back((unsigned char) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char) value);
+}
+
+static inline uint64_t readVarint(const unsigned char *& data) {
+    uint64_t value = 0;
+    unsigned int shift = 0;
+    while (*data & 0x80) {
+        value |= (uint64_t) (*data++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | ((uint64_t) *data++ << shift);
+}
+
+void encodePostingBlock(const unsigned int *postings, unsigned int count, vector<unsigned char>& out) {
+    if (count == 0) return;
+    unsigned int prevReview = postings[0];
+    unsigned int prevPortionAndOffset = 0;
+    bool first = true;
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int review = postings[2 * i];
+        unsigned int portionAndOffset = postings[2 * i + 1];
+        if (!first && review == prevReview && (portionAndOffset >> 24) == (prevPortionAndOffset >> 24)) {
+            appendVarint((uint64_t) (portionAndOffset - prevPortionAndOffset) << 1, out);
+        } else {
+            appendVarint(((uint64_t) (review - prevReview) << 1) | 1, out);
+            appendVarint(((uint64_t) (portionAndOffset & kPostingOffsetMask) << 8) | (portionAndOffset >> 24), out);
+        }
+        prevReview = review;
+        prevPortionAndOffset = portionAndOffset;
+        first = false;
+    }
+}
+
+const unsigned char *decodePostingBlock(const unsigned char *data, unsigned int firstReviewIndex, unsigned int count,
+        uint64_t *keys) {
+    uint64_t key = postingKey(firstReviewIndex, 0);
+    for (unsigned int i = 0; i < count; i++) {
+        uint64_t value = readVarint(data);
+        if ((value & 1) == 0) {
+            key += value >> 1;
+        } else {
+            unsigned int review = postingKeyReviewIndex(key) + (unsigned int) (value >> 1);
+            uint64_t position = readVarint(data);
+            key = postingKey(review, (unsigned int) (((position & 0xFF) << 24) | (position >> 8)));
+        }
+        keys[i] = key;
+    }
+    return data;
+}
+
+PostingCursor PostingCursor::compressed(const SkipEntry *blocks, unsigned int numPostings, const char *base) {
+    PostingCursor cursor(nullptr, numPostings);
+    cursor.isCompressed = true;
+    cursor.decoded.keys.reset(new uint64_t[kCompressedBlockSize]);
+    cursor.attachSkips(blocks, (numPostings + kCompressedBlockSize - 1) / kCompressedBlockSize, base);
+    return cursor;
+}
+
+const uint64_t *PostingCursor::decodeBlock(unsigned int block) const {
+    if (block != decoded.block) {
+        unsigned int start = block * kCompressedBlockSize;
+        decoded.count = min(kCompressedBlockSize, numPostings - start);
+        const unsigned char *data = (const unsigned char *) skipBase + skips[block].byteOffset;
+        const unsigned char *end = decodePostingBlock(data, skips[block].firstReviewIndex, decoded.count, decoded.keys.get());
+        decoded.block = block;
+        QUERY_COUNT(blocksDecoded, 1);
+        QUERY_COUNT(bytesTouched, end - data);
+    }
+    return decoded.keys.get();
+}
+
+void PostingCursor::attachSkips(const SkipEntry *skips, unsigned int numSkips, const char *skipBase) {
+    this->skips = skips;
+    this->numSkips = numSkips;
+    this->skipBase = skipBase;
+    currentSkip = 0;
+}
+
+void PostingCursor::leapToReview(unsigned int reviewIndex) {
+    // Find the last block that starts strictly before reviewIndex: a review's postings can
+    // spill over a block boundary, so a block starting at reviewIndex itself may be too late.
+    unsigned int low = currentSkip;
+    unsigned int high = numSkips;
+    if (low + 1 >= high || skips[low + 1].firstReviewIndex >= reviewIndex) return;
+    QUERY_COUNT(bytesTouched, sizeof(SkipEntry));
+    while (high - low > 1) {
+        unsigned int mid = low + (high - low) / 2;
+        if (skips[mid].firstReviewIndex < reviewIndex) low = mid;
+        else high = mid;
+    }
+    currentSkip = low;
+
+    unsigned int blockPosition;
+    if (isCompressed) {
+        blockPosition = low * kCompressedBlockSize;
+    } else {
+        const unsigned int *blockStart = (const unsigned int *) (skipBase + skips[low].byteOffset);
+        blockPosition = (blockStart - postings) / 2;
+    }
+    if (blockPosition > position) position = blockPosition;
+}
+
+void PostingCursor::seekCompressed(uint64_t target) {
+    while (!done()) {
+        unsigned int block = position / kCompressedBlockSize;
+        const uint64_t *keys = decodeBlock(block);
+        unsigned int start = block * kCompressedBlockSize;
+        if (keys[decoded.count - 1] < target) {
+            position = start + decoded.count;
+            continue;
+        }
+        position = start + (lower_bound(keys + (position - start), keys + decoded.count, target) - keys);
+        return;
+    }
+}
+
+void PostingCursor::seek(uint64_t target) {
+#if QUERY_STATS_ENABLED
+    unsigned int before = position;
+    seekForward(target);
+    if (position != before) {
+        QUERY_COUNT(seeks, 1);
+        QUERY_COUNT(postingsScanned, position - before);
+    }
+#else
+    seekForward(target);
+#endif
+}
+
+void PostingCursor::seekForward(uint64_t target) {
+    if (done() || keyAt(position) >= target) return;
+    if (numSkips > 0) {
+        leapToReview(postingKeyReviewIndex(target));
+        if (keyAt(position) >= target) return;
+    }
+    if (isCompressed) {
+        seekCompressed(target);
+        return;
+    }
+
+    // Gallop: double the step until we overshoot, then binary search the last gap.
+    unsigned int low = position;
+    unsigned int step = 1;
+    unsigned int high = position + step;
+    while (high < numPostings && keyAt(high) < target) {
+        low = high;
+        step *= 2;
+        high = (numPostings - low > step) ? low + step : numPostings;
+    }
+
+    // Invariant: keyAt(low) < target, and keyAt(high) >= target (or high == numPostings)
+    while (high - low > 1) {
+        unsigned int mid = low + (high - low) / 2;
+        if (keyAt(mid) < target) low = mid;
+        else high = mid;
+    }
+    position = high;
+}
+
+bool PhraseCursor::seekReview(unsigned int reviewIndex) {
+    if (exhausted || words.empty()) return false;
+    if (positioned && current >= reviewIndex) return true;
+
+    uint64_t target = postingKey(reviewIndex, 0);
+    while (true) {
+        bool aligned = true;
+        for (size_t i = 0; i < words.size(); i++) {
+            // A phrase can't straddle two portions: if word i would land past the last
+            // offset of this portion, move on to the start of the next one.
+            if ((target & kPostingOffsetMask) + i > kPostingOffsetMask) {
+                target = (target | kPostingOffsetMask) + 1;
+                aligned = false;
+                break;
+            }
+
+            PostingCursor& word = words[i];
+            word.seek(target + i);
+            if (word.done()) {
+                exhausted = true;
+                return false;
+            }
+
+            uint64_t key = word.key();
+            if (key != target + i) {
+                // The earliest phrase start still consistent with word i's position.
+                uint64_t candidate = (key & kPostingOffsetMask) >= i ? key - i : (key & ~kPostingOffsetMask);
+                target = max(target + 1, candidate);
+                aligned = false;
+                break;
+            }
+        }
+        if (aligned) {
+            current = postingKeyReviewIndex(target);
+            positioned = true;
+            return true;
+        }
+    }
+}
+
+unsigned int PhraseCursor::occurrences() {
+    if (!positioned || exhausted) return 0;
+    const uint64_t reviewEnd = postingKey(current + 1, 0);
+    unsigned int count = 0;
+    PostingCursor& first = words[0];
+    for (; !first.done() && first.key() < reviewEnd; first.next()) {
+        const uint64_t start = first.key();
+        if ((start & kPostingOffsetMask) + words.size() - 1 > kPostingOffsetMask) continue;
+        bool aligned = true;
+        for (size_t i = 1; i < words.size() && aligned; i++) {
+            words[i].seek(start + i);
+            aligned = !words[i].done() && words[i].key() == start + i;
+        }
+        if (aligned) count++;
+    }
+    return count;
+}
+
+size_t PhraseCursor::cost() const {
+    size_t smallest = SIZE_MAX;
+    for (const PostingCursor& word : words) smallest = min(smallest, (size_t) word.size());
+    return smallest;
+}
+
+void intersectPhrases(vector<PhraseCursor>& phrases, vector<unsigned int>& reviewIndexes,
+        unsigned int firstReview, unsigned int lastReview) {
+    if (phrases.empty()) return;
+    QUERY_STAGE(kMatchStage);
+    const size_t initialSize = reviewIndexes.size();
+    sort(phrases.begin(), phrases.end(), [](const PhraseCursor& lhs, const PhraseCursor& rhs) {
+        return lhs.cost() < rhs.cost();
+    });
+
+    // Leapfrog join: each cursor in turn jumps to the current target; whenever a cursor
+    // lands beyond it, that review becomes the new target.  A review is emitted once
+    // every cursor agrees on it.
+    unsigned int target = firstReview;
+    size_t agreeing = 0;
+    size_t i = 0;
+    while (true) {
+        PhraseCursor& phrase = phrases[i];
+        if (!phrase.seekReview(target) || phrase.reviewIndex() > lastReview) break;
+        if (phrase.reviewIndex() != target) {
+            target = phrase.reviewIndex();
+            agreeing = 0;
+        }
+        if (++agreeing == phrases.size()) {
+            reviewIndexes.push_back(target);
+            if (target == lastReview) break;
+            target++;
+            agreeing = 0;
+        }
+        i = (i + 1) % phrases.size();
+    }
+    QUERY_COUNT(candidates, reviewIndexes.size() - initialSize);
+}
@@ -0,0 +1,214 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <vector>
+#include <memory>
+#include "query_stats.h"
+
+/**
+ * Every posting in the keyword index is a pair of unsigned ints: the review index,
+ * followed by the review portion (high byte) and the word offset within that
+ * portion (low 24 bits).  Postings are stored in ascending (reviewIndex, portion,
+ * offset) order, so packing the pair into one 64-bit key gives a value that sorts
+ * exactly the same way, and "the next word in the same portion" is just key + 1.
+ */
+static const uint64_t kPostingOffsetMask = 0x00FFFFFF;
+
+inline uint64_t postingKey(unsigned int reviewIndex, unsigned int portionAndOffset) {
+    return ((uint64_t) reviewIndex << 32) | portionAndOffset;
+}
+
+inline unsigned int postingKeyReviewIndex(uint64_t key) { return (unsigned int) (key >> 32); }
+
+/**
+ * Struct: SkipEntry
+ * -----------------
+ * One skip pointer from the optional skip index: the review index of the first
+ * posting in a block, and the byte offset of that posting within the keyword index.
+ */
+struct SkipEntry {
+    unsigned int firstReviewIndex;
+    unsigned int byteOffset;
+};
+
+/**
+ * Compressed posting lists are cut into blocks of kCompressedBlockSize postings.  Each
+ * block is described by a SkipEntry (its first review index and the byte offset of its
+ * encoded data) and is decoded as a unit into an array of keys.  Within a block, every
+ * posting is stored as LEB128 varints, delta-encoded against the previous posting:
+ *
+ *     same review and portion:  (offset delta << 1)
+ *     otherwise:                (review delta << 1) | 1, then (offset << 8) | portion
+ *
+ * The first posting of a block is delta-encoded against the block's firstReviewIndex.
+ */
+static const unsigned int kCompressedBlockSize = 128;
+
+/**
+ * Function: encodePostingBlock
+ * ----------------------------
+ * Appends the encoding of count raw (reviewIndex, portion|offset) postings to out.
+ */
+void encodePostingBlock(const unsigned int *postings, unsigned int count, std::vector<unsigned char>& out);
+
+/**
+ * Function: decodePostingBlock
+ * ----------------------------
+ * Decodes count postings starting at data into keys, which must have room for count keys.
+ * Returns the address just past the block's encoding.
+ */
+const unsigned char *decodePostingBlock(const unsigned char *data, unsigned int firstReviewIndex, unsigned int count, uint64_t *keys);
+
+/**
+ * Class: PostingCursor
+ * --------------------
+ * A forward-only cursor over one keyword's posting block, read in place from the
+ * mmap'd keyword index.  No postings are copied; seeking gallops forward from the
+ * current position, so a sequence of increasing seeks costs O(log gap) each.  When
+ * skip pointers are attached, a seek first leaps over whole blocks using the compact
+ * skip table, so long lists are only touched near the postings actually needed.
+ *
+ * A cursor over a compressed list (see compressed) decodes one block at a time into
+ * a buffer of its own, using the block table to skip blocks it doesn't need.  Cursors
+ * over plain lists carry no buffer.
+ */
+class PostingCursor {
+    public:
+        PostingCursor(const unsigned int *postings, unsigned int numPostings) :
+            postings(postings), numPostings(numPostings), position(0),
+            skips(nullptr), numSkips(0), skipBase(nullptr), currentSkip(0), isCompressed(false) {}
+
+        /**
+         * Static Method: compressed
+         * -------------------------
+         * Returns a cursor over a compressed list of numPostings postings, whose block table
+         * (with byte offsets relative to base) is blocks.
+         */
+        static PostingCursor compressed(const SkipEntry *blocks, unsigned int numPostings, const char *base);
+
+        /**
+         * Method: attachSkips
+         * -------------------
+         * Lets seek leap whole blocks using the skip pointers for this list.  skipBase is
+         * the address the skip entries' byte offsets are relative to.
+         */
+        void attachSkips(const SkipEntry *skips, unsigned int numSkips, const char *skipBase);
+
+        bool done() const { return position >= numPostings; }
+        unsigned int size() const { return numPostings; }
+        uint64_t key() const { return keyAt(position); }
+        unsigned int reviewIndex() const { return postingKeyReviewIndex(keyAt(position)); }
+        void next() {
+            position++;
+            QUERY_COUNT(postingsScanned, 1);
+        }
+
+        /**
+         * Method: seek
+         * ------------
+         * Advances to the first posting whose key is >= target.  Never moves backwards.
+         */
+        void seek(uint64_t target);
+
+    private:
+        const unsigned int *postings;
+        unsigned int numPostings;
+        unsigned int position;
+
+        const SkipEntry *skips;
+        unsigned int numSkips;
+        const char *skipBase;
+        unsigned int currentSkip;
+
+        /**
+         * A compressed cursor's most recently decoded block.  The keys are only allocated
+         * for compressed cursors, and a copy of a cursor gets an empty buffer of its own,
+         * so copies handed to different threads never share one.
+         */
+        struct DecodedBlock {
+            unsigned int block;
+            unsigned int count;
+            std::unique_ptr<uint64_t[]> keys;
+
+            DecodedBlock() : block(UINT_MAX), count(0) {}
+            DecodedBlock(const DecodedBlock& other) :
+                block(UINT_MAX), count(0), keys(other.keys ? new uint64_t[kCompressedBlockSize] : nullptr) {}
+            DecodedBlock(DecodedBlock&& other) = default;
+            DecodedBlock& operator=(DecodedBlock other) {
+                block = other.block;
+                count = other.count;
+                keys = std::move(other.keys);
+                return *this;
+            }
+        };
+
+        bool isCompressed;
+        mutable DecodedBlock decoded;
+
+        void seekForward(uint64_t target);
+        void leapToReview(unsigned int reviewIndex);
+        void seekCompressed(uint64_t target);
+        const uint64_t *decodeBlock(unsigned int block) const;
+        uint64_t keyAt(unsigned int i) const {
+            QUERY_COUNT(postingsRead, 1);
+            if (isCompressed) return decodeBlock(i / kCompressedBlockSize)[i % kCompressedBlockSize];
+            QUERY_COUNT(bytesTouched, 2 * sizeof(unsigned int));
+            return postingKey(postings[2 * i], postings[2 * i + 1]);
+        }
+};
+
+/**
+ * Class: PhraseCursor
+ * -------------------
+ * Enumerates, in ascending order, the reviews containing a phrase (one or more words
+ * that must appear at consecutive offsets of the same review portion).  The word
+ * cursors are merged positionally: a candidate phrase start s matches when word i
+ * has a posting at key s + i for every i.
+ */
+class PhraseCursor {
+    public:
+        PhraseCursor() : current(0), positioned(false), exhausted(false) {}
+
+        /** Appends the next word of the phrase. Words must be added in phrase order. */
+        void addWord(const PostingCursor& word) { words.push_back(word); }
+
+        /**
+         * Method: seekReview
+         * ------------------
+         * Advances to the first review with index >= reviewIndex that contains the phrase.
+         * Returns false once no such review exists.
+         */
+        bool seekReview(unsigned int reviewIndex);
+
+        unsigned int reviewIndex() const { return current; }
+
+        /**
+         * Method: occurrences
+         * -------------------
+         * Counts the times the phrase occurs in the current review (the one the last
+         * successful seekReview landed on).  This consumes the review's postings, so it may
+         * be called at most once per review, and only before seeking past it.
+         */
+        unsigned int occurrences();
+
+        /** An upper bound on the number of matching reviews: the shortest word's posting count. */
+        size_t cost() const;
+
+    private:
+        std::vector<PostingCursor> words;
+        unsigned int current;
+        bool positioned;
+        bool exhausted;
+};
+
+/**
+ * Function: intersectPhrases
+ * --------------------------
+ * Appends to reviewIndexes, in ascending order, every review in [firstReview, lastReview]
+ * matched by all of the phrases.  Cursors are leapfrogged cheapest-first, so the rarest
+ * phrase drives seeks into the more common ones.  Restricting the range lets several
+ * threads, each with its own copies of the cursors, split one long intersection.
+ */
+void intersectPhrases(std::vector<PhraseCursor>& phrases, std::vector<unsigned int>& reviewIndexes,
+        unsigned int firstReview = 0, unsigned int lastReview = UINT_MAX);
@@ -0,0 +1,151 @@
+/**
+ * File: posting_list_test.cc
+ * --------------------------
+ * Round-trips posting lists through the compressed block encoding of posting_list.h and
+ * checks that compressed cursors read and seek exactly like cursors over the plain lists.
+ * The lists are built to land on the awkward cases: lengths on either side of a block
+ * boundary, reviews whose postings spill from one block into the next, portion changes
+ * within a review, and the largest review indexes and offsets the format allows.
+ *
+ *    > ./posting_list_test
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <climits>
+#include "posting_list.h"
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool condition, const string& what) {
+    if (condition) return;
+    cout << "FAILED: " << what << endl;
+    failures++;
+}
+
+/**
+ * Builds a list of numPostings raw (reviewIndex, portion|offset) pairs in ascending order.
+ * Every review gets a run of postings that walks through all three portions, so portion
+ * changes and same-review deltas both show up within blocks and across their boundaries.
+ */
+static vector<unsigned int> makePostings(unsigned int numPostings, unsigned int firstReview,
+        unsigned int maxReviewGap, mt19937& random) {
+    vector<unsigned int> postings;
+    unsigned int review = firstReview;
+    while (postings.size() / 2 < numPostings) {
+        unsigned int perReview = 1 + random() % 6;
+        unsigned int portion = 0, offset = random() % 4;
+        for (unsigned int i = 0; i < perReview && postings.size() / 2 < numPostings; i++) {
+            postings.push_back(review);
+            postings.push_back((portion << 24) | offset);
+            if (random() % 3 == 0 && portion < 2) {
+                portion++;
+                offset = random() % 4;
+            } else {
+                offset += 1 + random() % 5;
+            }
+        }
+        review += 1 + random() % maxReviewGap;
+    }
+    return postings;
+}
+
+static vector<uint64_t> keysOf(const vector<unsigned int>& postings) {
+    vector<uint64_t> keys;
+    for (size_t i = 0; i < postings.size(); i += 2) keys.push_back(postingKey(postings[i], postings[i + 1]));
+    return keys;
+}
+
+/**
+ * Encodes postings block by block, as amazon::writeCompressedIndex does, into data, with
+ * one SkipEntry per block whose byte offset is relative to data's start.
+ */
+static void compressList(const vector<unsigned int>& postings, vector<unsigned char>& data, vector<SkipEntry>& blocks) {
+    const unsigned int numPostings = postings.size() / 2;
+    for (unsigned int first = 0; first < numPostings; first += kCompressedBlockSize) {
+        SkipEntry block;
+        block.firstReviewIndex = postings[2 * first];
+        block.byteOffset = data.size();
+        blocks.push_back(block);
+        encodePostingBlock(postings.data() + 2 * first, min(kCompressedBlockSize, numPostings - first), data);
+    }
+}
+
+static void testRoundTrip(const string& name, const vector<unsigned int>& postings) {
+    const vector<uint64_t> expected = keysOf(postings);
+    vector<unsigned char> data;
+    vector<SkipEntry> blocks;
+    compressList(postings, data, blocks);
+
+    // Each block decodes on its own, and ends exactly where the next one starts
+    for (size_t b = 0; b < blocks.size(); b++) {
+        const unsigned int first = b * kCompressedBlockSize;
+        const unsigned int count = min<size_t>(kCompressedBlockSize, expected.size() - first);
+        uint64_t keys[kCompressedBlockSize];
+        const unsigned char *end = decodePostingBlock(data.data() + blocks[b].byteOffset, blocks[b].firstReviewIndex,
+            count, keys);
+        const size_t next = b + 1 < blocks.size() ? blocks[b + 1].byteOffset : data.size();
+        check((size_t) (end - data.data()) == next, name + ": block " + to_string(b) + " ends where the next starts");
+        check(equal(keys, keys + count, expected.begin() + first), name + ": block " + to_string(b) + " decodes");
+    }
+
+    // A compressed cursor reads the whole list back in order
+    PostingCursor cursor = PostingCursor::compressed(blocks.data(), expected.size(), (const char *) data.data());
+    vector<uint64_t> read;
+    for (; !cursor.done(); cursor.next()) read.push_back(cursor.key());
+    check(read == expected, name + ": compressed cursor reads every posting");
+
+    // Increasing seeks, on copies made partway through, land where lower_bound does
+    mt19937 random(expected.size());
+    PostingCursor compressed = PostingCursor::compressed(blocks.data(), expected.size(), (const char *) data.data());
+    PostingCursor plain(postings.data(), expected.size());
+    uniform_int_distribution<uint64_t> step(1, (expected.back() - expected.front()) / 8 + 1);
+    uint64_t target = expected.front() > 0 ? expected.front() - 1 : 0;
+    while (true) {
+        uint64_t gap = step(random);
+        target = gap > expected.back() - target ? expected.back() + 1 : target + gap;
+        const size_t position = lower_bound(expected.begin(), expected.end(), target) - expected.begin();
+        PostingCursor copy = compressed;
+        compressed.seek(target);
+        copy.seek(target);
+        plain.seek(target);
+        if (position == expected.size()) {
+            check(compressed.done() && copy.done() && plain.done(), name + ": seeks past the end finish the cursors");
+            break;
+        }
+        check(!compressed.done() && compressed.key() == expected[position], name + ": compressed seek");
+        check(!copy.done() && copy.key() == expected[position], name + ": seek on a copied cursor");
+        check(!plain.done() && plain.key() == expected[position], name + ": plain seek");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    mt19937 random(110);
+    const unsigned int lengths[] = {1, 2, kCompressedBlockSize - 1, kCompressedBlockSize, kCompressedBlockSize + 1,
+        2 * kCompressedBlockSize, 2 * kCompressedBlockSize + 1, 5000};
+    for (unsigned int length : lengths) {
+        testRoundTrip(to_string(length) + " postings", makePostings(length, 0, 3, random));
+        testRoundTrip(to_string(length) + " sparse postings", makePostings(length, 1000, 1 << 20, random));
+    }
+
+    // One review whose postings span several blocks, crossing portions along the way
+    vector<unsigned int> longReview;
+    for (unsigned int portion = 0; portion < 3; portion++) {
+        for (unsigned int offset = 0; offset < kCompressedBlockSize; offset++) {
+            longReview.push_back(7);
+            longReview.push_back((portion << 24) | offset);
+        }
+    }
+    testRoundTrip("one long review", longReview);
+
+    // The extremes of the format: the largest review indexes and word offsets
+    vector<unsigned int> extremes = {0, 0, 0, 2u << 24, UINT_MAX - 1, (unsigned int) kPostingOffsetMask,
+        UINT_MAX, 0, UINT_MAX, (2u << 24) | (unsigned int) kPostingOffsetMask};
+    testRoundTrip("extreme values", extremes);
+
+    if (failures == 0) cout << "All posting list tests passed." << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include "query_protocol.h"
+
+using namespace std;
+
+static const size_t kLengthBytes = sizeof(uint32_t);
+static const size_t kResponseHeaderBytes = 2 + 4 * sizeof(uint32_t);
+
+template <typename T>
+static void appendValue(string& out, T value) {
+    out.append((const char *) &value, sizeof(value));
+}
+
+static void appendString(string& out, string_view text) {
+    appendValue<uint32_t>(out, text.size());
+    out.append(text.data(), text.size());
+}
+
+// Reads values off the front of a payload, failing (and staying failed) on a short read
+namespace {
+struct PayloadReader {
+    const string& payload;
+    size_t position;
+    bool ok;
+
+    PayloadReader(const string& payload) : payload(payload), position(0), ok(true) {}
+
+    template <typename T>
+    T read() {
+        T value = T();
+        if (!ok || payload.size() - position < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, payload.data() + position, sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+
+    string readString() {
+        uint32_t length = read<uint32_t>();
+        if (!ok || payload.size() - position < length) {
+            ok = false;
+            return "";
+        }
+        position += length;
+        return payload.substr(position - length, length);
+    }
+};
+}
+
+static void setFrameLength(string& frame) {
+    uint32_t length = frame.size() - kLengthBytes;
+    memcpy(&frame[0], &length, sizeof(length));
+}
+
+void encodeQueryRequest(const QueryRequest& request, string& frame) {
+    frame.assign(kLengthBytes, '\0');
+    appendValue<uint8_t>(frame, request.mode);
+    appendValue<uint8_t>(frame, request.primaryKey);
+    appendValue<uint8_t>(frame, request.reversed);
+    appendValue<uint32_t>(frame, request.maxReviews);
+    frame += request.query;
+    setFrameLength(frame);
+}
+
+bool decodeQueryRequest(const string& payload, QueryRequest& request) {
+    PayloadReader reader(payload);
+    request.mode = reader.read<uint8_t>();
+    request.primaryKey = reader.read<uint8_t>();
+    request.reversed = reader.read<uint8_t>() != 0;
+    request.maxReviews = reader.read<uint32_t>();
+    if (!reader.ok) return false;
+    request.query = payload.substr(reader.position);
+    return true;
+}
+
+void beginQueryResponse(string& frame) {
+    frame.assign(kLengthBytes + kResponseHeaderBytes, '\0');
+}
+
+void appendResponseReview(const ReviewView& review, double score, string& frame) {
+    appendValue<uint32_t>(frame, review.index);
+    appendValue<double>(frame, score);
+    appendValue<uint8_t>(frame, review.star_rating());
+    appendValue<int16_t>(frame, review.review_year());
+    appendValue<uint8_t>(frame, review.review_month());
+    appendValue<uint8_t>(frame, review.review_day());
+    appendString(frame, review.product_title());
+    appendString(frame, review.product_category());
+    appendString(frame, review.review_headline());
+    appendString(frame, review.review_body());
+}
+
+void finishQueryResponse(const QueryResponseHeader& header, string& frame) {
+    string fields;
+    appendValue<uint8_t>(fields, header.status);
+    appendValue<uint8_t>(fields, header.more);
+    appendValue<uint32_t>(fields, header.totalMatches);
+    appendValue<uint32_t>(fields, header.totalReviews);
+    appendValue<uint32_t>(fields, header.serverMicros);
+    appendValue<uint32_t>(fields, header.count);
+    frame.replace(kLengthBytes, kResponseHeaderBytes, fields);
+    setFrameLength(frame);
+}
+
+bool decodeQueryResponse(const string& payload, QueryResponse& response) {
+    PayloadReader reader(payload);
+    QueryResponseHeader& header = response.header;
+    header.status = reader.read<uint8_t>();
+    header.more = reader.read<uint8_t>() != 0;
+    header.totalMatches = reader.read<uint32_t>();
+    header.totalReviews = reader.read<uint32_t>();
+    header.serverMicros = reader.read<uint32_t>();
+    header.count = reader.read<uint32_t>();
+    response.reviews.clear();
+    response.scores.clear();
+    for (uint32_t i = 0; i < header.count && reader.ok; i++) {
+        Review review;
+        review.index = reader.read<uint32_t>();
+        response.scores.push_back(reader.read<double>());
+        review.star_rating = reader.read<uint8_t>();
+        review.review_year = reader.read<int16_t>();
+        review.review_month = reader.read<uint8_t>();
+        review.review_day = reader.read<uint8_t>();
+        review.product_title = reader.readString();
+        review.product_category = reader.readString();
+        review.review_headline = reader.readString();
+        review.review_body = reader.readString();
+        response.reviews.push_back(move(review));
+    }
+    return reader.ok && reader.position == payload.size();
+}
+
+bool readQueryResponse(int fd, QueryResponse& response) {
+    response.reviews.clear();
+    response.scores.clear();
+    QueryResponse part;
+    size_t count = 0;
+    do {
+        string payload;
+        if (!readFrame(fd, payload) || !decodeQueryResponse(payload, part)) return false;
+        count += part.reviews.size();
+        move(part.reviews.begin(), part.reviews.end(), back_inserter(response.reviews));
+        response.scores.insert(response.scores.end(), part.scores.begin(), part.scores.end());
+    } while (part.header.more);
+    response.header = part.header;
+    response.header.count = count;
+    return true;
+}
+
+static bool readFully(int fd, char *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t count = read(fd, buffer, length);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        buffer += count;
+        length -= count;
+    }
+    return true;
+}
+
+bool readFrame(int fd, string& payload, size_t maxBytes) {
+    uint32_t length;
+    if (!readFully(fd, (char *) &length, sizeof(length)) || length > maxBytes) return false;
+    payload.resize(length);
+    return readFully(fd, &payload[0], length);
+}
+
+bool writeFrame(int fd, const string& frame) {
+    const char *data = frame.data();
+    size_t remaining = frame.size();
+    while (remaining > 0) {
+        // MSG_NOSIGNAL: a client hanging up mid-response mustn't raise SIGPIPE
+        ssize_t count = send(fd, data, remaining, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        data += count;
+        remaining -= count;
+    }
+    return true;
+}
+
+static bool fillAddress(const string& path, struct sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+int createClientSocket(const string& path) {
+    struct sockaddr_un address;
+    if (!fillAddress(path, address)) return kSocketError;
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) return kSocketError;
+    if (connect(s, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(s);
+        return kSocketError;
+    }
+    return s;
+}
+
+int createServerSocket(const string& path) {
+    struct sockaddr_un address;
+    if (!fillAddress(path, address)) return kSocketError;
+
+    // Only a socket nobody is answering on may be replaced
+    int existing = createClientSocket(path);
+    if (existing != kSocketError) {
+        close(existing);
+        return kSocketError;
+    }
+    unlink(path.c_str());
+
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) return kSocketError;
+    if (bind(s, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(s, SOMAXCONN) != 0) {
+        close(s);
+        return kSocketError;
+    }
+    return s;
+}
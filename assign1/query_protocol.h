@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "amazon.h"
+
+/**
+ * The protocol amazon_server speaks over its Unix-domain socket.  Both directions carry
+ * frames: a 4-byte payload length followed by the payload, with every integer in host
+ * byte order (the socket is local, so both ends share one).  Every request is answered
+ * by one response, in order, and a connection may carry any number of them, so a client
+ * pays for connecting only once.
+ *
+ *     request:   u8 mode  u8 primaryKey  u8 reversed  u32 maxReviews  query...
+ *     response:  one or more frames, each
+ *                u8 status  u8 more  u32 totalMatches  u32 totalReviews  u32 serverMicros  u32 count
+ *                then count reviews, each
+ *                u32 index  f64 score  u8 starRating  i16 year  u8 month  u8 day
+ *                and the title, category, headline and body as u32 length + bytes
+ *
+ * mode and primaryKey take the values in search_options.h.  A ranked query returns its
+ * best maxReviews reviews with their scores; any other query returns the first maxReviews
+ * of its matches in primaryKey order, with scores of 0.  totalMatches counts every match.
+ *
+ * A response's reviews are split across frames of roughly kResponseFrameBytes, so no
+ * frame comes near kMaxFrameBytes however many reviews are asked for.  Every frame but
+ * the last has more set; the last one's status and header fields stand for the whole
+ * response, and a status other than RESPONSE_OK there means the reviews sent so far
+ * should be thrown away.
+ */
+static const char * const kDefaultSocketPath = "/tmp/amazon_search.sock";
+static const size_t kMaxFrameBytes = 256 << 20;
+static const size_t kResponseFrameBytes = 1 << 20;
+static const int kSocketError = -1;
+
+enum {RESPONSE_OK, RESPONSE_BAD_REQUEST, RESPONSE_TOO_LARGE};
+
+struct QueryRequest {
+    int mode;
+    int primaryKey;
+    bool reversed;
+    uint32_t maxReviews;
+    std::string query;
+};
+
+struct QueryResponseHeader {
+    int status;
+    uint32_t totalMatches;
+    uint32_t totalReviews;
+    uint32_t serverMicros;
+    uint32_t count;
+    bool more;
+};
+
+struct QueryResponse {
+    QueryResponseHeader header;
+    std::vector<Review> reviews;
+    std::vector<double> scores;
+};
+
+/**
+ * Function: encodeQueryRequest
+ * ----------------------------
+ * Replaces frame with the complete frame (length included) for request.
+ */
+void encodeQueryRequest(const QueryRequest& request, std::string& frame);
+
+/**
+ * Function: decodeQueryRequest
+ * ----------------------------
+ * Parses a request frame's payload.  Returns false if it's malformed.
+ */
+bool decodeQueryRequest(const std::string& payload, QueryRequest& request);
+
+/**
+ * Function: beginQueryResponse
+ * ----------------------------
+ * Starts a response frame in frame, leaving room for the header, which
+ * finishQueryResponse fills in once the reviews have been appended.
+ */
+void beginQueryResponse(std::string& frame);
+void appendResponseReview(const ReviewView& review, double score, std::string& frame);
+void finishQueryResponse(const QueryResponseHeader& header, std::string& frame);
+
+/**
+ * Function: decodeQueryResponse
+ * -----------------------------
+ * Parses a response frame's payload.  Returns false if it's malformed.
+ */
+bool decodeQueryResponse(const std::string& payload, QueryResponse& response);
+
+/**
+ * Function: readQueryResponse
+ * ---------------------------
+ * Reads every frame of one response from fd and gathers them into response, whose
+ * header is the last frame's with count covering all of the reviews.  Returns false if
+ * the connection failed or a frame was malformed.
+ */
+bool readQueryResponse(int fd, QueryResponse& response);
+
+/**
+ * Function: readFrame
+ * -------------------
+ * Reads one frame from fd into payload (without its length).  Returns false at end of
+ * file, on error, or if the frame claims to be longer than maxBytes.
+ */
+bool readFrame(int fd, std::string& payload, size_t maxBytes = kMaxFrameBytes);
+
+/**
+ * Function: writeFrame
+ * --------------------
+ * Writes a complete frame to the socket fd.  Returns false if the peer went away.
+ */
+bool writeFrame(int fd, const std::string& frame);
+
+/**
+ * Function: createServerSocket
+ * ----------------------------
+ * Creates a Unix-domain socket listening at path, replacing a stale socket file left
+ * behind by a server that's no longer running.  Returns kSocketError on failure,
+ * including when another server is still accepting connections at path.
+ */
+int createServerSocket(const std::string& path);
+
+/**
+ * Function: createClientSocket
+ * ----------------------------
+ * Connects to the server listening at path.  Returns kSocketError on failure.
+ */
+int createClientSocket(const std::string& path);
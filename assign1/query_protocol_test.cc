@@ -0,0 +1,227 @@
+/**
+ * File: query_protocol_test.cc
+ * ----------------------------
+ * Exercises the amazon_server protocol of query_protocol.h without a server: requests and
+ * responses are encoded, decoded, and read back through a socketpair, and then fed to the
+ * readers cut short at every byte, padded with trailing bytes, or claiming more than they
+ * hold (review counts, string lengths, and frame lengths past kMaxFrameBytes).  Every
+ * malformed input must be rejected rather than read past.
+ *
+ *    > ./query_protocol_test
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include "amazon.h"
+#include "amazon_writer.h"
+#include "query_protocol.h"
+#include "search_options.h"
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool condition, const string& what) {
+    if (condition) return;
+    cout << "FAILED: " << what << endl;
+    failures++;
+}
+
+static const size_t kLengthBytes = sizeof(uint32_t);
+
+static string payloadOf(const string& frame) {
+    return frame.substr(kLengthBytes);
+}
+
+static string frameOf(const string& payload) {
+    uint32_t length = payload.size();
+    return string((const char *) &length, sizeof(length)) + payload;
+}
+
+static void testRequests() {
+    QueryRequest request {RANKED_QUERY, STARS, true, 123456, "tv OR \"dead pixels\" -refurbished"};
+    string frame;
+    encodeQueryRequest(request, frame);
+    uint32_t length;
+    memcpy(&length, frame.data(), sizeof(length));
+    check(length == frame.size() - kLengthBytes, "request frame length covers its payload");
+
+    QueryRequest decoded;
+    check(decodeQueryRequest(payloadOf(frame), decoded), "request decodes");
+    check(decoded.mode == request.mode && decoded.primaryKey == request.primaryKey &&
+        decoded.reversed == request.reversed && decoded.maxReviews == request.maxReviews &&
+        decoded.query == request.query, "request round-trips");
+
+    // The query is whatever follows the fixed fields, so it may be empty or hold any bytes
+    for (const string& query : {string(), string("a\0b", 3)}) {
+        request.query = query;
+        encodeQueryRequest(request, frame);
+        check(decodeQueryRequest(payloadOf(frame), decoded) && decoded.query == query, "unusual query round-trips");
+    }
+    const size_t fixedBytes = payloadOf(frame).size() - request.query.size();
+    for (size_t size = 0; size < fixedBytes; size++) {
+        check(!decodeQueryRequest(payloadOf(frame).substr(0, size), decoded),
+            "request cut to " + to_string(size) + " bytes is rejected");
+    }
+}
+
+static void checkSameReview(const Review& review, const ReviewView& original, const string& what) {
+    check(review.index == original.index && review.star_rating == original.star_rating() &&
+        review.review_year == original.review_year() && review.review_month == original.review_month() &&
+        review.review_day == original.review_day() && review.product_title == original.product_title() &&
+        review.product_category == original.product_category() &&
+        review.review_headline == original.review_headline() && review.review_body == original.review_body(), what);
+}
+
+static string responseFrame(const vector<ReviewView>& reviews, bool more, int status = RESPONSE_OK) {
+    string frame;
+    beginQueryResponse(frame);
+    for (const ReviewView& review : reviews) appendResponseReview(review, review.index + 0.5, frame);
+    QueryResponseHeader header {status, 1000, 2000, 30, (uint32_t) reviews.size(), more};
+    finishQueryResponse(header, frame);
+    return frame;
+}
+
+static void testResponses(const vector<ReviewView>& reviews) {
+    const string payload = payloadOf(responseFrame(reviews, false));
+    QueryResponse response;
+    check(decodeQueryResponse(payload, response), "response decodes");
+    check(response.header.status == RESPONSE_OK && !response.header.more && response.header.totalMatches == 1000 &&
+        response.header.totalReviews == 2000 && response.header.serverMicros == 30 &&
+        response.header.count == reviews.size(), "response header round-trips");
+    check(response.reviews.size() == reviews.size() && response.scores.size() == reviews.size(),
+        "every review comes back");
+    for (size_t i = 0; i < reviews.size() && i < response.reviews.size(); i++) {
+        checkSameReview(response.reviews[i], reviews[i], "review " + to_string(i) + " round-trips");
+        check(response.scores[i] == reviews[i].index + 0.5, "score " + to_string(i) + " round-trips");
+    }
+
+    // Truncated at every byte, or with bytes to spare, the payload no longer adds up
+    for (size_t size = 0; size < payload.size(); size++) {
+        check(!decodeQueryResponse(payload.substr(0, size), response),
+            "response cut to " + to_string(size) + " bytes is rejected");
+    }
+    check(!decodeQueryResponse(payload + '\0', response), "response with a trailing byte is rejected");
+
+    // Header fields claiming more than the payload holds
+    string lying = payload;
+    const uint32_t manyReviews = UINT32_MAX;
+    memcpy(&lying[2 + 3 * sizeof(uint32_t)], &manyReviews, sizeof(manyReviews));
+    check(!decodeQueryResponse(lying, response), "response claiming 2^32 - 1 reviews is rejected");
+    lying = payload;
+    const size_t titleLength = 2 + 4 * sizeof(uint32_t) + sizeof(uint32_t) + sizeof(double) + 1 + 2 + 1 + 1;
+    const uint32_t hugeString = UINT32_MAX;
+    memcpy(&lying[titleLength], &hugeString, sizeof(hugeString));
+    check(!decodeQueryResponse(lying, response), "review title claiming 4 GB is rejected");
+}
+
+static void testFrames(const vector<ReviewView>& reviews) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        check(false, "socketpair");
+        return;
+    }
+    string payload;
+    check(writeFrame(fds[0], frameOf("hello")) && readFrame(fds[1], payload) && payload == "hello", "frame round-trips");
+    check(writeFrame(fds[0], frameOf("")) && readFrame(fds[1], payload) && payload == "", "empty frame round-trips");
+    check(writeFrame(fds[0], frameOf("12345")) && readFrame(fds[1], payload, 5) && payload == "12345",
+        "frame of exactly maxBytes is read");
+    check(writeFrame(fds[0], frameOf("123456")) && !readFrame(fds[1], payload, 5), "frame over maxBytes is rejected");
+    close(fds[0]);
+    close(fds[1]);
+
+    // A frame longer than kMaxFrameBytes is refused on its length alone, before any payload
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    const uint32_t oversized = kMaxFrameBytes + 1;
+    check(writeFrame(fds[0], string((const char *) &oversized, sizeof(oversized))) && !readFrame(fds[1], payload),
+        "frame over kMaxFrameBytes is rejected");
+    close(fds[0]);
+    close(fds[1]);
+
+    // A peer that hangs up partway through a frame's length or payload
+    for (const string& partial : {string("\x10\0", 2), frameOf("complete").substr(0, 7)}) {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        writeFrame(fds[0], partial);
+        close(fds[0]);
+        check(!readFrame(fds[1], payload), "frame cut short at " + to_string(partial.size()) + " bytes is rejected");
+        close(fds[1]);
+    }
+
+    // A response split across frames is gathered into one, with the last frame's header
+    vector<ReviewView> first(reviews.begin(), reviews.begin() + 2), second(reviews.begin() + 2, reviews.end());
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    writeFrame(fds[0], responseFrame(first, true));
+    writeFrame(fds[0], responseFrame(vector<ReviewView>(), true));
+    writeFrame(fds[0], responseFrame(second, false));
+    QueryResponse response;
+    check(readQueryResponse(fds[1], response), "multi-frame response is read");
+    check(response.header.count == reviews.size() && response.reviews.size() == reviews.size() &&
+        response.scores.size() == reviews.size() && !response.header.more, "multi-frame response gathers every review");
+    for (size_t i = 0; i < reviews.size() && i < response.reviews.size(); i++) {
+        checkSameReview(response.reviews[i], reviews[i], "review " + to_string(i) + " of a multi-frame response");
+    }
+
+    // A failure reported in the last frame, after reviews were sent, comes through as such
+    writeFrame(fds[0], responseFrame(first, true));
+    writeFrame(fds[0], responseFrame(vector<ReviewView>(), false, RESPONSE_TOO_LARGE));
+    check(readQueryResponse(fds[1], response) && response.header.status == RESPONSE_TOO_LARGE,
+        "status of the last frame stands for the response");
+
+    // A malformed or missing frame partway through fails the whole response
+    string malformed = responseFrame(second, false);
+    malformed.pop_back();
+    uint32_t length = malformed.size() - kLengthBytes;
+    memcpy(&malformed[0], &length, sizeof(length));
+    writeFrame(fds[0], responseFrame(first, true));
+    writeFrame(fds[0], malformed);
+    check(!readQueryResponse(fds[1], response), "response with a malformed last frame is rejected");
+    writeFrame(fds[0], responseFrame(first, true));
+    close(fds[0]);
+    check(!readQueryResponse(fds[1], response), "response whose peer hangs up after a frame is rejected");
+    close(fds[1]);
+}
+
+int main(int argc, char *argv[]) {
+    testRequests();
+
+    char scratch[] = "/tmp/query_protocol_test.XXXXXX";
+    if (mkdtemp(scratch) == nullptr) {
+        cerr << "Could not create a scratch directory" << endl;
+        return 1;
+    }
+    const string directory = scratch;
+    AmazonWriter writer(directory, "db");
+    for (unsigned int i = 0; i < 5; i++) {
+        Review review;
+        review.product_title = "title " + to_string(i);
+        review.product_category = i % 2 == 0 ? "Electronics" : "";
+        review.star_rating = 1 + i;
+        review.review_headline = string(i * 100, 'h');
+        review.review_body = "body with a tab\tand a newline\n " + to_string(i);
+        review.review_year = 1999 + i;
+        review.review_month = 12 - i;
+        review.review_day = 28 - i;
+        writer.addReview(review);
+    }
+    check(writer.finish(), "database written");
+    {
+        amazon db(directory, "db");
+        vector<ReviewView> reviews(db.totalReviews());
+        for (unsigned int i = 0; i < reviews.size(); i++) db.getReview(i, reviews[i]);
+        check(db.good() && reviews.size() == 5, "database opens");
+        if (reviews.size() == 5) {
+            testResponses(reviews);
+            testFrames(reviews);
+        }
+    }
+    unlink((directory + "/db.bin").c_str());
+    unlink((directory + "/db_keyword_index.bin").c_str());
+    rmdir(scratch);
+
+    if (failures == 0) cout << "All query protocol tests passed." << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+#include <iomanip>
+#include <algorithm>
+#include "query_stats.h"
+
+using namespace std;
+
+thread_local QueryStage QueryStageTimer::active = kNumQueryStages;
+thread_local uint64_t QueryStageTimer::started = 0;
+
+const char *queryStageName(QueryStage stage) {
+    static const char *const kNames[kNumQueryStages] = {"parse", "lookup", "cursors", "match", "cache", "fetch"};
+    return stage < kNumQueryStages ? kNames[stage] : "?";
+}
+
+void addQueryCounters(QueryStats& into, const QueryStats& from) {
+    into.keywordsFound += from.keywordsFound;
+    into.keywordsMissing += from.keywordsMissing;
+    into.listsOpened += from.listsOpened;
+    into.seeks += from.seeks;
+    into.postingsScanned += from.postingsScanned;
+    into.postingsRead += from.postingsRead;
+    into.blocksDecoded += from.blocksDecoded;
+    into.candidates += from.candidates;
+    into.sortKeysRead += from.sortKeysRead;
+    into.reviewsFetched += from.reviewsFetched;
+    into.bytesTouched += from.bytesTouched;
+}
+
+void printQueryStats(ostream& os, const QueryStats& stats) {
+    if (!stats.enabled) {
+        os << "Trace: query statistics weren't compiled in (build with QUERY_STATS=1)" << endl;
+        return;
+    }
+
+    ios::fmtflags flags = os.flags();
+    os << fixed << setprecision(1) << "Trace: search " << stats.totalNanos / 1000.0 << " us;";
+    for (int stage = 0; stage < kNumQueryStages; stage++) {
+        os << " " << queryStageName((QueryStage) stage) << " " << stats.stageNanos[stage] / 1000.0;
+    }
+    os << " us" << endl;
+    os.flags(flags);
+
+    os << "Trace: " << stats.keywordsFound << " keywords found, " << stats.keywordsMissing << " missing; "
+        << stats.listsOpened << " lists opened";
+    const size_t traced = min(stats.listsOpened, kMaxTracedWords);
+    for (size_t i = 0; i < traced; i++) os << (i == 0 ? " of " : ", ") << stats.wordPostings[i];
+    if (traced < stats.listsOpened) os << ", ...";
+    if (traced > 0) os << " postings";
+    os << endl;
+    os << "Trace: " << stats.seeks << " seeks, " << stats.postingsScanned << " postings scanned, "
+        << stats.postingsRead << " read, " << stats.blocksDecoded << " blocks decoded; "
+        << stats.candidates << " candidates, " << stats.matches << " matches" << endl;
+    os << "Trace: " << stats.sortKeysRead << " sort keys read, " << stats.reviewsFetched << " reviews fetched; "
+        << stats.bytesTouched << " bytes touched; page faults " << stats.minorFaults << " minor, "
+        << stats.majorFaults << " major" << endl;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <ostream>
+
+/**
+ * Per-query instrumentation.  Every thread has one QueryStats record; each search entry
+ * point (searchKeywordIndex, searchBoolean, searchRanked, searchBatch) clears it, and the
+ * search, along with any sorting and fetching of results the same thread does before its
+ * next search, adds to it.  amazon::lastQueryStats returns a copy.
+ *
+ * The instrumentation only exists when the library is built with AMAZON_QUERY_STATS
+ * defined (see QUERY_STATS in the Makefile).  Otherwise the macros below compile to
+ * nothing and lastQueryStats reports enabled == false.
+ *
+ * Stage times are exclusive: a stage that starts inside another (a keyword lookup while
+ * building cursors, say) pauses the outer one, so the stages of a search add up to at
+ * most its total.  Fetching done after the search returns is charged on top of it.
+ */
+enum QueryStage {
+    kParseStage,    // turning the query string into terms
+    kLookupStage,   // finding keywords in the dictionary
+    kCursorStage,   // setting up posting list cursors
+    kMatchStage,    // walking, intersecting, merging and scoring posting lists
+    kCacheStage,    // result cache lookups and inserts
+    kFetchStage,    // sorting matches and reading their reviews
+    kNumQueryStages
+};
+
+static const size_t kMaxTracedWords = 16;
+
+struct QueryStats {
+    bool enabled;
+    uint64_t totalNanos;                    // wall time of the search call itself
+    uint64_t stageNanos[kNumQueryStages];
+
+    size_t keywordsFound;
+    size_t keywordsMissing;
+    size_t listsOpened;                     // posting list cursors created
+    size_t wordPostings[kMaxTracedWords];   // lengths of the first lists opened, in order
+    size_t seeks;                           // cursor seeks that had to move
+    size_t postingsScanned;                 // postings cursors moved past, whether read or leapt over
+    size_t postingsRead;                    // posting keys actually examined
+    size_t blocksDecoded;                   // compressed posting blocks decoded
+    size_t candidates;                      // reviews in intermediate result lists
+    size_t matches;                         // reviews the search returned
+    size_t sortKeysRead;
+    size_t reviewsFetched;
+    size_t bytesTouched;                    // posting, skip, sort key and record bytes read
+    long minorFaults;                       // page faults during the search (searchKeywordIndex only)
+    long majorFaults;
+};
+
+const char *queryStageName(QueryStage stage);
+
+/**
+ * Function: threadQueryStats
+ * --------------------------
+ * The calling thread's record.  QueryStats is a plain aggregate, so the thread-local is
+ * constant-initialized and access costs no more than a global's.
+ */
+inline QueryStats& threadQueryStats() {
+    static thread_local QueryStats stats;
+    return stats;
+}
+
+/**
+ * Function: addQueryCounters
+ * --------------------------
+ * Adds from's counters (but not its times, which overlap the caller's) into into; used to
+ * fold in the work of helper threads.
+ */
+void addQueryCounters(QueryStats& into, const QueryStats& from);
+
+/**
+ * Function: printQueryStats
+ * -------------------------
+ * Prints a human-readable trace of stats, a few lines each starting with "Trace:".
+ */
+void printQueryStats(std::ostream& os, const QueryStats& stats);
+
+/**
+ * Class: QueryStageTimer
+ * ----------------------
+ * Charges the time between its construction and destruction to a stage, pausing whatever
+ * stage was running when it was constructed.
+ */
+class QueryStageTimer {
+    public:
+        QueryStageTimer(QueryStage stage) : outer(active) {
+            uint64_t now = clockNanos();
+            if (outer != kNumQueryStages) threadQueryStats().stageNanos[outer] += now - started;
+            active = stage;
+            started = now;
+        }
+
+        ~QueryStageTimer() {
+            uint64_t now = clockNanos();
+            threadQueryStats().stageNanos[active] += now - started;
+            active = outer;
+            started = now;
+        }
+
+        static uint64_t clockNanos() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    private:
+        QueryStage outer;
+        static thread_local QueryStage active;
+        static thread_local uint64_t started;
+};
+
+/**
+ * Class: QueryStatsScope
+ * ----------------------
+ * Clears the thread's record when a search begins and records its total time when it ends.
+ */
+class QueryStatsScope {
+    public:
+        QueryStatsScope() : started(QueryStageTimer::clockNanos()) {
+            threadQueryStats() = QueryStats();
+            threadQueryStats().enabled = true;
+        }
+        ~QueryStatsScope() { threadQueryStats().totalNanos = QueryStageTimer::clockNanos() - started; }
+
+    private:
+        uint64_t started;
+};
+
+#ifdef AMAZON_QUERY_STATS
+#define QUERY_STATS_SCOPE() QueryStatsScope queryStatsScope
+#define QUERY_STAGE(stage) QueryStageTimer queryStageTimer(stage)
+#define QUERY_COUNT(field, amount) (threadQueryStats().field += (amount))
+#define QUERY_STATS_ENABLED 1
+#else
+#define QUERY_STATS_SCOPE() ((void) 0)
+#define QUERY_STAGE(stage) ((void) 0)
+#define QUERY_COUNT(field, amount) ((void) sizeof(amount))
+#define QUERY_STATS_ENABLED 0
+#endif
@@ -0,0 +1,54 @@
+#include "result_cache.h"
+
+using namespace std;
+
+// Rough cost of an entry beyond its key and values: list node, hash node, shared_ptr control block
+static const size_t kEntryOverheadBytes = 128;
+
+ResultCache::Value ResultCache::lookup(const string& key) {
+    lock_guard<mutex> lg(lock);
+    auto found = index.find(key);
+    if (found == index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->value;
+}
+
+void ResultCache::insert(const string& key, const vector<unsigned int>& value) {
+    const size_t entryBytes = 2 * key.size() + value.size() * sizeof(unsigned int) + kEntryOverheadBytes;
+    if (entryBytes > maxBytes) return;
+    Value shared = make_shared<const vector<unsigned int>>(value);
+
+    lock_guard<mutex> lg(lock);
+    auto found = index.find(key);
+    if (found != index.end()) {
+        // Another thread computed the same result first
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+    while (bytes + entryBytes > maxBytes) {
+        const Entry& victim = entries.back();
+        bytes -= victim.bytes;
+        index.erase(victim.key);
+        entries.pop_back();
+        evictions++;
+    }
+    entries.push_front(Entry {key, shared, entryBytes});
+    index[key] = entries.begin();
+    bytes += entryBytes;
+}
+
+void ResultCache::clear() {
+    lock_guard<mutex> lg(lock);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+ResultCacheStats ResultCache::stats() const {
+    lock_guard<mutex> lg(lock);
+    return ResultCacheStats {hits, misses, evictions, entries.size(), bytes};
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Struct: ResultCacheStats
+ * ------------------------
+ * A snapshot of a ResultCache's counters.
+ */
+struct ResultCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+};
+
+/**
+ * Class: ResultCache
+ * ------------------
+ * A thread-safe least-recently-used cache from strings to lists of review indexes,
+ * bounded by the bytes its entries occupy (keys, values and bookkeeping).  Values are
+ * handed out as shared, immutable lists, so a reader keeps its list even if the entry
+ * is evicted by another thread while it is being used.
+ */
+class ResultCache {
+    public:
+        typedef std::shared_ptr<const std::vector<unsigned int>> Value;
+
+        ResultCache(size_t maxBytes) : maxBytes(maxBytes), bytes(0), hits(0), misses(0), evictions(0) {}
+
+        /**
+         * Method: lookup
+         * --------------
+         * Returns the list cached under key, marking it most recently used, or nullptr
+         * (counted as a miss) if there is none.
+         */
+        Value lookup(const std::string& key);
+
+        /**
+         * Method: insert
+         * --------------
+         * Caches value under key, evicting least recently used entries until it fits.  A
+         * value too large for the whole cache is not cached at all.
+         */
+        void insert(const std::string& key, const std::vector<unsigned int>& value);
+
+        /**
+         * Method: clear
+         * -------------
+         * Drops every entry.  The counters are kept.
+         */
+        void clear();
+
+        ResultCacheStats stats() const;
+
+    private:
+        struct Entry {
+            std::string key;
+            Value value;
+            size_t bytes;
+        };
+
+        const size_t maxBytes;
+        size_t bytes;
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+
+        // Most recently used first
+        std::list<Entry> entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        mutable std::mutex lock;
+
+        ResultCache(const ResultCache& original) = delete;
+        ResultCache& operator=(const ResultCache& rhs) = delete;
+};
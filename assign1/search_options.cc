@@ -0,0 +1,89 @@
+#include <tuple>
+#include "search_options.h"
+using namespace std;
+
+/**
+ * Function: compareTitles
+ * -----------------------
+ * Orders two reviews' product titles like comparing the strings would, returning a
+ * negative, zero or positive value.  The sort keys' title prefixes settle almost every
+ * comparison; only titles that share their first 8 bytes are fetched and compared in full.
+ */
+static int compareTitles(const amazon& db, const ReviewSortKey &lhs, const ReviewSortKey &rhs) {
+    if (lhs.title_prefix != rhs.title_prefix) return lhs.title_prefix < rhs.title_prefix ? -1 : 1;
+    const size_t kPrefixSize = sizeof(lhs.title_prefix);
+    if (lhs.title_size <= kPrefixSize && rhs.title_size <= kPrefixSize) {
+        return (int) lhs.title_size - (int) rhs.title_size;
+    }
+    ReviewView lhsReview, rhsReview;
+    db.getReview(lhs.index, lhsReview);
+    db.getReview(rhs.index, rhsReview);
+    return lhsReview.product_title().compare(rhsReview.product_title());
+}
+
+bool genericReviewCompare(const amazon& db, const ReviewSortKey &lhs, const ReviewSortKey &rhs,
+        int primaryKey, bool reversed) {
+    if (primaryKey == DATE) {
+        auto tLhs = make_tuple(lhs.date, lhs.body_size, lhs.headline_size, lhs.star_rating, lhs.title_size);
+        auto tRhs = make_tuple(rhs.date, rhs.body_size, rhs.headline_size, rhs.star_rating, rhs.title_size);
+        if (reversed) {
+            return tRhs < tLhs;
+        } else {
+            return tLhs < tRhs;
+        }
+    } else if (primaryKey == BODY_SIZE) {
+        auto tLhs = make_tuple(lhs.body_size, lhs.date, lhs.headline_size, lhs.star_rating, lhs.title_size);
+        auto tRhs = make_tuple(rhs.body_size, rhs.date, rhs.headline_size, rhs.star_rating, rhs.title_size);
+        if (reversed) {
+            return tRhs < tLhs;
+        } else {
+            return tLhs < tRhs;
+        }
+    } else if (primaryKey == STARS) {
+        if (lhs.star_rating != rhs.star_rating) {
+            return reversed ? rhs.star_rating < lhs.star_rating : lhs.star_rating < rhs.star_rating;
+        }
+        int titleOrder = compareTitles(db, lhs, rhs);
+        auto tLhs = make_tuple(titleOrder, lhs.date, lhs.body_size, lhs.headline_size);
+        auto tRhs = make_tuple(0, rhs.date, rhs.body_size, rhs.headline_size);
+        if (reversed) {
+            return tRhs < tLhs;
+        } else {
+            return tLhs < tRhs;
+        }
+    } else if (primaryKey == TITLE_SIZE) {
+        auto tLhs = make_tuple(lhs.title_size, lhs.date, lhs.body_size, lhs.headline_size, lhs.star_rating);
+        auto tRhs = make_tuple(rhs.title_size, rhs.date, rhs.body_size, rhs.headline_size, rhs.star_rating);
+        if (reversed) {
+            return tRhs < tLhs;
+        } else {
+            return tLhs < tRhs;
+        }
+    } else {
+        return false;
+    }
+}
+
+bool parseResidency(const string& modes, ResidencyPolicy &residency) {
+    size_t start = 0;
+    while (start <= modes.size()) {
+        size_t end = modes.find(',', start);
+        if (end == string::npos) end = modes.size();
+        string mode = modes.substr(start, end - start);
+        if (mode == "populate") {
+            residency.populateOffsets = true;
+        } else if (mode == "lock") {
+            residency.lockOffsets = true;
+        } else if (mode == "random") {
+            residency.randomReviews = true;
+        } else if (mode == "hugepages") {
+            residency.hugePages = true;
+        } else if (mode == "warm") {
+            residency.warm = true;
+        } else {
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
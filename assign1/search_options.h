@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "amazon.h"
+
+/**
+ * The options shared by everything that answers queries the way amazon_search does:
+ * how to read a query, and which sort key orders its matches.
+ */
+enum {DATE, BODY_SIZE, STARS, TITLE_SIZE};
+enum {AND_QUERY, BOOLEAN_QUERY, RANKED_QUERY};
+
+// Ranked queries show this many reviews unless told otherwise
+static const size_t kDefaultRankedReviews = 10;
+
+/**
+ * Function: genericReviewCompare
+ * ------------------------------
+ * Orders two reviews by primaryKey (one of DATE, BODY_SIZE, STARS, TITLE_SIZE), breaking
+ * ties on the other properties, ascending unless reversed.
+ */
+bool genericReviewCompare(const amazon& db, const ReviewSortKey &lhs, const ReviewSortKey &rhs,
+        int primaryKey, bool reversed=false);
+
+/**
+ * Function: parseResidency
+ * ------------------------
+ * Sets the ResidencyPolicy fields named in modes, a comma-separated list of populate,
+ * lock, random, hugepages and warm.  Returns false if any mode is unknown.
+ */
+bool parseResidency(const std::string& modes, ResidencyPolicy &residency);
@@ -0,0 +1,169 @@
+/**
+ * File: segments_test.cc
+ * ----------------------
+ * Walks a small database through the life of its segment manifest: appends, a compaction
+ * that replaces the original base files while an instance is still serving them, more
+ * appends, and a second compaction that has to carry a skip index over to the new base.
+ * After every step it checks the manifest on disk, which segment files exist, and that
+ * both an open instance (once refreshed) and a freshly opened one answer queries with the
+ * same reviews at the same indexes.
+ *
+ *    > ./segments_test
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+#include <stdlib.h>
+#include "amazon.h"
+#include "amazon_writer.h"
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool condition, const string& what) {
+    if (condition) return;
+    cout << "FAILED: " << what << endl;
+    failures++;
+}
+
+static string directory;
+static const string kPrefix = "db";
+
+static bool fileExists(const string& name) {
+    return access((directory + "/" + name).c_str(), F_OK) == 0;
+}
+
+static string manifest() {
+    ifstream in(directory + "/" + kPrefix + "_segments.txt");
+    stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+/**
+ * Review i has the words "common", "group<i % 3>" and "review<i>", so every query below
+ * has a known answer however the reviews are split between segments.
+ */
+static Review makeReview(unsigned int i) {
+    Review review;
+    review.index = i;
+    review.product_title = "title" + to_string(i);
+    review.product_category = "Electronics";
+    review.star_rating = 1 + i % 5;
+    review.review_headline = "common headline";
+    review.review_body = "body of review" + to_string(i) + " in group" + to_string(i % 3);
+    review.review_year = 2000 + i % 20;
+    review.review_month = 1 + i % 12;
+    review.review_day = 1 + i % 28;
+    return review;
+}
+
+static vector<Review> makeReviews(unsigned int first, unsigned int count) {
+    vector<Review> reviews;
+    for (unsigned int i = first; i < first + count; i++) reviews.push_back(makeReview(i));
+    return reviews;
+}
+
+static void checkDatabase(const amazon& db, unsigned int numReviews, const string& when) {
+    check(db.good(), when + ": database is good");
+    check(db.totalReviews() == numReviews, when + ": " + to_string(numReviews) + " reviews");
+
+    vector<unsigned int> expected, found;
+    for (unsigned int i = 0; i < numReviews; i++) expected.push_back(i);
+    db.searchKeywordIndex("common", found);
+    check(found == expected, when + ": every review matches a word they all share");
+
+    for (unsigned int group = 0; group < 3; group++) {
+        expected.clear();
+        for (unsigned int i = group; i < numReviews; i += 3) expected.push_back(i);
+        db.searchKeywordIndex("common group" + to_string(group), found);
+        check(found == expected, when + ": group" + to_string(group) + " matches across segments");
+    }
+
+    for (unsigned int i = 0; i < numReviews; i++) {
+        db.searchKeywordIndex("review" + to_string(i), found);
+        check(found == vector<unsigned int>(1, i), when + ": review" + to_string(i) + " keeps its index");
+        ReviewView review;
+        check(db.getReview(i, review) && review.product_title() == "title" + to_string(i),
+            when + ": review " + to_string(i) + " is fetched from the right segment");
+    }
+    ReviewView missing;
+    check(!db.getReview(numReviews, missing), when + ": no review past the end");
+}
+
+int main(int argc, char *argv[]) {
+    char scratch[] = "/tmp/segments_test.XXXXXX";
+    if (mkdtemp(scratch) == nullptr) {
+        cerr << "Could not create a scratch directory" << endl;
+        return 1;
+    }
+    directory = scratch;
+
+    AmazonWriter writer(directory, kPrefix);
+    for (const Review& review : makeReviews(0, 10)) writer.addReview(review);
+    check(writer.finish(), "base database written");
+
+    // Without a manifest the database is just its base files, and there's nothing to compact
+    amazon db(directory, kPrefix);
+    checkDatabase(db, 10, "base only");
+    check(amazon::compactSegments(directory, kPrefix), "compacting a lone base succeeds");
+    check(manifest() == "", "compacting a lone base writes no manifest");
+
+    // Appends add delta segments, which open instances see once they refresh
+    check(amazon::appendSegment(directory, kPrefix, makeReviews(10, 5)), "first append");
+    check(manifest() == "next 2\ndb\ndb_delta_1\n", "manifest after the first append");
+    check(db.totalReviews() == 10, "appended reviews stay hidden until a refresh");
+    check(db.refreshSegments(), "refresh after the first append");
+    checkDatabase(db, 15, "after one append");
+    check(amazon::appendSegment(directory, kPrefix, makeReviews(15, 7)), "second append");
+    check(amazon::appendSegment(directory, kPrefix, vector<Review>()), "appending nothing succeeds");
+    check(manifest() == "next 3\ndb\ndb_delta_1\ndb_delta_2\n", "manifest after the second append");
+    check(db.refreshSegments(), "refresh after the second append");
+    checkDatabase(db, 22, "after two appends");
+
+    // Compaction merges everything, the original base files included, into one new base
+    ReviewView held;
+    check(db.getReview(3, held), "hold a review from the original base");
+    check(amazon::compactSegments(directory, kPrefix), "first compaction");
+    check(manifest() == "next 4\ndb_base_3\n", "manifest after the first compaction");
+    check(!fileExists("db.bin") && !fileExists("db_keyword_index.bin"), "original base files deleted");
+    check(!fileExists("db_delta_1.bin") && !fileExists("db_delta_2_keyword_index.bin"), "delta segments deleted");
+    check(fileExists("db_base_3.bin") && fileExists("db_base_3_keyword_index.bin"), "new base written");
+    checkDatabase(db, 22, "compacted, before the refresh");
+    check(db.refreshSegments(), "refresh after the first compaction");
+    checkDatabase(db, 22, "compacted and refreshed");
+    check(held.product_title() == "title3", "a held review outlives the files it came from");
+    {
+        amazon reopened(directory, kPrefix);
+        checkDatabase(reopened, 22, "reopened after compaction");
+    }
+
+    // Appends carry on after the new base, and a second compaction keeps its skip index
+    check(amazon::writeSkipIndex(directory, "db_base_3", 2), "skip index for the compacted base");
+    check(amazon::appendSegment(directory, kPrefix, makeReviews(22, 4)), "append after compaction");
+    check(manifest() == "next 5\ndb_base_3\ndb_delta_4\n", "manifest after appending to a compacted base");
+    check(db.refreshSegments(), "refresh after appending to a compacted base");
+    checkDatabase(db, 26, "compacted base plus a delta");
+    check(amazon::compactSegments(directory, kPrefix), "second compaction");
+    check(manifest() == "next 6\ndb_base_5\n", "manifest after the second compaction");
+    check(fileExists("db_base_5_keyword_skips.bin"), "skip index carried over to the new base");
+    check(!fileExists("db_base_3.bin") && !fileExists("db_base_3_keyword_skips.bin"), "earlier base deleted");
+    check(db.refreshSegments(), "refresh after the second compaction");
+    checkDatabase(db, 26, "compacted twice");
+    {
+        amazon base(directory, "db_base_5");
+        check(base.good() && base.hasSkipIndex(), "the new base's skip index loads");
+    }
+
+    for (const char *name : {"db_base_5.bin", "db_base_5_keyword_index.bin", "db_base_5_keyword_skips.bin",
+            "db_segments.txt", "db_segments.lock"}) {
+        unlink((directory + "/" + name).c_str());
+    }
+    rmdir(scratch);
+
+    if (failures == 0) cout << "All segment tests passed." << endl;
+    return failures == 0 ? 0 : 1;
+}
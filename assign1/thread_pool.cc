@@ -0,0 +1,50 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t numThreads) : outstanding(0), stopping(false) {
+    if (numThreads == 0) numThreads = 1;
+    for (size_t i = 0; i < numThreads; i++) {
+        workers.push_back(thread([this] { worker(); }));
+    }
+}
+
+void ThreadPool::schedule(const function<void(void)>& thunk) {
+    lock_guard<mutex> lg(lock);
+    work.push(thunk);
+    outstanding++;
+    workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+    unique_lock<mutex> ul(lock);
+    allWorkDone.wait(ul, [this] { return outstanding == 0; });
+}
+
+void ThreadPool::worker() {
+    while (true) {
+        function<void(void)> thunk;
+        {
+            unique_lock<mutex> ul(lock);
+            workAvailable.wait(ul, [this] { return stopping || !work.empty(); });
+            if (work.empty()) return; // stopping, and nothing left to do
+            thunk = work.front();
+            work.pop();
+        }
+
+        thunk();
+
+        lock_guard<mutex> lg(lock);
+        if (--outstanding == 0) allWorkDone.notify_all();
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        lock_guard<mutex> lg(lock);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (thread& t : workers) t.join();
+}
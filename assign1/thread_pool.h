@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+/**
+ * Class: ThreadPool
+ * -----------------
+ * A fixed set of worker threads that collaboratively work through a FIFO queue of
+ * thunks (zero-argument functions without a return value).  Thunks may be scheduled
+ * from any thread, but a thunk must not wait on the pool that is running it.
+ */
+class ThreadPool {
+    public:
+
+        /**
+         * Constructor: ThreadPool
+         * -----------------------
+         * Spawns numThreads worker threads (at least one), which sleep until work arrives.
+         */
+        ThreadPool(size_t numThreads);
+
+        /**
+         * Method: schedule
+         * ----------------
+         * Queues the thunk to run on the first available worker.
+         */
+        void schedule(const std::function<void(void)>& thunk);
+
+        /**
+         * Method: wait
+         * ------------
+         * Blocks until every previously scheduled thunk has run to completion.
+         */
+        void wait();
+
+        size_t size() const { return workers.size(); }
+
+        /** Destructor: ~ThreadPool
+         *  -----------------------
+         *  Waits for all scheduled work to finish, then joins every worker.
+         */
+        ~ThreadPool();
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void(void)>> work;
+        std::mutex lock;
+        std::condition_variable workAvailable;
+        std::condition_variable allWorkDone;
+        size_t outstanding;
+        bool stopping;
+
+        void worker();
+
+        ThreadPool(const ThreadPool& original) = delete;
+        ThreadPool& operator=(const ThreadPool& rhs) = delete;
+};
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdbool.h>
 
 #include "diskimg.h"
 #include "unixfilesystem.h"
@@ -11,6 +12,7 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "diskqueue.h"
 #include <openssl/sha.h>
 
 int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
@@ -20,25 +22,27 @@ int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
     return -1;
   }
 
-  struct inode in;
-  int err = inode_iget(fs, inumber, &in);
-  if (err < 0) {
-    return err;
+  const struct inode *in = inode_iget_ptr(fs, inumber);
+  if (in == NULL) {
+    return -1;
   }
 
-  if (!(in.i_mode & IALLOC)) {
+  if (!(in->i_mode & IALLOC)) {
     // The inode isn't allocated, so we can't hash it.
     return -1;
   }
 
-  int size = inode_getsize(&in);
-  for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
-    char buf[DISKIMG_SECTOR_SIZE];
-    int bno = offset/DISKIMG_SECTOR_SIZE;
-
-    int bytesMoved = file_getblock(fs, inumber, bno, buf);
+  // Hash the file an extent at a time, while the next extents are read ahead
+  struct file_stream stream;
+  if (file_stream_open(fs, inumber, &stream) < 0)
+    return -1;
+  while (1) {
+    const void *buf;
+    int bytesMoved = file_stream_next(&stream, &buf);
     if (bytesMoved < 0)
       return -1;
+    if (bytesMoved == 0)
+      break;
 
     if (!SHA1_Update(&shactx, buf, bytesMoved))
       return -1;
@@ -50,6 +54,151 @@ int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
   return SHA_DIGEST_LENGTH;
 }
 
+/**
+ * chksumfile_byinumbers hashes extents strictly in the order it asks for them,
+ * oldest first, which keeps each file's blocks in order however the reads
+ * finish.  Every extent has a buffer in a ring as deep as the queue.
+ */
+struct file_hash {
+  SHA_CTX shactx;
+  const int *blockmap;
+  int numBlocks;
+  int filesize;
+  int nextBlock;      // the first block not yet asked for
+  int outstanding;    // extents asked for but not yet hashed
+  bool failed;
+};
+
+struct extent_read {
+  int file;           // index of the file the extent belongs to
+  int bytes;          // the file's bytes in the extent
+  int result;         // bytes read, once done
+  bool done;
+  char buf[FILE_STREAM_MAX_EXTENT * DISKIMG_SECTOR_SIZE];
+};
+
+static void finish_file(struct file_hash *file, void *chksum, int *result) {
+  if (file->failed || !SHA1_Final(chksum, &file->shactx)) *result = -1;
+  else *result = SHA_DIGEST_LENGTH;
+}
+
+/**
+ * Asks for the next extent of the file, returning false once the whole file
+ * has been asked for (or it can't be).
+ */
+static bool read_next_extent(struct diskqueue *queue, struct file_hash *file,
+                             int fileIndex, struct extent_read *read) {
+  int numBlocks = (file->filesize + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  int block = file->nextBlock;
+  if (file->failed || block >= numBlocks) return false;
+  if (block >= file->numBlocks || file->blockmap[block] < 0) {
+    file->failed = true;
+    return false;
+  }
+  int length = 1;
+  while (length < FILE_STREAM_MAX_EXTENT && block + length < numBlocks &&
+         file->blockmap[block + length] == file->blockmap[block] + length) {
+    length++;
+  }
+
+  read->file = fileIndex;
+  read->bytes = length * DISKIMG_SECTOR_SIZE;
+  if (read->bytes > file->filesize - block * DISKIMG_SECTOR_SIZE) read->bytes = file->filesize - block * DISKIMG_SECTOR_SIZE;
+  read->done = false;
+  if (diskqueue_read(queue, file->blockmap[block], length, read->buf, read) < 0) {
+    file->failed = true;
+    return false;
+  }
+  file->nextBlock += length;
+  file->outstanding++;
+  return true;
+}
+
+int chksumfile_byinumbers(struct unixfilesystem *fs, struct diskqueue *queue, int numFiles,
+                          const int *inumbers, void *chksums, int *results) {
+  int depth = diskqueue_depth(queue);
+  struct file_hash *files = malloc(numFiles * sizeof(struct file_hash));
+  struct extent_read *reads = malloc(depth * sizeof(struct extent_read));
+  if (files == NULL || reads == NULL) {
+    free(files);
+    free(reads);
+    return -1;
+  }
+
+  int oldest = 0, numReads = 0;   // the ring of extents asked for but not yet hashed
+  int nextFile = 0;               // the first file not yet fully asked for
+  bool fileOpen = false;
+  while (1) {
+    // Keep the queue full, moving on to the next file whenever one is all asked for
+    while (numReads < depth && nextFile < numFiles) {
+      struct file_hash *file = &files[nextFile];
+      char *chksum = (char *) chksums + (size_t) nextFile * CHKSUMFILE_SIZE;
+      if (!fileOpen) {
+        const struct inode *in = inode_iget_ptr(fs, inumbers[nextFile]);
+        file->failed = in == NULL || !(in->i_mode & IALLOC) || !SHA1_Init(&file->shactx);
+        file->blockmap = file->failed ? NULL : inode_blockmap(fs, inumbers[nextFile], &file->numBlocks);
+        file->failed = file->failed || file->blockmap == NULL;
+        file->filesize = file->failed ? 0 : inode_getsize(in);
+        file->nextBlock = 0;
+        file->outstanding = 0;
+        fileOpen = true;
+      }
+      struct extent_read *read = &reads[(oldest + numReads) % depth];
+      if (read_next_extent(queue, file, nextFile, read)) {
+        numReads++;
+        continue;
+      }
+      if (file->outstanding == 0) finish_file(file, chksum, &results[nextFile]);
+      nextFile++;
+      fileOpen = false;
+    }
+    if (numReads == 0) break;
+    if (diskqueue_submit(queue) < 0) break;
+
+    // Hash extents oldest first, collecting whatever else finishes meanwhile, until
+    // half the ring is free, so the queue is topped up in batches rather than one
+    // system call per extent
+    bool reaped = true;
+    do {
+      struct extent_read *read = &reads[oldest];
+      while (!read->done) {
+        void *tag;
+        int result;
+        if (diskqueue_reap(queue, &tag, &result) != 1) break;
+        struct extent_read *finished = tag;
+        finished->result = result;
+        finished->done = true;
+      }
+      reaped = read->done;
+      if (!reaped) break;
+
+      struct file_hash *file = &files[read->file];
+      if (read->result < read->bytes || !SHA1_Update(&file->shactx, read->buf, read->bytes)) file->failed = true;
+      file->outstanding--;
+      if (file->outstanding == 0 && read->file < nextFile) {
+        finish_file(file, (char *) chksums + (size_t) read->file * CHKSUMFILE_SIZE, &results[read->file]);
+      }
+      oldest = (oldest + 1) % depth;
+      numReads--;
+    } while (numReads > depth / 2);
+    if (!reaped) break;
+  }
+
+  // Only if the queue broke down: drain it and fail whatever is left
+  if (numReads > 0) {
+    void *tag;
+    int result;
+    while (diskqueue_reap(queue, &tag, &result) == 1) {}
+    for (int i = 0; i < numReads; i++) files[reads[(oldest + i) % depth].file].failed = true;
+    for (int i = 0; i < numFiles; i++) {
+      if (i >= nextFile || files[i].failed) results[i] = -1;
+    }
+  }
+  free(files);
+  free(reads);
+  return 0;
+}
+
 int chksumfile_bypathname(struct unixfilesystem *fs, const char *pathname, void *chksum) {
   int inumber = pathname_lookup(fs, pathname);
   if (inumber < 0) {
@@ -13,6 +13,16 @@
  */
 int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum);
 
+/**
+ * Computes the checksums of numFiles inumbers at once, keeping up to the
+ * queue's depth of extent reads in flight across them.  Stores file i's
+ * checksum at chksums + i * CHKSUMFILE_SIZE and what chksumfile_byinumber
+ * would have returned for it in results[i].  Returns 0, or -1 if out of memory.
+ */
+struct diskqueue;
+int chksumfile_byinumbers(struct unixfilesystem *fs, struct diskqueue *queue, int numFiles,
+                          const int *inumbers, void *chksums, int *results);
+
 /**
  * Compute the checksum of the specified pathname.  Assumes chksum points to a
  * CHKSUMFILE_SIZE byte array. Returns the length of the checksum or -1 if
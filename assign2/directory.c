@@ -3,34 +3,135 @@
 #include "diskimg.h"
 #include "file.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
-// remove the placeholder implementation and replace with your own
-int directory_findname(struct unixfilesystem *fs, const char *name,
-		       int dirinumber, struct direntv6 *dirEnt) {
+/**
+ * The dentry cache maps (directory inumber, name) to the directory entry with
+ * that name.  The first lookup in a directory scans every block of it once and
+ * indexes all of its entries; every later lookup in that directory, found or
+ * not, is a single hash probe.  Names compare like strncmp(.., D_NAME_MAX_SIZE),
+ * so a name is hashed and compared only up to its first NUL or its 14th byte.
+ */
+struct dentry {
+    int dirinumber;          // 0 marks an empty slot
+    struct direntv6 entry;
+};
 
-    struct inode in;
-    int err = inode_iget(fs, dirinumber, &in);
-    if (err < 0) return -1; // Inode not found
-    if (!(inode_isdir(&in))) return -1; // Not a directory
+struct dentrycache {
+    struct dentry *slots;    // open addressing with linear probing
+    int numSlots;            // a power of 2
+    int numEntries;
+    unsigned char *indexed;  // indexed[inumber - 1] is 1 once that directory's entries are all in slots
+    int numInodes;
+};
+
+struct dentrycache *directory_createcache(struct unixfilesystem *fs) {
+    struct dentrycache *cache = malloc(sizeof(struct dentrycache));
+    if (cache == NULL) return NULL;
+    cache->numSlots = 64;
+    cache->numEntries = 0;
+    cache->numInodes = fs->superblock.s_isize * (DISKIMG_SECTOR_SIZE / sizeof(struct inode));
+    cache->slots = calloc(cache->numSlots, sizeof(struct dentry));
+    cache->indexed = calloc(cache->numInodes > 0 ? cache->numInodes : 1, 1);
+    if (cache->slots == NULL || cache->indexed == NULL) {
+        directory_freecache(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void directory_freecache(struct dentrycache *cache) {
+    if (cache == NULL) return;
+    free(cache->slots);
+    free(cache->indexed);
+    free(cache);
+}
+
+static unsigned int dentry_hash(int dirinumber, const char *name) {
+    // FNV-1a over the directory and the significant bytes of the name
+    unsigned int hash = 2166136261u ^ (unsigned int) dirinumber;
+    hash *= 16777619u;
+    for (int i = 0; i < D_NAME_MAX_SIZE && name[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static struct dentry *dentry_probe(const struct dentrycache *cache, int dirinumber, const char *name) {
+    unsigned int mask = cache->numSlots - 1;
+    for (unsigned int i = dentry_hash(dirinumber, name) & mask; ; i = (i + 1) & mask) {
+        struct dentry *slot = &cache->slots[i];
+        if (slot->dirinumber == 0) return slot;
+        if (slot->dirinumber == dirinumber && strncmp(slot->entry.d_name, name, D_NAME_MAX_SIZE) == 0) return slot;
+    }
+}
 
-    int size = inode_getsize(&in);
-    // Iterate over all the blocks in the directory
+static int dentry_grow(struct dentrycache *cache) {
+    struct dentry *old = cache->slots;
+    int oldSlots = cache->numSlots;
+    struct dentry *slots = calloc(oldSlots * 2, sizeof(struct dentry));
+    if (slots == NULL) return -1;
+    cache->slots = slots;
+    cache->numSlots = oldSlots * 2;
+    for (int i = 0; i < oldSlots; i++) {
+        if (old[i].dirinumber != 0) *dentry_probe(cache, old[i].dirinumber, old[i].entry.d_name) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * Adds a directory entry to the cache, unless the directory already has an entry
+ * with the same name, which then wins, just as it would in a linear scan.
+ */
+static int dentry_insert(struct dentrycache *cache, int dirinumber, const struct direntv6 *entry) {
+    // Keep the table at most half full, so probe sequences stay short
+    if (2 * (cache->numEntries + 1) > cache->numSlots && dentry_grow(cache) < 0) return -1;
+    struct dentry *slot = dentry_probe(cache, dirinumber, entry->d_name);
+    if (slot->dirinumber != 0) return 0;
+    slot->dirinumber = dirinumber;
+    slot->entry = *entry;
+    cache->numEntries++;
+    return 0;
+}
+
+/**
+ * Scans every block of the directory, adding each of its entries to the cache.
+ * Returns 0 once the whole directory is indexed, or -1 if a block can't be read.
+ */
+static int directory_index(struct unixfilesystem *fs, int dirinumber, int size) {
     for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
         int fileBlockIndex = offset / DISKIMG_SECTOR_SIZE;
-        struct direntv6 buf[DISKIMG_SECTOR_SIZE / sizeof(struct direntv6)];
-        int bytes_read = file_getblock(fs, dirinumber, fileBlockIndex, buf);
+        const void *block;
+        int bytes_read = file_getblock_ptr(fs, dirinumber, fileBlockIndex, &block);
         if (bytes_read < 0) return -1;
 
-        // Iterate over each entry in the block
-        for (int i = 0; i < (int)sizeof(buf); i ++) {
-            if (strncmp(buf[i].d_name, name, D_NAME_MAX_SIZE) == 0) {
-                *dirEnt = buf[i];
-                return 0;
-            } 
+        const struct direntv6 *entries = block;
+        int num_entries = bytes_read / sizeof(struct direntv6);
+        for (int i = 0; i < num_entries; i++) {
+            if (entries[i].d_inumber == 0) continue; // a free slot
+            if (dentry_insert(fs->dentries, dirinumber, &entries[i]) < 0) return -1;
         }
     }
-    // Entry with specified name not found
-    return -1;
+    fs->dentries->indexed[dirinumber - 1] = 1;
+    return 0;
+}
+
+int directory_findname(struct unixfilesystem *fs, const char *name,
+		       int dirinumber, struct direntv6 *dirEnt) {
+
+    const struct inode *in = inode_iget_ptr(fs, dirinumber);
+    if (in == NULL) return -1; // Inode not found
+    if (!(inode_isdir(in))) return -1; // Not a directory
+
+    // A directory that can't be indexed in full is rescanned next time, but any
+    // entries found before the bad block still count, as they would in a linear scan
+    if (!fs->dentries->indexed[dirinumber - 1]) directory_index(fs, dirinumber, inode_getsize(in));
+
+    const struct dentry *found = dentry_probe(fs->dentries, dirinumber, name);
+    if (found->dirinumber == 0) return -1; // Entry with specified name not found
+    *dirEnt = found->entry;
+    return 0;
 }
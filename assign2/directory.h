@@ -12,4 +12,11 @@
 int directory_findname(struct unixfilesystem *fs, const char *name,
                        int dirinumber, struct direntv6 *dirEnt);
 
+/**
+ * Creates and frees the dentry cache behind directory_findname;
+ * unixfilesystem_init and unixfilesystem_free do this for every filesystem.
+ */
+struct dentrycache *directory_createcache(struct unixfilesystem *fs);
+void directory_freecache(struct dentrycache *cache);
+
 #endif // _DIRECTORY_H_
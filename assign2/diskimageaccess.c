@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "diskimg.h"
 #include "unixfilesystem.h"
@@ -12,20 +13,31 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "diskqueue.h"
 
 int quietFlag = 0; 
 int idumpFlag = 0;
 int pdumpFlag = 0;
+int statsFlag = 0;
+int mapFlag = 0;
+int cacheSectors = SECTORCACHE_DEFAULT_SECTORS;
+int numThreads = 1;
+int queueDepth = 0;
+
+// Sector cache statistics of the -j worker threads' filesystems, added in as each finishes
+struct sectorcache_stats workerCacheStats;
 
 static void PrintDirectory(struct unixfilesystem *fs,  char *pathname);
 static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f);
 static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f);
+static void ParallelDumpInodeChecksum(struct unixfilesystem *fs, char *diskpath, FILE *f);
+static void ParallelDumpPathnameChecksum(struct unixfilesystem *fs, char *diskpath, FILE *f);
 static void PrintUsageAndExit(char *progname);
 static int GetDirEntries(struct unixfilesystem *fs, int inumber, struct direntv6 *entries, int maxNumEntries);
 
 int main(int argc, char *argv[]) {
   int opt;
-  while ((opt = getopt(argc, argv, "iqp")) != -1) {
+  while ((opt = getopt(argc, argv, "iqpsmc:j:a:")) != -1) {
     switch (opt) {
     case 'q':
       quietFlag = 1;
@@ -36,6 +48,24 @@ int main(int argc, char *argv[]) {
     case 'p':
       pdumpFlag = 1;
       break;
+    case 's':
+      statsFlag = 1;
+      break;
+    case 'm':
+      mapFlag = 1;
+      break;
+    case 'c':
+      cacheSectors = atoi(optarg);
+      if (cacheSectors < 0) PrintUsageAndExit(argv[0]);
+      break;
+    case 'j':
+      numThreads = atoi(optarg);
+      if (numThreads < 1) PrintUsageAndExit(argv[0]);
+      break;
+    case 'a':
+      queueDepth = atoi(optarg);
+      if (queueDepth < 1) PrintUsageAndExit(argv[0]);
+      break;
     default: 
       PrintUsageAndExit(argv[0]);
     } 
@@ -58,6 +88,14 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "Failed to initialize unix filesystem\n");
     exit(EXIT_FAILURE);
   }
+  if (cacheSectors != SECTORCACHE_DEFAULT_SECTORS && unixfilesystem_setcachesize(fs, cacheSectors) < 0) {
+    fprintf(stderr, "Can't allocate a cache of %d sectors\n", cacheSectors);
+    unixfilesystem_free(fs);
+    exit(EXIT_FAILURE);
+  }
+  if (mapFlag && unixfilesystem_usemap(fs) < 0) {
+    fprintf(stderr, "Can't map %s, reading it through the sector cache instead\n", diskpath);
+  }
 
   if (!quietFlag) {  
     int disksize = diskimg_getsize(fd);
@@ -66,7 +104,7 @@ int main(int argc, char *argv[]) {
       // Cast the result of diskimg_close to void so the compiler doesn't
       // complain that we're ignoring its return value.
       (void) diskimg_close(fd);
-      free(fs);
+      unixfilesystem_free(fs);
       exit(EXIT_FAILURE);
     }
     printf("Disk %s is %d bytes (%d KB)\n", argv[1],  disksize, disksize/1024);
@@ -76,12 +114,27 @@ int main(int argc, char *argv[]) {
     printf("Superblock s_ninode %d\n",(int)fs->superblock.s_ninode);
   }
 
-  if (idumpFlag) DumpInodeChecksum(fs, stdout);
-  if (pdumpFlag) DumpPathnameChecksum(fs, stdout);
+  if (numThreads > 1 || queueDepth > 0) {
+    if (idumpFlag) ParallelDumpInodeChecksum(fs, diskpath, stdout);
+    if (pdumpFlag) ParallelDumpPathnameChecksum(fs, diskpath, stdout);
+  } else {
+    if (idumpFlag) DumpInodeChecksum(fs, stdout);
+    if (pdumpFlag) DumpPathnameChecksum(fs, stdout);
+  }
+  if (statsFlag) {
+    // Every thread's cache counts, not just the main thread's
+    struct sectorcache_stats stats;
+    sectorcache_getstats(fs->cache, &stats);
+    stats.hits += workerCacheStats.hits;
+    stats.misses += workerCacheStats.misses;
+    stats.evictions += workerCacheStats.evictions;
+    printf("Sector cache: %ld hits, %ld misses (disk reads), %ld evictions\n",
+           stats.hits, stats.misses, stats.evictions);
+  }
 
   int err = diskimg_close(fd);
   if (err < 0) fprintf(stderr, "Error closing %s\n", argv[1]);
-  free(fs);
+  unixfilesystem_free(fs);
   exit(EXIT_SUCCESS);
   return 0;
 }
@@ -193,6 +246,484 @@ static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f) {
   DumpPathAndChildren(fs, "/", ROOT_INUMBER, f);
 }
 
+/**
+ * The parallel dumps split the checksumming across numThreads threads and then
+ * print exactly what the serial dumps would, in the same order.  Every thread
+ * reads the disk image through its own descriptor and its own unixfilesystem
+ * (with its own caches), so the threads share nothing but the list of work and
+ * the array of results.  The main thread works too, with the main filesystem.
+ *
+ * With -a, every thread also reads file contents through a disk queue of its
+ * own, claiming a batch of items at a time and keeping up to queueDepth extent
+ * reads in flight across the batch's files (see chksumfile_byinumbers).
+ */
+#define QUEUE_BATCH 256
+
+struct ChksumWork {
+  char *diskpath;
+  int numItems;
+  int nextItem;        // the next item to claim, advanced atomically
+  void (*compute)(struct unixfilesystem *fs, struct diskqueue *queue, struct ChksumWork *work,
+                  int firstItem, int numItems);
+  void *items;         // what compute reads and fills in for each item
+};
+
+static void ComputeItems(struct unixfilesystem *fs, struct ChksumWork *work) {
+  // Without a queue (or the memory for one), checksum one item at a time
+  struct diskqueue *queue = queueDepth > 0 ? diskqueue_create(fs->dfd, queueDepth) : NULL;
+  int batch = queue != NULL ? QUEUE_BATCH : 1;
+  while (1) {
+    int item = __sync_fetch_and_add(&work->nextItem, batch);
+    if (item >= work->numItems) break;
+    int count = work->numItems - item < batch ? work->numItems - item : batch;
+    work->compute(fs, queue, work, item, count);
+  }
+  diskqueue_free(queue);
+}
+
+static void *ChksumWorker(void *arg) {
+  struct ChksumWork *work = arg;
+  int fd = diskimg_open(work->diskpath, 1);
+  if (fd < 0) return NULL;
+  struct unixfilesystem *fs = unixfilesystem_init(fd);
+  if (fs != NULL) {
+    // Same cache settings as the main filesystem; if they can't be had, the default is fine
+    if (cacheSectors != SECTORCACHE_DEFAULT_SECTORS) (void) unixfilesystem_setcachesize(fs, cacheSectors);
+    if (mapFlag) (void) unixfilesystem_usemap(fs);
+    ComputeItems(fs, work);
+    struct sectorcache_stats stats;
+    sectorcache_getstats(fs->cache, &stats);
+    __sync_fetch_and_add(&workerCacheStats.hits, stats.hits);
+    __sync_fetch_and_add(&workerCacheStats.misses, stats.misses);
+    __sync_fetch_and_add(&workerCacheStats.evictions, stats.evictions);
+    unixfilesystem_free(fs);
+  }
+  (void) diskimg_close(fd);
+  return NULL;
+}
+
+/**
+ * Computes every item of work, using numThreads threads in all.  A thread that
+ * can't open the disk image leaves its share to the others.
+ */
+static void RunChksumWork(struct unixfilesystem *fs, struct ChksumWork *work) {
+  pthread_t threads[numThreads];
+  int numStarted = 0;
+  for (int i = 1; i < numThreads; i++) {
+    if (pthread_create(&threads[numStarted], NULL, ChksumWorker, work) == 0) numStarted++;
+  }
+  ComputeItems(fs, work);
+  for (int i = 0; i < numStarted; i++) pthread_join(threads[i], NULL);
+}
+
+struct InodeChksum {
+  int result;                  // what chksumfile_byinumber returned, or 0 if not computed
+  char chksum[CHKSUMFILE_SIZE];
+};
+
+static void ComputeInodeChksums(struct unixfilesystem *fs, struct diskqueue *queue, struct ChksumWork *work,
+                                int firstItem, int numItems) {
+  struct InodeChksum *chksums = work->items;
+  int inumbers[QUEUE_BATCH];
+  int numFiles = 0;
+  for (int item = firstItem; item < firstItem + numItems; item++) {
+    int inumber = item + 1;
+    const struct inode *in = inode_iget_ptr(fs, inumber);
+    if (in == NULL || (in->i_mode & IALLOC) == 0) continue;
+    if (queue == NULL) chksums[item].result = chksumfile_byinumber(fs, inumber, chksums[item].chksum);
+    else inumbers[numFiles++] = inumber;
+  }
+  if (numFiles == 0) return;
+
+  char batchChksums[QUEUE_BATCH][CHKSUMFILE_SIZE];
+  int results[QUEUE_BATCH];
+  if (chksumfile_byinumbers(fs, queue, numFiles, inumbers, batchChksums, results) < 0) {
+    for (int i = 0; i < numFiles; i++) results[i] = -1;
+  }
+  for (int i = 0; i < numFiles; i++) {
+    struct InodeChksum *chksum = &chksums[inumbers[i] - 1];
+    chksum->result = results[i];
+    memcpy(chksum->chksum, batchChksums[i], CHKSUMFILE_SIZE);
+  }
+}
+
+/**
+ * DumpInodeChecksum, with the checksums computed in parallel.
+ */
+static void ParallelDumpInodeChecksum(struct unixfilesystem *fs, char *diskpath, FILE *f) {
+  int numInodes = fs->superblock.s_isize*16 - 1;
+  if (numInodes <= 0) return;
+  struct InodeChksum *chksums = calloc(numInodes, sizeof(struct InodeChksum));
+  if (chksums == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return;
+  }
+  struct ChksumWork work = {diskpath, numInodes, 0, ComputeInodeChksums, chksums};
+  RunChksumWork(fs, &work);
+
+  for (int inumber = 1; inumber < fs->superblock.s_isize*16; inumber++) {
+    struct inode in;
+    if (inode_iget(fs, inumber, &in) < 0) {
+      fprintf(stderr,"Can't read inode %d \n", inumber);
+      break;
+    }
+    if ((in.i_mode & IALLOC) == 0) {
+      // Skip this inode if it's not allocated.
+      continue;
+    }
+
+    // A result of 0 means no thread got a checksum for it, which is no more printable than an error
+    struct InodeChksum *chksum = &chksums[inumber - 1];
+    if (chksum->result <= 0) {
+      fprintf(stderr, "Inode %d can't compute chksum\n", inumber);
+      continue;
+    }
+
+    char chksumstring[CHKSUMFILE_STRINGSIZE];
+    chksumfile_cvt2string(chksum->chksum, chksumstring);
+
+    int size = inode_getsize(&in);
+    fprintf(f, "Inode %d mode 0x%x size %d checksum %s\n",inumber,in.i_mode, size, chksumstring);
+  }
+  free(chksums);
+}
+
+/**
+ * Every path DumpPathAndChildren would visit, in the order it would visit them.
+ * A path's descendants are the paths right after it, up to subtreeEnd, so the
+ * whole subtree can be skipped when checksumming the path fails.
+ */
+struct PathChksum {
+  char *pathname;
+  int inumber;
+  int subtreeEnd;
+  int tooDeep;                 // a directory whose children's paths may not fit
+  int status;                  // one of the PATH_ values below
+  char chksum[CHKSUMFILE_SIZE];
+};
+
+enum { PATH_NOT_COMPUTED, PATH_OK, PATH_BYINUMBER_FAILED, PATH_BYPATHNAME_FAILED, PATH_DIFFERS };
+
+struct PathList {
+  struct PathChksum *paths;
+  int numPaths;
+  int capacity;
+};
+
+static int AddPath(struct PathList *list, const char *pathname, int inumber) {
+  if (list->numPaths == list->capacity) {
+    int capacity = list->capacity > 0 ? 2 * list->capacity : 256;
+    struct PathChksum *paths = realloc(list->paths, capacity * sizeof(struct PathChksum));
+    if (paths == NULL) return -1;
+    list->paths = paths;
+    list->capacity = capacity;
+  }
+  char *copy = strdup(pathname);
+  if (copy == NULL) return -1;
+  struct PathChksum *path = &list->paths[list->numPaths];
+  memset(path, 0, sizeof(*path));
+  path->pathname = copy;
+  path->inumber = inumber;
+  return list->numPaths++;
+}
+
+/**
+ * The entries of every directory in the naming hierarchy, read ahead of the walk
+ * through a disk queue, a whole level of the tree at a time.  Directories that
+ * couldn't be read this way have no entries here and are read as they're walked.
+ */
+struct DirContents {
+  struct direntv6 *entries;
+  int numEntries;
+  int pendingReads;    // reads of the directory not yet reaped
+  long pendingBytes;   // bytes those reads asked for
+  bool failed;
+};
+
+/**
+ * Records a directory read the queue has finished.  A read that comes up short
+ * leaves part of the directory unread, so it fails the directory like an error.
+ */
+static void FinishDirectoryRead(void *tag, int result) {
+  struct DirContents *finished = tag;
+  finished->pendingReads--;
+  if (result < 0) finished->failed = true;
+  else finished->pendingBytes -= result;
+  if (finished->pendingReads == 0 && finished->pendingBytes != 0) finished->failed = true;
+}
+
+/**
+ * Queues reads of all of a directory's blocks, reaping finished reads whenever
+ * the queue is full.
+ */
+static void QueueDirectoryReads(struct unixfilesystem *fs, struct diskqueue *queue, struct DirContents *dirs,
+                                int inumber) {
+  struct DirContents *dir = &dirs[inumber];
+  const struct inode *in = inode_iget_ptr(fs, inumber);
+  int numBlocks;
+  const int *blockmap = inode_blockmap(fs, inumber, &numBlocks);
+  if (in == NULL || (in->i_mode & IFMT) != IFDIR || blockmap == NULL) {
+    dir->failed = true;
+    return;
+  }
+  int size = inode_getsize(in);
+  int neededBlocks = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  dir->entries = malloc((neededBlocks > 0 ? neededBlocks : 1) * DISKIMG_SECTOR_SIZE);
+  if (neededBlocks > numBlocks || dir->entries == NULL) {
+    dir->failed = true;
+    return;
+  }
+  dir->numEntries = size / sizeof(struct direntv6);
+  if (dir->numEntries > 10000) dir->numEntries = 10000;
+
+  for (int block = 0; block < neededBlocks; ) {
+    if (blockmap[block] < 0) {
+      dir->failed = true;
+      return;
+    }
+    int length = 1;
+    while (block + length < neededBlocks && length < FILE_STREAM_MAX_EXTENT &&
+           blockmap[block + length] == blockmap[block] + length) {
+      length++;
+    }
+    void *buf = (char *) dir->entries + (size_t) block * DISKIMG_SECTOR_SIZE;
+    while (diskqueue_read(queue, blockmap[block], length, buf, dir) < 0) {
+      void *tag;
+      int result;
+      if (diskqueue_submit(queue) < 0 || diskqueue_reap(queue, &tag, &result) != 1) {
+        dir->failed = true;
+        return;
+      }
+      FinishDirectoryRead(tag, result);
+    }
+    dir->pendingReads++;
+    dir->pendingBytes += (long) length * DISKIMG_SECTOR_SIZE;
+    block += length;
+  }
+}
+
+/**
+ * Reads every directory reachable from the root, breadth first, with every
+ * directory of a level in flight at once.  Returns NULL if out of memory.
+ */
+static struct DirContents *ReadDirectories(struct unixfilesystem *fs, struct diskqueue *queue) {
+  // Inumbers are 1-indexed, so there's a slot for every inumber up to and including the last
+  int maxInumber = fs->superblock.s_isize*16;
+  struct DirContents *dirs = calloc(maxInumber + 1, sizeof(struct DirContents));
+  int *level = malloc((maxInumber + 1) * sizeof(int));
+  int *nextLevel = malloc((maxInumber + 1) * sizeof(int));
+  bool *seen = calloc(maxInumber + 1, sizeof(bool));
+  if (dirs == NULL || level == NULL || nextLevel == NULL || seen == NULL) {
+    free(dirs);
+    dirs = NULL;
+    goto done;
+  }
+
+  int levelSize = 1;
+  level[0] = ROOT_INUMBER;
+  seen[ROOT_INUMBER] = true;
+  while (levelSize > 0) {
+    for (int i = 0; i < levelSize; i++) QueueDirectoryReads(fs, queue, dirs, level[i]);
+    void *tag;
+    int result;
+    while (diskqueue_reap(queue, &tag, &result) == 1) FinishDirectoryRead(tag, result);
+
+    int nextSize = 0;
+    for (int i = 0; i < levelSize; i++) {
+      struct DirContents *dir = &dirs[level[i]];
+      if (dir->failed || dir->pendingReads != 0 || dir->pendingBytes != 0) {
+        free(dir->entries);
+        dir->entries = NULL;
+        continue;
+      }
+      for (int e = 0; e < dir->numEntries; e++) {
+        int child = dir->entries[e].d_inumber;
+        if (child > maxInumber || seen[child]) continue;
+        const struct inode *in = inode_iget_ptr(fs, child);
+        if (in != NULL && (in->i_mode & IALLOC) && (in->i_mode & IFMT) == IFDIR) {
+          seen[child] = true;
+          nextLevel[nextSize++] = child;
+        }
+      }
+    }
+    int *swap = level;
+    level = nextLevel;
+    nextLevel = swap;
+    levelSize = nextSize;
+  }
+
+done:
+  free(level);
+  free(nextLevel);
+  free(seen);
+  return dirs;
+}
+
+static void FreeDirectories(struct DirContents *dirs, int maxInumber) {
+  if (dirs == NULL) return;
+  for (int i = 0; i <= maxInumber; i++) free(dirs[i].entries);
+  free(dirs);
+}
+
+/**
+ * Walks the naming hierarchy the way DumpPathAndChildren does, but only lists
+ * the paths it finds, taking directories' entries from dirs (which may be NULL)
+ * when it has them.  Returns -1 if out of memory.
+ */
+static int CollectPaths(struct unixfilesystem *fs, const char *pathname, int inumber, struct DirContents *dirs,
+                        struct PathList *list) {
+  int index = AddPath(list, pathname, inumber);
+  if (index < 0) return -1;
+  struct inode in;
+  if (inode_iget(fs, inumber, &in) == 0 && (in.i_mode & IFMT) == IFDIR) {
+    if (pathname[1] == 0) {
+      /* pathame == "/" */
+      pathname++; /* Delete extra / character */
+    }
+
+    const unsigned int MAXPATH = 1024;
+    list->paths[index].tooDeep = strlen(pathname) > MAXPATH-16;
+
+    struct direntv6 direntries[10000];
+    const struct direntv6 *entries = direntries;
+    int numentries;
+    if (dirs != NULL && inumber <= fs->superblock.s_isize*16 && dirs[inumber].entries != NULL) {
+      entries = dirs[inumber].entries;
+      numentries = dirs[inumber].numEntries;
+    } else {
+      numentries = GetDirEntries(fs, inumber, direntries, 10000);
+    }
+    for (int i = 0; i < numentries; i++) {
+      const char *n = entries[i].d_name;
+      if (n[0] == '.') {
+        if ((n[1] == 0) || ((n[1] == '.') && (n[2] == 0))) {
+          /* Skip over "." and ".." */
+          continue;
+        }
+      }
+
+      char nextpath[MAXPATH];
+      sprintf(nextpath, "%s/%s",pathname, entries[i].d_name);
+      if (CollectPaths(fs, nextpath, entries[i].d_inumber, dirs, list) < 0) return -1;
+    }
+  }
+  list->paths[index].subtreeEnd = list->numPaths;
+  return 0;
+}
+
+static void ComputePathChksums(struct unixfilesystem *fs, struct diskqueue *queue, struct ChksumWork *work,
+                               int firstItem, int numItems) {
+  struct PathChksum *paths = work->items;
+  if (queue == NULL) {
+    for (int item = firstItem; item < firstItem + numItems; item++) {
+      struct PathChksum *path = &paths[item];
+      if (inode_iget_ptr(fs, path->inumber) == NULL) continue;
+
+      char chksum1[CHKSUMFILE_SIZE];
+      if (chksumfile_byinumber(fs, path->inumber, chksum1) < 0) {
+        path->status = PATH_BYINUMBER_FAILED;
+      } else if (chksumfile_bypathname(fs, path->pathname, path->chksum) < 0) {
+        path->status = PATH_BYPATHNAME_FAILED;
+      } else {
+        path->status = chksumfile_compare(chksum1, path->chksum) ? PATH_OK : PATH_DIFFERS;
+      }
+    }
+    return;
+  }
+
+  // Checksum each path's inode, and the one its name looks up if that's different, all in one batch
+  int inumbers[2 * QUEUE_BATCH];
+  int byinumber[QUEUE_BATCH], bypathname[QUEUE_BATCH];
+  int numFiles = 0;
+  for (int i = 0; i < numItems; i++) {
+    struct PathChksum *path = &paths[firstItem + i];
+    byinumber[i] = bypathname[i] = -1;
+    if (inode_iget_ptr(fs, path->inumber) == NULL) continue;
+    byinumber[i] = numFiles;
+    inumbers[numFiles++] = path->inumber;
+    int lookedUp = pathname_lookup(fs, path->pathname);
+    if (lookedUp == path->inumber) {
+      bypathname[i] = byinumber[i];
+    } else if (lookedUp >= 0) {
+      bypathname[i] = numFiles;
+      inumbers[numFiles++] = lookedUp;
+    }
+  }
+  if (numFiles == 0) return;
+
+  char chksums[2 * QUEUE_BATCH][CHKSUMFILE_SIZE];
+  int results[2 * QUEUE_BATCH];
+  if (chksumfile_byinumbers(fs, queue, numFiles, inumbers, chksums, results) < 0) {
+    for (int i = 0; i < numFiles; i++) results[i] = -1;
+  }
+  for (int i = 0; i < numItems; i++) {
+    struct PathChksum *path = &paths[firstItem + i];
+    if (byinumber[i] < 0) continue;
+    if (results[byinumber[i]] < 0) {
+      path->status = PATH_BYINUMBER_FAILED;
+    } else if (bypathname[i] < 0 || results[bypathname[i]] < 0) {
+      path->status = PATH_BYPATHNAME_FAILED;
+    } else {
+      memcpy(path->chksum, chksums[bypathname[i]], CHKSUMFILE_SIZE);
+      path->status = chksumfile_compare(chksums[byinumber[i]], path->chksum) ? PATH_OK : PATH_DIFFERS;
+    }
+  }
+}
+
+/**
+ * DumpPathnameChecksum, with the checksums computed in parallel.
+ */
+static void ParallelDumpPathnameChecksum(struct unixfilesystem *fs, char *diskpath, FILE *f) {
+  // With a queue, read the directories ahead of the walk instead of one block at a time during it
+  struct DirContents *dirs = NULL;
+  if (queueDepth > 0) {
+    struct diskqueue *queue = diskqueue_create(fs->dfd, queueDepth);
+    if (queue != NULL) dirs = ReadDirectories(fs, queue);
+    diskqueue_free(queue);
+  }
+
+  struct PathList list = {NULL, 0, 0};
+  int err = CollectPaths(fs, "/", ROOT_INUMBER, dirs, &list);
+  FreeDirectories(dirs, fs->superblock.s_isize*16);
+  if (err < 0) {
+    fprintf(stderr, "Out of memory.\n");
+  } else {
+    struct ChksumWork work = {diskpath, list.numPaths, 0, ComputePathChksums, list.paths};
+    RunChksumWork(fs, &work);
+  }
+
+  for (int i = 0; i < list.numPaths; ) {
+    struct PathChksum *path = &list.paths[i];
+    // Unless everything checks out, DumpPathAndChildren doesn't descend
+    int next = path->subtreeEnd;
+    struct inode in;
+    if (inode_iget(fs, path->inumber, &in) < 0) {
+      fprintf(stderr,"Can't read inode %d \n", path->inumber);
+    } else {
+      assert(in.i_mode & IALLOC);
+      if (path->status == PATH_BYINUMBER_FAILED || path->status == PATH_BYPATHNAME_FAILED ||
+          path->status == PATH_NOT_COMPUTED) {
+        fprintf(stderr,"Can't checksum inode %d path %s\n", path->inumber, path->pathname);
+      } else if (path->status == PATH_DIFFERS) {
+        fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", path->pathname, path->inumber);
+      } else if (path->status == PATH_OK) {
+        char chksumstring[CHKSUMFILE_STRINGSIZE];
+        chksumfile_cvt2string(path->chksum, chksumstring);
+        int size = inode_getsize(&in);
+        fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n",path->pathname,path->inumber,in.i_mode, size, chksumstring);
+        if ((in.i_mode & IFMT) == IFDIR && path->tooDeep) {
+          fprintf(stderr, "Too deep of directories %s\n", path->pathname);
+        }
+        next = i + 1;
+      }
+    }
+    i = next;
+  }
+
+  for (int i = 0; i < list.numPaths; i++) free(list.paths[i].pathname);
+  free(list.paths);
+}
+
 /**
  * Print all the entries in the specified directory. 
  */
@@ -262,5 +793,10 @@ static void PrintUsageAndExit(char *progname) {
   fprintf(stderr, "-q     don't print extra info\n"); 
   fprintf(stderr, "-i     print all inode checksums\n"); 
   fprintf(stderr, "-p     print all pathname checksums\n");  
+  fprintf(stderr, "-c N   cache up to N disk sectors (default %d, 0 for none)\n", SECTORCACHE_DEFAULT_SECTORS);
+  fprintf(stderr, "-m     read the disk image through a memory mapping instead of the sector cache\n");
+  fprintf(stderr, "-s     print sector cache statistics, summed over all threads\n");
+  fprintf(stderr, "-j N   compute the -i and -p checksums with N threads\n");
+  fprintf(stderr, "-a N   keep up to N disk reads in flight per thread for -i and -p (io_uring where available)\n");
   exit(EXIT_FAILURE);
 }
@@ -1,7 +1,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "diskimg.h"
 
@@ -14,16 +16,49 @@ int diskimg_getsize(int fd) {
 }
 
 int diskimg_readsector(int fd, int sectorNum,  void *buf) {
-  if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) return -1;  
-  return read(fd, buf, DISKIMG_SECTOR_SIZE);
+  return diskimg_readsectors(fd, sectorNum, 1, buf);
 }
 
-int diskimg_writesector(int fd, int sectorNum,  void *buf) {
-  if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) {
-    return -1;
+int diskimg_readsectors(int fd, int firstSector, int numSectors, void *buf) {
+  // pread leaves the descriptor's offset alone, so threads can share the descriptor
+  off_t offset = (off_t) firstSector * DISKIMG_SECTOR_SIZE;
+  size_t length = (size_t) numSectors * DISKIMG_SECTOR_SIZE;
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = pread(fd, (char *) buf + done, length - done, offset + done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) break; // the end of the image
+    done += n;
   }
+  return done;
+}
+
+int diskimg_prefetch(int fd, int firstSector, int numSectors) {
+  // Starts reading the sectors into the page cache, which a mapping shares too
+  int err = posix_fadvise(fd, (off_t) firstSector * DISKIMG_SECTOR_SIZE,
+                          (off_t) numSectors * DISKIMG_SECTOR_SIZE, POSIX_FADV_WILLNEED);
+  return err == 0 ? 0 : -1;
+}
+
+int diskimg_writesector(int fd, int sectorNum,  void *buf) {
+  return pwrite(fd, buf, DISKIMG_SECTOR_SIZE, (off_t) sectorNum * DISKIMG_SECTOR_SIZE);
+}
+
+const void *diskimg_map(int fd, int *size) {
+  int imageSize = diskimg_getsize(fd);
+  if (imageSize <= 0) return NULL;
+
+  void *image = mmap(NULL, imageSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (image == MAP_FAILED) return NULL;
+  *size = imageSize;
+  return image;
+}
 
-  return write(fd, buf, DISKIMG_SECTOR_SIZE);
+int diskimg_unmap(const void *image, int size) {
+  return munmap((void *) (uintptr_t) image, size);
 }
 
 int diskimg_close(int fd) {
@@ -23,12 +23,42 @@ int diskimg_getsize(int fd);
  */
 int diskimg_readsector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Reads numSectors consecutive sectors, starting with firstSector, into buf with
+ * as few system calls as the operating system allows (normally one).  Returns the
+ * number of bytes read, which is less than numSectors * DISKIMG_SECTOR_SIZE only
+ * if the image ends first, or -1 on error.
+ *
+ * Neither this nor diskimg_readsector moves the descriptor's file offset, so
+ * several threads may read the same descriptor at once.
+ */
+int diskimg_readsectors(int fd, int firstSector, int numSectors, void *buf);
+
+/**
+ * Tells the operating system that numSectors consecutive sectors, starting with
+ * firstSector, will be read soon, so it can start reading them in the
+ * background.  Returns 0 on success, or -1 on error.
+ */
+int diskimg_prefetch(int fd, int firstSector, int numSectors);
+
 /**
  * Writes the specified sector from the disk.  Returns the number of bytes
  * written, or -1 on error.
  */
 int diskimg_writesector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Maps the whole disk image read-only into memory, so its sectors can be read in
+ * place instead of with a system call each.  Returns the address of the image's
+ * first byte and stores its size in *size, or returns NULL if unsuccessful.
+ */
+const void *diskimg_map(int fd, int *size);
+
+/**
+ * Unmaps an image mapped by diskimg_map().  Returns 0 on success, or -1 on error.
+ */
+int diskimg_unmap(const void *image, int size);
+
 /**
  * Clean up from a previous diskimg_open() call.  Returns 0 on success, or -1 on
  * error.
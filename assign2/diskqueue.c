@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define DISKQUEUE_URING 1
+#endif
+#endif
+
+#include "diskqueue.h"
+#include "diskimg.h"
+
+/**
+ * One read in the queue.  Requests are handed out from a free list; the
+ * request's index rides along with the read as its io_uring user_data.
+ */
+struct request {
+    int firstSector;
+    int numSectors;
+    struct iovec iov;    // where the read goes
+    void *tag;
+    int nextFree;        // next request on the free list, or -1
+};
+
+#ifdef DISKQUEUE_URING
+/**
+ * The submission and completion rings the kernel shares with us, mapped from
+ * the ring's descriptor.  The head and tail pointers are read and written with
+ * acquire and release ordering because the kernel updates them concurrently.
+ */
+struct uring {
+    int fd;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;        // the same mapping as sqRing, if the kernel allows
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+};
+#endif
+
+struct diskqueue {
+    int dfd;
+    int depth;
+    struct request *requests;
+    int firstFree;
+    int numQueued;       // queued but not submitted
+    int numInFlight;     // submitted but not reaped
+    bool async;
+#ifdef DISKQUEUE_URING
+    struct uring ring;
+#endif
+    // Without io_uring, the requests waiting to be carried out, oldest first
+    int *pending;
+    int pendingHead;
+};
+
+#ifdef DISKQUEUE_URING
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static void uring_close(struct uring *ring) {
+    if (ring->sqes != NULL) munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != NULL && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing != NULL) munmap(ring->sqRing, ring->sqRingSize);
+    if (ring->fd >= 0) close(ring->fd);
+}
+
+/**
+ * Sets up a ring with room for at least entries reads.  Returns 0 on success, or
+ * -1 if io_uring isn't available, in which case the ring needs no cleaning up.
+ */
+static int uring_open(struct uring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0) return -1;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    void *sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) goto fail;
+    ring->sqRing = sqRing;
+    if (singleMap) {
+        ring->cqRing = sqRing;
+    } else {
+        void *cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) goto fail;
+        ring->cqRing = cqRing;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) goto fail;
+    ring->sqes = sqes;
+
+    char *sq = ring->sqRing;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+    char *cq = ring->cqRing;
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return 0;
+
+fail:
+    uring_close(ring);
+    memset(ring, 0, sizeof(*ring));
+    return -1;
+}
+
+/**
+ * Hands the kernel every queued read, and, if wait is set, waits for at least
+ * one read to finish.
+ */
+static int uring_submit(struct diskqueue *queue, bool wait) {
+    while (queue->numQueued > 0 || wait) {
+        unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+        int submitted = uring_enter(queue->ring.fd, queue->numQueued, wait ? 1 : 0, flags);
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        queue->numQueued -= submitted;
+        queue->numInFlight += submitted;
+        wait = false;
+    }
+    return 0;
+}
+#endif
+
+struct diskqueue *diskqueue_create(int fd, int depth) {
+    if (depth < 1) depth = 1;
+    struct diskqueue *queue = calloc(1, sizeof(struct diskqueue));
+    if (queue == NULL) return NULL;
+    queue->dfd = fd;
+    queue->depth = depth;
+    queue->requests = malloc(depth * sizeof(struct request));
+    queue->pending = malloc(depth * sizeof(int));
+    if (queue->requests == NULL || queue->pending == NULL) {
+        free(queue->requests);
+        free(queue->pending);
+        free(queue);
+        return NULL;
+    }
+    for (int i = 0; i < depth; i++) queue->requests[i].nextFree = i + 1 < depth ? i + 1 : -1;
+    queue->firstFree = 0;
+#ifdef DISKQUEUE_URING
+    queue->async = uring_open(&queue->ring, depth) == 0;
+#endif
+    return queue;
+}
+
+bool diskqueue_isasync(const struct diskqueue *queue) {
+    return queue->async;
+}
+
+int diskqueue_depth(const struct diskqueue *queue) {
+    return queue->depth;
+}
+
+int diskqueue_read(struct diskqueue *queue, int firstSector, int numSectors, void *buf, void *tag) {
+    if (queue->firstFree < 0) return -1;
+    int index = queue->firstFree;
+    struct request *request = &queue->requests[index];
+    queue->firstFree = request->nextFree;
+    request->firstSector = firstSector;
+    request->numSectors = numSectors;
+    request->iov.iov_base = buf;
+    request->iov.iov_len = (size_t) numSectors * DISKIMG_SECTOR_SIZE;
+    request->tag = tag;
+
+#ifdef DISKQUEUE_URING
+    if (queue->async) {
+        // There are never more requests than submission slots, so there's always room
+        struct uring *ring = &queue->ring;
+        unsigned tail = *ring->sqTail;
+        unsigned slot = tail & *ring->sqMask;
+        struct io_uring_sqe *sqe = &ring->sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;  // plain reads need a newer kernel
+        sqe->fd = queue->dfd;
+        sqe->off = (uint64_t) firstSector * DISKIMG_SECTOR_SIZE;
+        sqe->addr = (uint64_t) (uintptr_t) &request->iov;
+        sqe->len = 1;
+        sqe->user_data = index;
+        ring->sqArray[slot] = slot;
+        __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+        queue->numQueued++;
+        return 0;
+    }
+#endif
+    queue->pending[(queue->pendingHead + queue->numQueued + queue->numInFlight) % queue->depth] = index;
+    queue->numQueued++;
+    return 0;
+}
+
+int diskqueue_submit(struct diskqueue *queue) {
+#ifdef DISKQUEUE_URING
+    if (queue->async) return uring_submit(queue, false);
+#endif
+    queue->numInFlight += queue->numQueued;
+    queue->numQueued = 0;
+    return 0;
+}
+
+static void release_request(struct diskqueue *queue, int index, void **tag) {
+    *tag = queue->requests[index].tag;
+    queue->requests[index].nextFree = queue->firstFree;
+    queue->firstFree = index;
+}
+
+int diskqueue_reap(struct diskqueue *queue, void **tag, int *result) {
+    if (queue->numQueued + queue->numInFlight == 0) return 0;
+
+#ifdef DISKQUEUE_URING
+    if (queue->async) {
+        struct uring *ring = &queue->ring;
+        unsigned head = *ring->cqHead;
+        while (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+            if (uring_submit(queue, true) < 0) return -1;
+        }
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+        int index = (int) cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+        queue->numInFlight--;
+
+        struct request *request = &queue->requests[index];
+        if (res > 0 && (size_t) res < request->iov.iov_len && res % DISKIMG_SECTOR_SIZE == 0) {
+            // A short read that isn't at the end of the image: finish it synchronously
+            int more = diskimg_readsectors(queue->dfd, request->firstSector + res / DISKIMG_SECTOR_SIZE,
+                                           request->numSectors - res / DISKIMG_SECTOR_SIZE,
+                                           (char *) request->iov.iov_base + res);
+            res = more < 0 ? -1 : res + more;
+        }
+        *result = res < 0 ? -1 : res;
+        release_request(queue, index, tag);
+        return 1;
+    }
+#endif
+    queue->numInFlight += queue->numQueued;
+    queue->numQueued = 0;
+    int index = queue->pending[queue->pendingHead];
+    queue->pendingHead = (queue->pendingHead + 1) % queue->depth;
+    queue->numInFlight--;
+    struct request *request = &queue->requests[index];
+    *result = diskimg_readsectors(queue->dfd, request->firstSector, request->numSectors, request->iov.iov_base);
+    release_request(queue, index, tag);
+    return 1;
+}
+
+void diskqueue_free(struct diskqueue *queue) {
+    if (queue == NULL) return;
+#ifdef DISKQUEUE_URING
+    if (queue->async) {
+        // The kernel may still be writing into the callers' buffers
+        void *tag;
+        int result;
+        while (diskqueue_reap(queue, &tag, &result) == 1) {}
+        uring_close(&queue->ring);
+    }
+#endif
+    free(queue->requests);
+    free(queue->pending);
+    free(queue);
+}
@@ -0,0 +1,65 @@
+#ifndef _DISKQUEUE_H_
+#define _DISKQUEUE_H_
+
+#include <stdbool.h>
+
+/**
+ * A queue of reads of a disk image that are carried out asynchronously, so many
+ * can be in flight at once: queue reads with diskqueue_read, hand them to the
+ * operating system with diskqueue_submit, and collect them, in whatever order
+ * they finish, with diskqueue_reap.
+ *
+ * Where the kernel offers io_uring, the reads go through a ring of the queue's
+ * own, set up with raw system calls.  Otherwise the queue falls back to
+ * carrying out each read with diskimg_readsectors when it's reaped, so callers
+ * work the same either way, just without the overlap.
+ */
+
+struct diskqueue;
+
+/**
+ * Creates a queue of up to depth reads of the disk image open on fd.  Returns
+ * NULL if out of memory.
+ */
+struct diskqueue *diskqueue_create(int fd, int depth);
+
+/**
+ * Returns true if the queue's reads really are asynchronous (through io_uring),
+ * and false if it fell back to reading when reaping.
+ */
+bool diskqueue_isasync(const struct diskqueue *queue);
+
+/**
+ * Returns the most reads the queue can hold (queued, submitted or finished but
+ * not yet reaped) at once.
+ */
+int diskqueue_depth(const struct diskqueue *queue);
+
+/**
+ * Queues a read of numSectors consecutive sectors, starting with firstSector,
+ * into buf, which must stay put until the read is reaped.  tag is handed back
+ * when it is.  Returns 0 on success, or -1 if the queue is full.
+ */
+int diskqueue_read(struct diskqueue *queue, int firstSector, int numSectors, void *buf, void *tag);
+
+/**
+ * Starts every read queued since the last submit.  Returns 0 on success, or -1
+ * on error.
+ */
+int diskqueue_submit(struct diskqueue *queue);
+
+/**
+ * Waits for a read to finish (submitting any that haven't been), and stores its
+ * tag in *tag and its result, the number of bytes read or -1 on error, in
+ * *result.  Returns 1 if a read was reaped, 0 if there were none to wait for,
+ * or -1 if waiting failed.
+ */
+int diskqueue_reap(struct diskqueue *queue, void **tag, int *result);
+
+/**
+ * Frees the queue, first waiting for any reads still in flight.  The disk image
+ * stays open.
+ */
+void diskqueue_free(struct diskqueue *queue);
+
+#endif // _DISKQUEUE_H_
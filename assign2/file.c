@@ -1,23 +1,25 @@
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 
 #include "file.h"
 #include "inode.h"
 #include "diskimg.h"
 
-// remove the placeholder implementation and replace with your own
-int file_getblock(struct unixfilesystem *fs, int inumber, int fileBlockIndex, void *buf) {
-    struct inode node;
-    struct inode * inp = &node;
-    int err = inode_iget(fs, inumber, inp);
-    if (err < 0) return -1;  
-
-    int block_num = inode_indexlookup(fs, inp, fileBlockIndex);
-    if (block_num < 0) return -1;
-    int bytes_read = diskimg_readsector(fs->dfd, block_num, buf);
-    if (bytes_read < 0) return -1;
+/**
+ * Finds the disk block holding the specified file block, storing its number in
+ * *blockNum.  Returns the number of the block's bytes that belong to the file,
+ * or -1 on error.
+ */
+static int file_locateblock(struct unixfilesystem *fs, int inumber, int fileBlockIndex, int *blockNum) {
+    // The block map turns every lookup after a file's first into an array index
+    int num_mapped;
+    const int *blockmap = inode_blockmap(fs, inumber, &num_mapped);
+    if (blockmap == NULL) return -1;
+    if (fileBlockIndex < 0 || fileBlockIndex >= num_mapped || blockmap[fileBlockIndex] < 0) return -1;
+    *blockNum = blockmap[fileBlockIndex];
 
-    const int filesize = inode_getsize(inp);
+    const int filesize = inode_getsize(inode_iget_ptr(fs, inumber));
     if (filesize % DISKIMG_SECTOR_SIZE == 0) 
     {
         int num_blocks = filesize / DISKIMG_SECTOR_SIZE;
@@ -33,3 +35,143 @@ int file_getblock(struct unixfilesystem *fs, int inumber, int fileBlockIndex, vo
         else return DISKIMG_SECTOR_SIZE;
     }
 }
+
+int file_getblock(struct unixfilesystem *fs, int inumber, int fileBlockIndex, void *buf) {
+    int block_num;
+    int valid_bytes = file_locateblock(fs, inumber, fileBlockIndex, &block_num);
+    if (valid_bytes < 0) return -1;
+    int bytes_read = sectorcache_readsectors(fs->cache, block_num, 1, buf);
+    if (bytes_read < 0) return -1;
+    return valid_bytes;
+}
+
+int file_read(struct unixfilesystem *fs, int inumber, int offset, int len, void *buf) {
+    const struct inode *in = inode_iget_ptr(fs, inumber);
+    if (in == NULL || offset < 0 || len < 0) return -1;
+    int num_mapped;
+    const int *blockmap = inode_blockmap(fs, inumber, &num_mapped);
+    if (blockmap == NULL) return -1;
+
+    const int filesize = inode_getsize(in);
+    if (offset >= filesize) return 0;
+    if (len > filesize - offset) len = filesize - offset;
+
+    char *out = buf;
+    int done = 0;
+    while (done < len) {
+        int pos = offset + done;
+        int block_index = pos / DISKIMG_SECTOR_SIZE;
+        int skip = pos % DISKIMG_SECTOR_SIZE;
+        if (block_index >= num_mapped || blockmap[block_index] < 0) return -1;
+
+        if (skip != 0 || len - done < DISKIMG_SECTOR_SIZE) {
+            // Only part of this block is wanted, so copy it out of the cache
+            const char *block = sectorcache_getsector(fs->cache, blockmap[block_index]);
+            if (block == NULL) return -1;
+            int count = DISKIMG_SECTOR_SIZE - skip;
+            if (count > len - done) count = len - done;
+            memcpy(out + done, block + skip, count);
+            done += count;
+            continue;
+        }
+
+        // Read every whole block that follows this one on the disk in one go
+        int run = 1;
+        while ((run + 1) * DISKIMG_SECTOR_SIZE <= len - done && block_index + run < num_mapped &&
+               blockmap[block_index + run] == blockmap[block_index] + run) {
+            run++;
+        }
+        int bytes_read = sectorcache_readsectors(fs->cache, blockmap[block_index], run, out + done);
+        if (bytes_read != run * DISKIMG_SECTOR_SIZE) return -1;
+        done += bytes_read;
+    }
+    return done;
+}
+
+int file_getblock_ptr(struct unixfilesystem *fs, int inumber, int fileBlockIndex, const void **block) {
+    int block_num;
+    int valid_bytes = file_locateblock(fs, inumber, fileBlockIndex, &block_num);
+    if (valid_bytes < 0) return -1;
+    *block = sectorcache_getsector(fs->cache, block_num);
+    if (*block == NULL) return -1;
+    return valid_bytes;
+}
+
+int file_stream_open(struct unixfilesystem *fs, int inumber, struct file_stream *stream) {
+    const struct inode *in = inode_iget_ptr(fs, inumber);
+    if (in == NULL) return -1;
+    stream->blockmap = inode_blockmap(fs, inumber, &stream->numBlocks);
+    if (stream->blockmap == NULL) return -1;
+    stream->fs = fs;
+    stream->filesize = inode_getsize(in);
+    stream->nextBlock = 0;
+    stream->prefetchedBlock = 0;
+    return 0;
+}
+
+/**
+ * Returns the number of blocks, up to maxBlocks, in the extent starting with
+ * the specified block, or 0 if the block can't be looked up.
+ */
+static int file_extentlength(const struct file_stream *stream, int firstBlock, int maxBlocks) {
+    const int *blockmap = stream->blockmap;
+    if (blockmap[firstBlock] < 0) return 0;
+    int length = 1;
+    while (length < maxBlocks && firstBlock + length < stream->numBlocks &&
+           blockmap[firstBlock + length] == blockmap[firstBlock] + length) {
+        length++;
+    }
+    return length;
+}
+
+/**
+ * Keeps the read ahead FILE_STREAM_READAHEAD blocks past the stream's next
+ * block, topping it up half a window at a time so small files and short
+ * extents don't cost a request each.
+ */
+static void file_readahead(struct file_stream *stream) {
+    int numBlocks = (stream->filesize + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+    if (numBlocks > stream->numBlocks) numBlocks = stream->numBlocks;
+    if (stream->prefetchedBlock < stream->nextBlock) stream->prefetchedBlock = stream->nextBlock;
+    if (stream->prefetchedBlock - stream->nextBlock >= FILE_STREAM_READAHEAD / 2) return;
+
+    int end = stream->nextBlock + FILE_STREAM_READAHEAD;
+    if (end > numBlocks) end = numBlocks;
+    while (stream->prefetchedBlock < end) {
+        int block = stream->prefetchedBlock;
+        int length = file_extentlength(stream, block, end - block);
+        if (length == 0) {
+            // file_stream_next reports the error when it gets here
+            stream->prefetchedBlock = end;
+            return;
+        }
+        sectorcache_prefetch(stream->fs->cache, stream->blockmap[block], length);
+        stream->prefetchedBlock += length;
+    }
+}
+
+int file_stream_next(struct file_stream *stream, const void **data) {
+    int offset = stream->nextBlock * DISKIMG_SECTOR_SIZE;
+    if (offset >= stream->filesize) return 0;
+    if (stream->nextBlock >= stream->numBlocks) return -1;
+
+    int remaining = (stream->filesize - offset + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+    int length = file_extentlength(stream, stream->nextBlock,
+                                   remaining < FILE_STREAM_MAX_EXTENT ? remaining : FILE_STREAM_MAX_EXTENT);
+    if (length == 0) return -1;
+    int firstSector = stream->blockmap[stream->nextBlock];
+    stream->nextBlock += length;
+
+    // Ask for the extents after this one before waiting on this one
+    file_readahead(stream);
+
+    int bytes = length * DISKIMG_SECTOR_SIZE;
+    if (bytes > stream->filesize - offset) bytes = stream->filesize - offset;
+    *data = sectorcache_getsectors(stream->fs->cache, firstSector, length);
+    if (*data == NULL) {
+        int bytes_read = sectorcache_readsectors(stream->fs->cache, firstSector, length, stream->buf);
+        if (bytes_read < bytes) return -1;
+        *data = stream->buf;
+    }
+    return bytes;
+}
@@ -2,10 +2,65 @@
 #define _FILE_H_
 
 #include "unixfilesystem.h"
+#include "diskimg.h"
+
+// Most blocks a file stream hands back at once: 32 KB
+#define FILE_STREAM_MAX_EXTENT 64
+
+// How far ahead of the caller a file stream asks for blocks to be read: 128 KB
+#define FILE_STREAM_READAHEAD 256
+
+/**
+ * Reads a whole file front to back, an extent (a run of blocks that sit one
+ * after another on the disk) at a time, while the blocks of the next few extents
+ * are read in the background.  Set one up with file_stream_open and call
+ * file_stream_next until it returns 0.  A stream needs no cleaning up.
+ */
+struct file_stream {
+  struct unixfilesystem *fs;
+  int filesize;
+  const int *blockmap;   // the file's block map (see inode_blockmap)
+  int numBlocks;
+  int nextBlock;         // the first block file_stream_next hasn't returned
+  int prefetchedBlock;   // the first block not yet asked to be read ahead
+  char buf[FILE_STREAM_MAX_EXTENT * DISKIMG_SECTOR_SIZE]; // the extent, unless it's read in place
+};
 /**
  * Fetches the specified file block from the specified inode.
  * Returns the number of valid bytes in the block, -1 on error.
  */
 int file_getblock(struct unixfilesystem *fs, int inumber, int fileBlockIndex, void *buf); 
 
+/**
+ * Like file_getblock, but points *block at the block where it sits in the
+ * filesystem's sector cache (or mapped image) instead of copying it.  The block
+ * stays valid only until the next read of the filesystem, unless the image is
+ * mapped (see unixfilesystem_usemap).
+ * Returns the number of valid bytes in the block, -1 on error.
+ */
+int file_getblock_ptr(struct unixfilesystem *fs, int inumber, int fileBlockIndex, const void **block);
+
+/**
+ * Reads up to len bytes of the specified file, starting offset bytes in, into
+ * buf.  Each run of blocks that sit one after another on the disk is read with a
+ * single read of the disk image.
+ * Returns the number of bytes read, which is less than len only at the end of
+ * the file, or -1 on error.
+ */
+int file_read(struct unixfilesystem *fs, int inumber, int offset, int len, void *buf);
+
+/**
+ * Sets up stream to read the specified file.  Returns 0 on success, -1 on error.
+ */
+int file_stream_open(struct unixfilesystem *fs, int inumber, struct file_stream *stream);
+
+/**
+ * Points *data at the file's next extent, read in place when the image is mapped
+ * and into the stream's buffer otherwise.  The extent stays valid until the next
+ * call on the stream or read of the filesystem.
+ * Returns the number of bytes in the extent, 0 at the end of the file, or -1 on
+ * error.
+ */
+int file_stream_next(struct file_stream *stream, const void **data);
+
 #endif // _FILE_H_
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "inode.h"
@@ -9,37 +11,91 @@ typedef int diskimg_block_t;
 const int DISKIMG_MAX_FILESIZE = 7 * n_address_per_block * DISKIMG_SECTOR_SIZE + n_address_per_block * n_address_per_block * DISKIMG_SECTOR_SIZE;
 #define n_inode_per_sector (int)(DISKIMG_SECTOR_SIZE / sizeof(struct inode))
 
-int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+/**
+ * The in-core inode table.  Inodes are read a sector at a time, the first time
+ * any inode in the sector is asked for, and then stay in memory along with each
+ * file's block map: the disk block holding each of its file blocks, worked out
+ * the first time any block of the file is looked up.  The image is read-only,
+ * so nothing is ever written back or invalidated.
+ */
+struct incore_inode {
+    struct inode inode;
+    int *blockmap;       // NULL until the block map is built
+    int numBlocks;       // entries in blockmap
+};
+
+struct inodetable {
+    int numSectors;                   // inode sectors on the disk (s_isize)
+    struct incore_inode **sectors;    // one array of n_inode_per_sector per inode sector, or NULL until read
+};
+
+struct inodetable *inode_createtable(struct unixfilesystem *fs) {
+    struct inodetable *table = malloc(sizeof(struct inodetable));
+    if (table == NULL) return NULL;
+    table->numSectors = fs->superblock.s_isize;
+    table->sectors = calloc(table->numSectors > 0 ? table->numSectors : 1, sizeof(struct incore_inode *));
+    if (table->sectors == NULL) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+void inode_freetable(struct inodetable *table) {
+    if (table == NULL) return;
+    for (int i = 0; i < table->numSectors; i++) {
+        if (table->sectors[i] == NULL) continue;
+        for (int j = 0; j < n_inode_per_sector; j++) free(table->sectors[i][j].blockmap);
+        free(table->sectors[i]);
+    }
+    free(table->sectors);
+    free(table);
+}
+
+static struct incore_inode *incore_iget(struct unixfilesystem *fs, int inumber) {
     // Check that inumber is 1-indexed
     // Convert 1-indexed inumber to 0-indexed
-    if (inumber == 0) return -1;
+    if (inumber <= 0) return NULL;
     inumber -= 1;
 
     int num_inodes = fs->superblock.s_isize * n_inode_per_sector;
-    if (inumber >= num_inodes) return -1; // inumber out of range
+    if (inumber >= num_inodes) return NULL; // inumber out of range
 
     // calculate which sector to go to
-    int sector_containing_inode = (inumber / n_inode_per_sector) + INODE_START_SECTOR ;
+    int sector_index = inumber / n_inode_per_sector;
     int inode_index_within_sector = inumber % n_inode_per_sector;
-    
-    struct inode buf[n_inode_per_sector];
-    int n_bytes_read = diskimg_readsector(fs->dfd, sector_containing_inode, buf);
-    struct inode * tmp = buf + inode_index_within_sector;
+    struct incore_inode *incore = fs->inodes->sectors[sector_index];
+    if (incore == NULL) {
+        const struct inode *buf = sectorcache_getsector(fs->cache, sector_index + INODE_START_SECTOR);
+        if (buf == NULL) return NULL;
+        incore = calloc(n_inode_per_sector, sizeof(struct incore_inode));
+        if (incore == NULL) return NULL;
+        for (int i = 0; i < n_inode_per_sector; i++) incore[i].inode = buf[i];
+        fs->inodes->sectors[sector_index] = incore;
+    }
+    return incore + inode_index_within_sector;
+}
 
-    // Check: does this successfully copy tmp into inp?
-    // Debugging with gdb suggests that it works!
+const struct inode *inode_iget_ptr(struct unixfilesystem *fs, int inumber) {
+    struct incore_inode *incore = incore_iget(fs, inumber);
+    return incore == NULL ? NULL : &incore->inode;
+}
+
+int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+    const struct inode *tmp = inode_iget_ptr(fs, inumber);
+    if (tmp == NULL) return -1;
     *inp = *tmp;
     return 0;
 }
 
 static diskimg_block_t lookup_address_block(struct unixfilesystem *fs, diskimg_block_t block, int index) {
-    uint16_t buf[DISKIMG_SECTOR_SIZE / sizeof(uint16_t)];
-    int n_bytes_read = diskimg_readsector(fs->dfd, block, buf);
+    const uint16_t *buf = sectorcache_getsector(fs->cache, block);
+    if (buf == NULL) return -1;
     return buf[index];
 }
 
 
-int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int fileBlockIndex) {
+int inode_indexlookup(struct unixfilesystem *fs, const struct inode *inp, int fileBlockIndex) {
     const int filesize = inode_getsize(inp);
     if (!(inode_islarge(inp))) 
     {
@@ -79,7 +135,54 @@ int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int fileBloc
     }
 }
 
-int inode_getsize(struct inode *inp) {
+/**
+ * Fills in map with the disk block holding each of the first numBlocks blocks of
+ * the file, reading every indirect block once, in order, rather than once per
+ * lookup.  Entries inode_indexlookup would fail on are -1.
+ */
+static void build_blockmap(struct unixfilesystem *fs, const struct inode *inp, int *map, int numBlocks) {
+    int i = 0;
+    if (!inode_islarge(inp)) {
+        for (; i < numBlocks && i < 8; i++) map[i] = inp->i_addr[i];
+    } else if (inode_getsize(inp) <= DISKIMG_MAX_FILESIZE) {
+        for (int k = 0; k < 7 && i < numBlocks; k++) {
+            const uint16_t *addresses = sectorcache_getsector(fs->cache, inp->i_addr[k]);
+            for (int j = 0; j < n_address_per_block && i < numBlocks; j++, i++) {
+                map[i] = addresses != NULL ? addresses[j] : -1;
+            }
+        }
+        if (i < numBlocks) {
+            // Copy the doubly indirect block, since reading the blocks it points to may evict it
+            uint16_t indirect[n_address_per_block];
+            const uint16_t *addresses = sectorcache_getsector(fs->cache, inp->i_addr[7]);
+            if (addresses != NULL) memcpy(indirect, addresses, sizeof(indirect));
+            for (int k = 0; k < n_address_per_block && i < numBlocks; k++) {
+                const uint16_t *direct = addresses != NULL ? sectorcache_getsector(fs->cache, indirect[k]) : NULL;
+                for (int j = 0; j < n_address_per_block && i < numBlocks; j++, i++) {
+                    map[i] = direct != NULL ? direct[j] : -1;
+                }
+            }
+        }
+    }
+    for (; i < numBlocks; i++) map[i] = -1;
+}
+
+const int *inode_blockmap(struct unixfilesystem *fs, int inumber, int *numBlocks) {
+    struct incore_inode *incore = incore_iget(fs, inumber);
+    if (incore == NULL) return NULL;
+    if (incore->blockmap == NULL) {
+        int size = inode_getsize(&incore->inode);
+        int count = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+        incore->blockmap = malloc((count > 0 ? count : 1) * sizeof(int));
+        if (incore->blockmap == NULL) return NULL;
+        build_blockmap(fs, &incore->inode, incore->blockmap, count);
+        incore->numBlocks = count;
+    }
+    *numBlocks = incore->numBlocks;
+    return incore->blockmap;
+}
+
+int inode_getsize(const struct inode *inp) {
     return ((inp->i_size0 << 16) | inp->i_size1); 
 }
 
@@ -12,6 +12,32 @@
  */
 int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp); 
 
+/**
+ * Like inode_iget, but returns a pointer to the filesystem's in-core copy of the
+ * inode instead of copying it, or NULL on error.  The in-core copy lasts as long
+ * as the filesystem.
+ *
+ * @param  inumber: 1-indexed
+ */
+const struct inode *inode_iget_ptr(struct unixfilesystem *fs, int inumber);
+
+/**
+ * Returns the file's block map, the disk block number of each of its blocks in
+ * order (-1 for any block that can't be looked up), and stores the number of
+ * blocks in *numBlocks.  The map is built the first time it's asked for and lasts
+ * as long as the filesystem.  Returns NULL on error.
+ *
+ * @param  inumber: 1-indexed
+ */
+const int *inode_blockmap(struct unixfilesystem *fs, int inumber, int *numBlocks);
+
+/**
+ * Creates and frees the in-core inode table behind inode_iget and inode_blockmap;
+ * unixfilesystem_init and unixfilesystem_free do this for every filesystem.
+ */
+struct inodetable *inode_createtable(struct unixfilesystem *fs);
+void inode_freetable(struct inodetable *table);
+
 /**
  * Given an index of a file block, retrieves the file's actual block number
  * from the given inode.
@@ -19,12 +45,12 @@ int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp);
  *
  * Returns the disk block number on success, -1 on error.  
  */
-int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int fileBlockIndex);
+int inode_indexlookup(struct unixfilesystem *fs, const struct inode *inp, int fileBlockIndex);
 
 /**
  * Computes the size in bytes of the file identified by the given inode
  */
-int inode_getsize(struct inode *inp);
+int inode_getsize(const struct inode *inp);
 
 /**
  * Returns true if file uses large file mapping scheme and false otherwise
@@ -18,10 +18,9 @@ static int pathname_lookup_helper(struct unixfilesystem *fs, char ** pathname_pt
     assert(strncmp(dirEnt.d_name, filename, D_NAME_MAX_SIZE) == 0);
     int file_inumber = dirEnt.d_inumber;
 
-    struct inode in; 
-    err = inode_iget(fs, dirEnt.d_inumber, &in);
-    if (err < 0) return -1;
-    
+    // Only checks the inode exists; the in-core inode table makes that a lookup, not a read
+    if (inode_iget_ptr(fs, file_inumber) == NULL) return -1;
+
 
     if (*pathname_ptr == NULL) {
         return file_inumber;
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "sectorcache.h"
+#include "diskimg.h"
+
+#define NO_SLOT (-1)
+
+struct slot {
+    int sectorNum;     // sector held, or NO_SLOT if the slot is empty
+    int next;          // next slot in the same hash bucket
+    bool referenced;   // used since the clock hand last passed
+};
+
+struct sectorcache {
+    int dfd;
+    int numSlots;
+    int numUsed;         // slots [0, numUsed) have been handed out
+    int hand;            // the clock hand: the next slot considered for eviction
+    int bucketMask;      // number of buckets - 1, a power of 2 minus 1
+    int *buckets;        // first slot in each bucket's chain
+    struct slot *slots;
+    char *data;          // numSlots sectors, slot i's at i * DISKIMG_SECTOR_SIZE
+    char scratch[DISKIMG_SECTOR_SIZE]; // holds sectors read when nothing is cached
+    const char *image;   // the whole image, for a mapped cache, or NULL
+    int imageSize;
+    struct sectorcache_stats stats;
+};
+
+struct sectorcache *sectorcache_create(int dfd, int numSectors) {
+    if (numSectors < 0) numSectors = 0;
+    struct sectorcache *cache = calloc(1, sizeof(struct sectorcache));
+    if (cache == NULL) return NULL;
+    cache->dfd = dfd;
+    cache->numSlots = numSectors;
+
+    // About one slot per bucket keeps the chains short
+    int numBuckets = 1;
+    while (numBuckets < numSectors) numBuckets *= 2;
+    cache->bucketMask = numBuckets - 1;
+    cache->buckets = malloc(numBuckets * sizeof(int));
+    cache->slots = malloc((numSectors > 0 ? numSectors : 1) * sizeof(struct slot));
+    cache->data = malloc((size_t) (numSectors > 0 ? numSectors : 1) * DISKIMG_SECTOR_SIZE);
+    if (cache->buckets == NULL || cache->slots == NULL || cache->data == NULL) {
+        sectorcache_free(cache);
+        return NULL;
+    }
+    for (int i = 0; i < numBuckets; i++) cache->buckets[i] = NO_SLOT;
+    for (int i = 0; i < numSectors; i++) cache->slots[i] = (struct slot) {NO_SLOT, NO_SLOT, false};
+    return cache;
+}
+
+struct sectorcache *sectorcache_create_mapped(int dfd) {
+    struct sectorcache *cache = sectorcache_create(dfd, 0);
+    if (cache == NULL) return NULL;
+    cache->image = diskimg_map(dfd, &cache->imageSize);
+    if (cache->image == NULL) {
+        sectorcache_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+static int *bucket_for(struct sectorcache *cache, int sectorNum) {
+    // Fibonacci hashing spreads runs of consecutive sectors across the buckets
+    unsigned int hash = (unsigned int) sectorNum * 2654435769u;
+    return &cache->buckets[(hash ^ (hash >> 15)) & cache->bucketMask];
+}
+
+static int find_slot(struct sectorcache *cache, int sectorNum) {
+    for (int i = *bucket_for(cache, sectorNum); i != NO_SLOT; i = cache->slots[i].next) {
+        if (cache->slots[i].sectorNum == sectorNum) return i;
+    }
+    return NO_SLOT;
+}
+
+static void unlink_slot(struct sectorcache *cache, int slot) {
+    int *link = bucket_for(cache, cache->slots[slot].sectorNum);
+    while (*link != slot) link = &cache->slots[*link].next;
+    *link = cache->slots[slot].next;
+    cache->slots[slot].sectorNum = NO_SLOT;
+}
+
+/**
+ * Picks the slot for a sector about to be read: an unused one while any are
+ * left, and otherwise the first slot the clock hand finds that hasn't been used
+ * since the hand last passed it.
+ */
+static int claim_slot(struct sectorcache *cache) {
+    if (cache->numUsed < cache->numSlots) return cache->numUsed++;
+    while (cache->slots[cache->hand].referenced) {
+        cache->slots[cache->hand].referenced = false;
+        cache->hand = (cache->hand + 1) % cache->numSlots;
+    }
+    int slot = cache->hand;
+    cache->hand = (cache->hand + 1) % cache->numSlots;
+    if (cache->slots[slot].sectorNum != NO_SLOT) {
+        unlink_slot(cache, slot);
+        cache->stats.evictions++;
+    }
+    return slot;
+}
+
+/**
+ * Reads a sector into buf, zero-filling whatever of it lies past the end of an
+ * image whose size isn't a whole number of sectors.  Returns false if none of
+ * the sector could be read.
+ */
+static bool read_sector(struct sectorcache *cache, int sectorNum, char *buf) {
+    int bytesRead = diskimg_readsector(cache->dfd, sectorNum, buf);
+    if (bytesRead <= 0) return false;
+    memset(buf + bytesRead, 0, DISKIMG_SECTOR_SIZE - bytesRead);
+    return true;
+}
+
+const void *sectorcache_getsector(struct sectorcache *cache, int sectorNum) {
+    if (cache->image != NULL) {
+        if (sectorNum < 0 || (long) sectorNum * DISKIMG_SECTOR_SIZE >= cache->imageSize) return NULL;
+        cache->stats.hits++;
+        long sectorStart = (long) sectorNum * DISKIMG_SECTOR_SIZE;
+        if (sectorStart + DISKIMG_SECTOR_SIZE <= cache->imageSize) return cache->image + sectorStart;
+        // The image's partial last sector is the only one that can land here, so scratch always holds it
+        int bytes = cache->imageSize - sectorStart;
+        memcpy(cache->scratch, cache->image + sectorStart, bytes);
+        memset(cache->scratch + bytes, 0, DISKIMG_SECTOR_SIZE - bytes);
+        return cache->scratch;
+    }
+    if (cache->numSlots == 0) {
+        cache->stats.misses++;
+        return read_sector(cache, sectorNum, cache->scratch) ? cache->scratch : NULL;
+    }
+
+    int slot = find_slot(cache, sectorNum);
+    if (slot != NO_SLOT) {
+        cache->stats.hits++;
+        cache->slots[slot].referenced = true;
+        return cache->data + (size_t) slot * DISKIMG_SECTOR_SIZE;
+    }
+
+    cache->stats.misses++;
+    slot = claim_slot(cache);
+    char *sector = cache->data + (size_t) slot * DISKIMG_SECTOR_SIZE;
+    if (!read_sector(cache, sectorNum, sector)) {
+        // Leave the slot empty for the clock hand to hand out again
+        cache->slots[slot].referenced = false;
+        return NULL;
+    }
+    int *bucket = bucket_for(cache, sectorNum);
+    cache->slots[slot] = (struct slot) {sectorNum, *bucket, true};
+    *bucket = slot;
+    return sector;
+}
+
+/**
+ * Caches a copy of a sector read some other way than into a slot.
+ */
+static void cache_sector(struct sectorcache *cache, int sectorNum, const void *data) {
+    int slot = claim_slot(cache);
+    memcpy(cache->data + (size_t) slot * DISKIMG_SECTOR_SIZE, data, DISKIMG_SECTOR_SIZE);
+    int *bucket = bucket_for(cache, sectorNum);
+    cache->slots[slot] = (struct slot) {sectorNum, *bucket, true};
+    *bucket = slot;
+}
+
+int sectorcache_readsectors(struct sectorcache *cache, int firstSector, int numSectors, void *buf) {
+    char *out = buf;
+    if (cache->image != NULL) {
+        if (firstSector < 0) return -1;
+        long start = (long) firstSector * DISKIMG_SECTOR_SIZE;
+        long length = (long) numSectors * DISKIMG_SECTOR_SIZE;
+        if (start + length > cache->imageSize) length = start < cache->imageSize ? cache->imageSize - start : 0;
+        memcpy(out, cache->image + start, length);
+        cache->stats.hits += numSectors;
+        return length;
+    }
+
+    int sector = 0;
+    while (sector < numSectors) {
+        int slot = cache->numSlots > 0 ? find_slot(cache, firstSector + sector) : NO_SLOT;
+        if (slot != NO_SLOT) {
+            cache->stats.hits++;
+            cache->slots[slot].referenced = true;
+            memcpy(out + (size_t) sector * DISKIMG_SECTOR_SIZE, cache->data + (size_t) slot * DISKIMG_SECTOR_SIZE,
+                   DISKIMG_SECTOR_SIZE);
+            sector++;
+            continue;
+        }
+
+        // Read the whole run of uncached sectors from here on at once
+        int runEnd = sector + 1;
+        while (runEnd < numSectors && (cache->numSlots == 0 || find_slot(cache, firstSector + runEnd) == NO_SLOT)) {
+            runEnd++;
+        }
+        char *run = out + (size_t) sector * DISKIMG_SECTOR_SIZE;
+        int bytesRead = diskimg_readsectors(cache->dfd, firstSector + sector, runEnd - sector, run);
+        if (bytesRead < 0) return -1;
+        cache->stats.misses += runEnd - sector;
+        if (cache->numSlots > 0) {
+            for (int i = 0; i < bytesRead / DISKIMG_SECTOR_SIZE; i++) {
+                cache_sector(cache, firstSector + sector + i, run + (size_t) i * DISKIMG_SECTOR_SIZE);
+            }
+        }
+        if (bytesRead < (runEnd - sector) * DISKIMG_SECTOR_SIZE) {
+            return sector * DISKIMG_SECTOR_SIZE + bytesRead;
+        }
+        sector = runEnd;
+    }
+    return numSectors * DISKIMG_SECTOR_SIZE;
+}
+
+const void *sectorcache_getsectors(struct sectorcache *cache, int firstSector, int numSectors) {
+    if (cache->image != NULL) {
+        if (firstSector < 0 || (long) (firstSector + numSectors) * DISKIMG_SECTOR_SIZE > cache->imageSize) return NULL;
+        cache->stats.hits += numSectors;
+        return cache->image + (size_t) firstSector * DISKIMG_SECTOR_SIZE;
+    }
+    return numSectors == 1 ? sectorcache_getsector(cache, firstSector) : NULL;
+}
+
+void sectorcache_prefetch(struct sectorcache *cache, int firstSector, int numSectors) {
+    if (cache->image != NULL || cache->numSlots == 0) {
+        (void) diskimg_prefetch(cache->dfd, firstSector, numSectors);
+        return;
+    }
+    int sector = 0;
+    while (sector < numSectors) {
+        if (find_slot(cache, firstSector + sector) != NO_SLOT) {
+            sector++;
+            continue;
+        }
+        int runEnd = sector + 1;
+        while (runEnd < numSectors && find_slot(cache, firstSector + runEnd) == NO_SLOT) runEnd++;
+        (void) diskimg_prefetch(cache->dfd, firstSector + sector, runEnd - sector);
+        sector = runEnd;
+    }
+}
+
+int sectorcache_readsector(struct sectorcache *cache, int sectorNum, void *buf) {
+    const void *sector = sectorcache_getsector(cache, sectorNum);
+    if (sector == NULL) {
+        // Sectors wholly past the end of the image still get diskimg_readsector's answer
+        return diskimg_readsector(cache->dfd, sectorNum, buf);
+    }
+    memcpy(buf, sector, DISKIMG_SECTOR_SIZE);
+    return DISKIMG_SECTOR_SIZE;
+}
+
+void sectorcache_getstats(const struct sectorcache *cache, struct sectorcache_stats *stats) {
+    *stats = cache->stats;
+}
+
+void sectorcache_free(struct sectorcache *cache) {
+    if (cache == NULL) return;
+    if (cache->image != NULL) diskimg_unmap(cache->image, cache->imageSize);
+    free(cache->buckets);
+    free(cache->slots);
+    free(cache->data);
+    free(cache);
+}
@@ -0,0 +1,89 @@
+#ifndef _SECTORCACHE_H_
+#define _SECTORCACHE_H_
+
+/**
+ * A cache of disk sectors in front of the diskimg module.  Every layer of the
+ * filesystem reads the disk through its unixfilesystem's cache, so the inode
+ * sectors and indirect blocks that each lookup revisits are read from the disk
+ * image once instead of once per use.  Sectors are replaced with the CLOCK
+ * algorithm (an approximation of LRU that needs one reference bit per slot).
+ * The image is assumed not to change while it's cached.
+ *
+ * A mapped cache (see sectorcache_create_mapped) instead maps the whole image
+ * into memory and hands out pointers straight into it, leaving the caching to
+ * the kernel's page cache.
+ */
+
+// Sectors cached when no other size is asked for: 512 KB
+#define SECTORCACHE_DEFAULT_SECTORS 1024
+
+struct sectorcache_stats {
+    long hits;       // reads answered from the cache (or, when mapped, from the mapping)
+    long misses;     // reads that went to the disk image
+    long evictions;  // cached sectors replaced to make room for others
+};
+
+struct sectorcache;
+
+/**
+ * Creates a cache of up to numSectors sectors of the disk image open on dfd.
+ * A cache of 0 sectors reads every sector from the disk image.  Returns NULL
+ * if out of memory.
+ */
+struct sectorcache *sectorcache_create(int dfd, int numSectors);
+
+/**
+ * Creates a cache that reads the disk image open on dfd through a read-only
+ * mapping of the whole image.  Returns NULL if the image can't be mapped.
+ */
+struct sectorcache *sectorcache_create_mapped(int dfd);
+
+/**
+ * Copies the specified sector into buf, which must hold DISKIMG_SECTOR_SIZE
+ * bytes.  Returns the number of bytes read, or -1 on error, just like
+ * diskimg_readsector.
+ */
+int sectorcache_readsector(struct sectorcache *cache, int sectorNum, void *buf);
+
+/**
+ * Copies numSectors consecutive sectors, starting with firstSector, into buf.
+ * Cached sectors are copied from the cache, and each run of uncached ones is read
+ * from the disk image with a single diskimg_readsectors call (and then cached).
+ * Returns the number of bytes read, or -1 on error, just like diskimg_readsectors.
+ */
+int sectorcache_readsectors(struct sectorcache *cache, int firstSector, int numSectors, void *buf);
+
+/**
+ * Returns numSectors consecutive sectors, starting with firstSector, in place
+ * when the cache holds them one after another in memory (always, when it's
+ * mapped), or NULL otherwise; then sectorcache_readsectors copies them instead.
+ * The sectors stay valid as long as sectorcache_getsector's would.
+ */
+const void *sectorcache_getsectors(struct sectorcache *cache, int firstSector, int numSectors);
+
+/**
+ * Starts reading any of numSectors consecutive sectors, starting with
+ * firstSector, that aren't cached in the background (see diskimg_prefetch), so
+ * they're ready by the time they're read.
+ */
+void sectorcache_prefetch(struct sectorcache *cache, int firstSector, int numSectors);
+
+/**
+ * Returns the specified sector's contents without copying them, or NULL if the
+ * sector can't be read.  If the image ends partway through the sector, the rest
+ * of it reads as zeros.  The contents stay valid only until the next
+ * call on this cache, or, for a mapped cache, until the cache is freed.
+ */
+const void *sectorcache_getsector(struct sectorcache *cache, int sectorNum);
+
+/**
+ * Fills in stats with the hits, misses and evictions so far.
+ */
+void sectorcache_getstats(const struct sectorcache *cache, struct sectorcache_stats *stats);
+
+/**
+ * Frees the cache, unmapping the image if it's mapped.  The disk image stays open.
+ */
+void sectorcache_free(struct sectorcache *cache);
+
+#endif // _SECTORCACHE_H_
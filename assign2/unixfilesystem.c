@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include "unixfilesystem.h"
 #include "diskimg.h" 
+#include "inode.h"
+#include "directory.h"
 
 /**
  * Allocates and initializes a struct unixfilesystem given a filedescriptor to 
@@ -41,5 +43,37 @@ struct unixfilesystem *unixfilesystem_init(int dfd) {
     return NULL;
   }
 
+  fs->cache = sectorcache_create(dfd, SECTORCACHE_DEFAULT_SECTORS);
+  fs->inodes = inode_createtable(fs);
+  fs->dentries = directory_createcache(fs);
+  if (fs->cache == NULL || fs->inodes == NULL || fs->dentries == NULL) {
+    fprintf(stderr,"Out of memory.\n");
+    unixfilesystem_free(fs);
+    return NULL;
+  }
+
   return fs;
 }
+
+int unixfilesystem_setcachesize(struct unixfilesystem *fs, int numSectors) {
+  struct sectorcache *cache = sectorcache_create(fs->dfd, numSectors);
+  if (cache == NULL) return -1;
+  sectorcache_free(fs->cache);
+  fs->cache = cache;
+  return 0;
+}
+
+int unixfilesystem_usemap(struct unixfilesystem *fs) {
+  struct sectorcache *cache = sectorcache_create_mapped(fs->dfd);
+  if (cache == NULL) return -1;
+  sectorcache_free(fs->cache);
+  fs->cache = cache;
+  return 0;
+}
+
+void unixfilesystem_free(struct unixfilesystem *fs) {
+  directory_freecache(fs->dentries);
+  inode_freetable(fs->inodes);
+  sectorcache_free(fs->cache);
+  free(fs);
+}
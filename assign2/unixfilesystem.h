@@ -8,6 +8,7 @@
 #include "filsys.h"     // Superblock definition
 #include "ino.h"        // Inode definition
 #include "direntv6.h"   // Directory entry
+#include "sectorcache.h"
 
 /**
  * The layout of the Unix disk looked as follows:
@@ -28,8 +29,36 @@
 struct unixfilesystem {
   int dfd; // Handle from the diskimg module to read the diskimg.
   struct filsys superblock;  // The superblock read from the diskimage.
+  struct sectorcache *cache; // Every read of the diskimage after the superblock goes through here.
+  struct inodetable *inodes; // In-core inodes and block maps (see inode.c).
+  struct dentrycache *dentries; // Indexed directory entries (see directory.c).
 };
 
+/**
+ * Allocates a struct unixfilesystem for the disk image open on fd, with a cache of
+ * SECTORCACHE_DEFAULT_SECTORS sectors.  Returns NULL on error.
+ */
 struct unixfilesystem *unixfilesystem_init(int fd);
 
+/**
+ * Replaces the filesystem's sector cache with an empty one of numSectors sectors
+ * (0 turns caching off).  Returns 0 on success, or -1 if out of memory, in which
+ * case the old cache stays.
+ */
+int unixfilesystem_setcachesize(struct unixfilesystem *fs, int numSectors);
+
+/**
+ * Switches the filesystem to reading the disk image through a read-only mapping of
+ * the whole image, so every sector (and, through inode_iget_ptr and
+ * file_getblock_ptr, every inode and file block) is read in place.  Returns 0 on
+ * success, or -1 if the image can't be mapped, in which case the filesystem keeps
+ * reading through its cache.
+ */
+int unixfilesystem_usemap(struct unixfilesystem *fs);
+
+/**
+ * Frees a struct unixfilesystem and its cache.  The disk image stays open.
+ */
+void unixfilesystem_free(struct unixfilesystem *fs);
+
 #endif // _UNIXFILESYSTEM_H_